@@ -0,0 +1,244 @@
+/*
+ * Boot time benchmark for the ATmega8 image, run under simavr.
+ *
+ * Loads combined.hex (bootloader + firmware), starts the core at the
+ * bootloader reset vector the way the BOOTRST fuse does, and acts as the I2C
+ * master: every poll interval it reads a report frame from the application
+ * address. Prints the simulated time at which the bootloader handed over to
+ * the app, the app enabled its TWI slave, the first report frame with a
+ * valid CRC arrived, and the backlight fade-in sent its last EasyScale frame
+ * on LCD_1W (PC3).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sim_avr.h"
+#include "sim_hex.h"
+#include "avr_twi.h"
+#include "avr_ioport.h"
+
+#include "topper_protocol.h"
+
+#define MCU_NAME            "atmega8"
+#define MCU_FREQ            8000000UL
+#define BOOTLOADER_START    0x1C00
+
+/* ATmega8 data-space addresses (I/O address + 0x20) */
+#define ADDR_TWAR           0x22
+#define ADDR_TWCR           0x56
+
+#define TWCR_TWEN           (1 << 2)
+
+#define POLL_INTERVAL_US    1000        /* time between master read attempts */
+#define TIMEOUT_MS          3000        /* give up after this much simulated time */
+#define FADE_QUIET_MS       200         /* LCD_1W idle this long after a frame ends the fade */
+#define LCD_1W_PORT         'C'
+#define LCD_1W_PIN          3
+
+#define US_TO_CYCLES(us)    ((avr_cycle_count_t)(us) * (MCU_FREQ / 1000000UL))
+#define CYCLES_TO_MS(c)     ((double)(c) * 1000.0 / MCU_FREQ)
+
+typedef enum {
+    MASTER_IDLE,
+    MASTER_ADDR,        /* START + SLA+R sent, waiting for ACK */
+    MASTER_DATA,        /* clocking frame bytes in */
+} master_state_t;
+
+typedef struct {
+    avr_t             *avr;
+    avr_irq_t         *twi_in;
+    master_state_t     state;
+    uint8_t            frame[REPORT_LEN];
+    uint8_t            received;
+    avr_cycle_count_t  app_entry;
+    avr_cycle_count_t  twi_ready;
+    avr_cycle_count_t  first_frame;
+    avr_cycle_count_t  fade_start;      /* first LCD_1W edge in the app */
+    avr_cycle_count_t  fade_end;        /* latest LCD_1W edge */
+    unsigned           fade_edges;
+    unsigned           attempts;
+} bench_t;
+
+static void master_send(bench_t *b, uint8_t cond, uint8_t addr, uint8_t data)
+{
+    avr_raise_irq(b->twi_in, avr_twi_irq_msg(cond, addr, data));
+}
+
+static void master_request_byte(bench_t *b)
+{
+    /* ACK every byte but the last, like the Linux i2c-dev master does */
+    uint8_t ack = (b->received + 1 < REPORT_LEN) ? TWI_COND_ACK : 0;
+    master_send(b, TWI_COND_READ | ack, I2C_APP_ADDR << 1 | 1, 0);
+}
+
+static void master_stop(bench_t *b)
+{
+    master_send(b, TWI_COND_STOP, I2C_APP_ADDR << 1 | 1, 0);
+    b->state = MASTER_IDLE;
+}
+
+static void frame_done(bench_t *b)
+{
+    uint16_t computed = topper_crc16(b->frame, REPORT_CRC);
+    uint16_t received = (uint16_t)b->frame[REPORT_CRC] |
+                        ((uint16_t)b->frame[REPORT_CRC + 1] << 8);
+
+    master_stop(b);
+    if (computed == received && !b->first_frame)
+        b->first_frame = b->avr->cycle;
+}
+
+/* Slave responses: address/data ACKs and transmitted bytes */
+static void twi_output_hook(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    bench_t            *b = param;
+    avr_twi_msg_irq_t   msg;
+    (void)irq;
+
+    msg.u.v = value;
+
+    switch (b->state) {
+        case MASTER_ADDR:
+            if (msg.u.twi.msg & TWI_COND_ACK) {
+                b->state    = MASTER_DATA;
+                b->received = 0;
+                master_request_byte(b);
+            }
+            break;
+
+        case MASTER_DATA:
+            if (msg.u.twi.msg & TWI_COND_READ) {
+                b->frame[b->received++] = msg.u.twi.data;
+                if (b->received == REPORT_LEN)
+                    frame_done(b);
+                else
+                    master_request_byte(b);
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* EasyScale traffic to the TPS61160 backlight driver */
+static void lcd_1w_hook(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+    bench_t *b = param;
+    (void)irq;
+    (void)value;
+
+    if (!b->app_entry)
+        return;
+    if (!b->fade_start)
+        b->fade_start = b->avr->cycle;
+    b->fade_end = b->avr->cycle;
+    b->fade_edges++;
+}
+
+static int fade_settled(const bench_t *b)
+{
+    return b->fade_end &&
+           b->avr->cycle - b->fade_end >= US_TO_CYCLES((uint64_t)FADE_QUIET_MS * 1000);
+}
+
+static int load_hex(avr_t *avr, const char *path)
+{
+    ihex_chunk_p chunks = NULL;
+    int          count  = read_ihex_chunks(path, &chunks);
+    int          i;
+
+    if (count <= 0) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        if (chunks[i].baseaddr + chunks[i].size > avr->flashend + 1) {
+            fprintf(stderr, "%s: data at 0x%04X exceeds flash\n", path, chunks[i].baseaddr);
+            return -1;
+        }
+        memcpy(avr->flash + chunks[i].baseaddr, chunks[i].data, chunks[i].size);
+    }
+    free_ihex_chunks(chunks);
+    return 0;
+}
+
+static void print_event(const char *what, avr_cycle_count_t cycle)
+{
+    if (cycle)
+        printf("  %-28s %8.3f ms\n", what, CYCLES_TO_MS(cycle));
+    else
+        printf("  %-28s %8s\n", what, "never");
+}
+
+int main(int argc, char *argv[])
+{
+    const char        *hex  = argc > 1 ? argv[1] : "../combined.hex";
+    bench_t            b    = {0};
+    avr_cycle_count_t  next_poll;
+    avr_cycle_count_t  timeout = US_TO_CYCLES((uint64_t)TIMEOUT_MS * 1000);
+    int                state;
+
+    b.avr = avr_make_mcu_by_name(MCU_NAME);
+    if (!b.avr) {
+        fprintf(stderr, "simavr does not know %s\n", MCU_NAME);
+        return 2;
+    }
+    avr_init(b.avr);
+    b.avr->frequency = MCU_FREQ;
+
+    if (load_hex(b.avr, hex) < 0)
+        return 2;
+
+    /* hfuse 0xDA programs BOOTRST: execution starts at the bootloader */
+    b.avr->reset_pc = BOOTLOADER_START;
+    b.avr->pc       = BOOTLOADER_START;
+
+    b.twi_in = avr_io_getirq(b.avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT);
+    avr_irq_register_notify(avr_io_getirq(b.avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT),
+                            twi_output_hook, &b);
+    avr_irq_register_notify(avr_io_getirq(b.avr, AVR_IOCTL_IOPORT_GETIRQ(LCD_1W_PORT), LCD_1W_PIN),
+                            lcd_1w_hook, &b);
+
+    next_poll = US_TO_CYCLES(POLL_INTERVAL_US);
+
+    do {
+        state = avr_run(b.avr);
+
+        if (!b.app_entry && b.avr->pc < BOOTLOADER_START)
+            b.app_entry = b.avr->cycle;
+
+        if (b.app_entry && !b.twi_ready &&
+            b.avr->data[ADDR_TWAR] >> 1 == I2C_APP_ADDR &&
+            (b.avr->data[ADDR_TWCR] & TWCR_TWEN))
+            b.twi_ready = b.avr->cycle;
+
+        if (b.avr->cycle >= next_poll) {
+            next_poll += US_TO_CYCLES(POLL_INTERVAL_US);
+
+            /* Abandon a read the slave never finished, as a bus timeout would */
+            if (b.state != MASTER_IDLE)
+                master_stop(&b);
+
+            b.attempts++;
+            b.state = MASTER_ADDR;
+            master_send(&b, TWI_COND_START | TWI_COND_ADDR, I2C_APP_ADDR << 1 | 1, 0);
+        }
+    } while (!(b.first_frame && fade_settled(&b)) && b.avr->cycle < timeout &&
+             state != cpu_Done && state != cpu_Crashed);
+
+    printf("Boot timeline (%s, %lu Hz):\n", hex, MCU_FREQ);
+    print_event("Bootloader -> application", b.app_entry);
+    print_event("TWI slave enabled at 0x30", b.twi_ready);
+    print_event("First valid report frame", b.first_frame);
+    print_event("Backlight fade-in started", b.fade_start);
+    print_event(fade_settled(&b) ? "Backlight fade-in done" : "Backlight fade-in unfinished",
+                b.fade_end);
+    printf("  %-28s %8u\n", "LCD_1W edges", b.fade_edges);
+    printf("  %-28s %8u\n", "Read attempts", b.attempts);
+
+    return b.first_frame ? 0 : 1;
+}
@@ -6,19 +6,25 @@
 #include <avr/io.h>
 #include <avr/boot.h>
 #include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
 
-#define BOOTLOADER_VERSION          0x01
-#define TWI_ADDRESS                 0x29
+#include "topper_protocol.h"
+
+/*
+ * BL_VERIFY_CACHE=1 remembers a passed app checksum in EEPROM_BL_VERIFIED so
+ * later power-ups jump straight to the app instead of re-summing 7KB of flash.
+ * The marker is cleared whenever the bootloader stays active, before any page
+ * can be erased.
+ */
+#ifndef BL_VERIFY_CACHE
+#define BL_VERIFY_CACHE             0
+#endif
 
 /* Timer0: F_CPU / 1024, free-running overflow period = 256 * 1024 / F_CPU */
 #define TIMER_DIVISOR               1024
 #define TIMER_OVF_PER_SEC           (F_CPU / ((uint32_t)TIMER_DIVISOR * 256))
 
-/* I2C protocol commands */
-#define CMD_READ_INFO               0x01
-#define CMD_WRITE_PAGE              0x03  /* page number byte precedes the 64 data bytes */
-#define CMD_FINALIZE                0x05
-
 /* TWI slave receiver status codes (ATmega8 datasheet table 22-2) */
 #define TWI_SR_SLA_ACK              0x60    /* SLA+W received, ACK returned */
 #define TWI_SR_DATA_ACK             0x80    /* data received, ACK returned */
@@ -35,11 +41,6 @@
 #define BL_HOLD                     0x00
 #define BL_JUMP_APP                 0x01
 
-/* Verification status codes (bit patterns with Hamming distance 8 from each other) */
-#define VERIFY_PENDING              0x00
-#define VERIFY_FAILED               0x55
-#define VERIFY_PASSED               0xAA
-
 /* TWI ACK control helpers */
 #define TWI_CLEAR_ACK(ctrl)         ((ctrl) &= ~(1<<TWEA))
 #define TWI_SET_ACK(ctrl)           ((ctrl) |=  (1<<TWEA))
@@ -48,15 +49,13 @@
 #define LCD_CONTROL                 (1<<PC3)
 #define BTN_DISP                    (1<<PC2)
 
-static uint8_t          bl_mode                  = BL_HOLD;
 static uint8_t          page_buf[SPM_PAGESIZE];
 static uint16_t         flash_addr;
-static volatile uint8_t page_write_pending       = 0;
-static volatile uint8_t page_write_ready         = 0;
-static volatile uint8_t checksum_verify_pending  = 0;
-static uint8_t          verify_status            = VERIFY_PENDING;
-static uint8_t          info_bytes[6];
-static uint8_t          info_checksum[3];
+static uint8_t          page_write_pending       = 0;
+static uint8_t          page_write_ready         = 0;
+static uint8_t          checksum_verify_pending  = 0;
+/* CMD_READ_INFO reply: 6 info bytes followed by their 3-byte checksum */
+static uint8_t          info_bytes[9];
 
 
 static void write_flash_page(void)
@@ -90,9 +89,9 @@ static void update_info_checksum(void)
         sum2 += sum1;
         xor  ^= info_bytes[i];
     }
-    info_checksum[0] = sum1;
-    info_checksum[1] = sum2;
-    info_checksum[2] = xor;
+    info_bytes[6] = sum1;
+    info_bytes[7] = sum2;
+    info_bytes[8] = xor;
 }
 
 
@@ -125,6 +124,22 @@ static uint8_t flash_verify_checksum(void)
 }
 
 
+/* Boot-time check: trusts the EEPROM marker when BL_VERIFY_CACHE is enabled. */
+static uint8_t app_verified(void)
+{
+#if BL_VERIFY_CACHE
+    if (eeprom_read_byte((uint8_t *)EEPROM_BL_VERIFIED) == VERIFY_PASSED)
+        return 1;
+    if (!flash_verify_checksum())
+        return 0;
+    eeprom_write_byte((uint8_t *)EEPROM_BL_VERIFIED, VERIFY_PASSED);
+    return 1;
+#else
+    return flash_verify_checksum();
+#endif
+}
+
+
 static void twi_handle(void)
 {
     static uint8_t cmd = 0;
@@ -241,10 +256,8 @@ static void twi_handle(void)
             switch (cmd)
             {
                 case CMD_READ_INFO:
-                    if (byte_cnt < 6)
+                    if (byte_cnt < 9)
                         tx_data = info_bytes[byte_cnt];
-                    else if (byte_cnt < 9)
-                        tx_data = info_checksum[byte_cnt - 6];
                     if (byte_cnt == 8)
                         TWI_CLEAR_ACK(twi_ctrl);
                     break;
@@ -273,6 +286,25 @@ static void twi_handle(void)
 }
 
 
+/*
+ * Returns 1 if the app wrote BL_REQUEST_MAGIC and reset through the watchdog.
+ * The marker is erased either way so it is honoured at most once.
+ */
+static uint8_t app_requested_bootloader(void)
+{
+    uint8_t wdt_reset = MCUCSR & (1<<WDRF);
+    uint8_t marker    = eeprom_read_byte((uint8_t *)EEPROM_BL_REQUEST);
+
+    MCUCSR = 0;
+    wdt_disable();
+
+    if (marker == 0xFF)
+        return 0;
+    eeprom_write_byte((uint8_t *)EEPROM_BL_REQUEST, 0xFF);
+    return wdt_reset && marker == BL_REQUEST_MAGIC;
+}
+
+
 void init1(void) __attribute__((naked, section(".init1")));
 void init1(void)
 {
@@ -284,8 +316,10 @@ void init1(void)
 int main(void) __attribute__((OS_main, section(".init9")));
 int main(void)
 {
+    uint8_t bl_mode = BL_HOLD;
+    uint8_t hold;
+
     /* explicitly re-init critical state rather than relying on .bss clearing */
-    bl_mode            = BL_HOLD;
     page_write_pending = 0;
     page_write_ready   = 0;
 
@@ -301,43 +335,50 @@ int main(void)
     TCCR0 = (1<<CS02) | (1<<CS00);
 
     /* TWI: set slave address, enable auto-ACK */
-    TWAR  = (TWI_ADDRESS << 1);
+    TWAR  = (I2C_BL_ADDR << 1);
     TWCR  = (1<<TWEA) | (1<<TWEN);
 
     /* --- BOOT ENTRY LOGIC --- */
-    if (PINC & BTN_DISP)
-    {
-        /* Button not pressed: boot app only if embedded checksum is valid */
-        if (flash_verify_checksum())
-            bl_mode = BL_JUMP_APP;
-    }
-    else
+    /* App received I2C_CMD_BOOTLOADER: stay active for an unattended update */
+    hold = app_requested_bootloader();
+
+    if (!hold && !(PINC & BTN_DISP))
     {
         /* Button pressed: wait up to 1 second for release.
          * Releasing early boots the app (if checksum valid); holding the full second stays in bootloader. */
         uint8_t ovf_count = 0;
-        while (ovf_count < (uint8_t)TIMER_OVF_PER_SEC)
+        while (!(PINC & BTN_DISP))
         {
-            while (!(TIFR & (1<<TOV0)));
-            TIFR = (1<<TOV0);
-            ovf_count++;
-
-            if (PINC & BTN_DISP)
+            if (ovf_count == (uint8_t)TIMER_OVF_PER_SEC)
             {
-                if (flash_verify_checksum())
-                    bl_mode = BL_JUMP_APP;
+                hold = 1;
                 break;
             }
+            while (!(TIFR & (1<<TOV0)));
+            TIFR = (1<<TOV0);
+            ovf_count++;
         }
     }
 
+    /* Boot the app only if its embedded checksum is valid */
+    if (!hold && app_verified())
+        bl_mode = BL_JUMP_APP;
+
     if (bl_mode == BL_HOLD)
+    {
         PORTC |= LCD_CONTROL;
+#if BL_VERIFY_CACHE
+        /* Pages may be erased from here on; SPM must not start while the EEPROM write is in progress */
+        if (eeprom_read_byte((uint8_t *)EEPROM_BL_VERIFIED) != VERIFY_PENDING)
+            eeprom_write_byte((uint8_t *)EEPROM_BL_VERIFIED, VERIFY_PENDING);
+        eeprom_busy_wait();
+#endif
+    }
 
     info_bytes[0] = SIGNATURE_0;
     info_bytes[1] = SIGNATURE_1;
     info_bytes[2] = SIGNATURE_2;
-    info_bytes[3] = BOOTLOADER_VERSION;
+    info_bytes[3] = BOOTLOADER_VERSION_ATMEGA8;
     info_bytes[4] = (uint8_t)(BOOTLOADER_START / SPM_PAGESIZE);
     info_bytes[5] = VERIFY_PENDING;
     update_info_checksum();
@@ -361,12 +402,14 @@ int main(void)
             checksum_verify_pending = 0;
             if (flash_verify_checksum())
             {
-                verify_status = VERIFY_PASSED;
+                info_bytes[5] = VERIFY_PASSED;
                 bl_mode = BL_JUMP_APP;
+#if BL_VERIFY_CACHE
+                eeprom_write_byte((uint8_t *)EEPROM_BL_VERIFIED, VERIFY_PASSED);
+#endif
             }
             else
-                verify_status = VERIFY_FAILED;
-            info_bytes[5] = verify_status;
+                info_bytes[5] = VERIFY_FAILED;
             update_info_checksum();
             TWCR = (1<<TWEN) | (1<<TWEA);
         }
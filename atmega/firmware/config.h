@@ -4,22 +4,41 @@
 // Button configuration macros
 #define BTN_DEBOUNCE_DURATION 10  // Buttons will remain "pressed" for this many loops
 
-#define I2C_ADDR 0x30
 #define I2C_IDLE_TRIGGER 200    // I2C timeout in number of NORMAL_MODE_LOOP_MS loops
 
+// TWI slave receiver status codes (ATmega8 datasheet table 22-2)
+#define TWI_SR_SLA_ACK 0x60     // SLA+W received, ACK returned
+#define TWI_SR_DATA_ACK 0x80    // Data received, ACK returned
+#define TWI_SR_DATA_NACK 0x88   // Data received, NACK returned
+#define TWI_SR_STOP 0xA0        // STOP or repeated START received
+
+// TWI slave transmitter status codes (ATmega8 datasheet table 22-3)
+#define TWI_ST_SLA_ACK 0xA8     // SLA+R received, ACK returned
+#define TWI_ST_DATA_ACK 0xB8    // Data sent, ACK received
+#define TWI_ST_DATA_NACK 0xC0   // Data sent, NACK received
+#define TWI_ST_LAST_ACK 0xC8    // Last data byte sent, ACK received
+
+// TWCR value that releases the bus and keeps the slave addressable
+#define TWI_CTRL_ACK ((1<<TWINT) | (1<<TWEA) | (1<<TWEN) | (1<<TWIE))
+
 // EEPROM Addresses
 #define EEPROM_BRIGHT_ADDR 0
 #define EEPROM_DDRB 1
 #define EEPROM_PORTB 2
 #define EEPROM_DDRD 3
 #define EEPROM_PORTD 4
+// EEPROM_BL_* addresses in topper_protocol.h are reserved by the bootloader
 
 // Brightness Configuration
 #define BRIGHTNESS_DEFAULT 4 // 0-7 are valid
+#define FADE_STEP_MS 20      // Time between backlight steps when fading on/off
+#define BACKLIGHT_RAW(level) ((uint8_t)((level) * 4 + 1))  // Brightness 0-7 to EasyScale 1-29
 
 // Pin Definitions
 #define BTN_DISP C,2
 #define LCD_1W C,3
+#define TWI_SDA C,4
+#define TWI_SCL C,5
 
 // ADC pins
 #define JOY_LX 0
@@ -50,21 +69,9 @@
 // TPS61160 Backlight EasyScale Protocol
 #define LCD_ADDR 0x72
 
-// I2C Command IDs
-#define I2C_CMD_BRIGHT 0x10
-#define I2C_CMD_CRC 0x20
-#define I2C_CMD_GPIO_ALL 0x30
-#define I2C_CMD_GPIO_SAVE 0x40
-#define I2C_CMD_VERSION 0x50
-#define I2C_CMD_GPIO_READ 0x60
-
 // Firmware Version (max 7 characters)
 #define FW_VERSION "1.0"
 
-// I2C Command Values
-#define I2C_BRIGHT_DISABLE 8  // Send this value with I2C_CMD_BRIGHT to disable display
-#define I2C_BRIGHT_ENABLE 9   // Send this value with I2C_CMD_BRIGHT to enable display at previous brightness
-
 // LCD timing parameters (microseconds)
 #define T_START 10   // Start condition
 #define T_EOS 10     // End of sequence
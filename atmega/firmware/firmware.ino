@@ -1,7 +1,14 @@
 #include <Arduino.h>
-#include <Wire.h>
 #include <EEPROM.h>
+#include <avr/wdt.h>
 #include "config.h"
+#include "topper_protocol.h"
+
+struct DisplayFade {
+  uint8_t current;          // EasyScale level last sent (0 = backlight off)
+  uint8_t target;           // Level the fade is heading towards
+  unsigned long lastStep;   // millis() of the last fade step
+};
 
 struct SystemState {
   uint8_t debounceCount[16];
@@ -26,17 +33,32 @@ struct i2cStructure {
   uint16_t crc16;
 };
 
+static_assert(sizeof(i2cStructure) == REPORT_LEN, "i2cStructure must match the report frame layout");
+
 // Global state declarations
 SystemState state;
+DisplayFade fade;
 i2cStructure i2cdata;
-volatile byte rxData[5];
+volatile byte rxData[I2C_CMD_MAX_LEN];
 volatile bool pendingCommand = false;
+volatile uint8_t pendingLen = 0;  // bytes in rxData for the pending command
 volatile bool versionMode = false;
 volatile bool pinInfoMode = false;
-uint8_t versionBytes[7] = {0};
-uint16_t versionCRC = 0;
+uint8_t versionFrame[VERSIONFRAME_LEN] = {0};
+uint8_t pinFrame[PINFRAME_LEN];
 unsigned long lastUpdateTime = 0;
-uint16_t crcTable[256];
+
+// Published copies of i2cdata. The TWI ISR transmits straight out of
+// reports[reportFront]; the main loop fills the other buffer and flips.
+#define REPORT_NONE 0xFF
+i2cStructure reports[2];
+volatile uint8_t reportFront = 0;
+volatile uint8_t reportInFlight = REPORT_NONE;  // Buffer currently being clocked out
+
+// TWI slave state
+const uint8_t* volatile twiTxPtr;
+volatile uint8_t twiTxLen = 0;
+volatile uint8_t twiRxLen = 0;
 
 // Loop control
 #define UPDATE_INTERVAL_REACHED currentTime - lastUpdateTime >= LOOP_MS
@@ -61,30 +83,6 @@ void initGPIOs() {
   setPinHigh(BTN_DISP);
 }
 
-void generateCRCTable() {
-  const uint16_t poly = 0x1021;
-
-  for (uint16_t i = 0; i < 256; i++) {
-    uint16_t crc = i << 8;
-    for (uint8_t j = 0; j < 8; j++) {
-      if (crc & 0x8000) {
-        crc = (crc << 1) ^ poly;
-      } else {
-        crc = crc << 1;
-      }
-    }
-    crcTable[i] = crc;
-  }
-}
-
-uint16_t calculateCRC(const uint8_t* data, uint8_t len) {
-  uint16_t crc = 0xFFFF;
-  for (uint8_t i = 0; i < len; i++) {
-    crc = (crc << 8) ^ crcTable[(crc >> 8) ^ data[i]];
-  }
-  return crc;
-}
-
 void readEEPROM() {
   uint8_t brightness = EEPROM.read(EEPROM_BRIGHT_ADDR);
 
@@ -100,13 +98,9 @@ void writeBrightnessToEEPROM() {
   EEPROM.update(EEPROM_BRIGHT_ADDR, i2cdata.status.brightness);
 }
 
-void setBrightness() {
-  // Verify display is currently enabled
-  if (!readPin(LCD_1W)) {
-    return;
-  }
-
-  byte bytesToSend[] = {LCD_ADDR, (byte)(i2cdata.status.brightness * 4 + 1)};
+// Send one EasyScale brightness value (1-31) to the TPS61160
+void writeBacklightRaw(uint8_t raw) {
+  byte bytesToSend[] = {LCD_ADDR, raw};
 
   noInterrupts();
   for (int byte = 0; byte < 2; byte++) {
@@ -127,90 +121,78 @@ void setBrightness() {
     delayMicroseconds(T_EOS);
     setPinHigh(LCD_1W);
   }
-
   interrupts();
+}
+
+void setBrightness() {
+  // Verify display is currently enabled
+  if (!i2cdata.status.display_on) {
+    return;
+  }
+
+  // Jump straight to the new level, cancelling any fade in progress
+  fade.target = BACKLIGHT_RAW(i2cdata.status.brightness);
+  fade.current = fade.target;
+  writeBacklightRaw(fade.current);
+
   // Always update the eeprom when brightness is set
   writeBrightnessToEEPROM();
 }
 
 void disableDisplay() {
   // Verify that the display isn't already off
-  if (!readPin(LCD_1W)) {
+  if (!i2cdata.status.display_on) {
     return;
   }
 
+  // Fade down in updateDisplayFade(); the pin is pulled low once it reaches 0
   i2cdata.status.display_on = false;
-  uint8_t currentRaw = i2cdata.status.brightness * 4 + 1;
-
-  for (uint8_t rawBrightness = currentRaw; rawBrightness >= 1; rawBrightness--) {
-    byte bytesToSend[] = {LCD_ADDR, rawBrightness};
-
-    noInterrupts();
-    for (int byte = 0; byte < 2; byte++) {
-      delayMicroseconds(T_START);
-
-      for (int i = 7; i >= 0; i--) {
-        bool bit = bytesToSend[byte] & (1 << i);
-        setPinLow(LCD_1W);
-        delayMicroseconds(bit ? T_L_HB : T_L_LB);
-        setPinHigh(LCD_1W);
-        delayMicroseconds(bit ? T_H_HB : T_H_LB);
-      }
-
-      setPinLow(LCD_1W);
-      delayMicroseconds(T_EOS);
-      setPinHigh(LCD_1W);
-    }
-    interrupts();
-
-    delay(20);
-  }
-
-  setPinLow(LCD_1W);
+  fade.target = 0;
 }
 
 void enableDisplay() {
   // Verify that the display isn't already on
-  if (readPin(LCD_1W)) {
+  if (i2cdata.status.display_on) {
     return;
   }
 
   i2cdata.status.display_on = true;
   writeBrightnessToEEPROM();
 
-  // TPS61160 initialization sequence
-  setPinLow(LCD_1W);
-  delayMicroseconds(T_OFF);
-  setPinHigh(LCD_1W);
-  delayMicroseconds(150);
-  setPinLow(LCD_1W);
-  delayMicroseconds(300);
-  setPinHigh(LCD_1W);
-
-  // Fade from off to target brightness
-  uint8_t targetRaw = i2cdata.status.brightness * 4 + 1;
-  for (uint8_t rawBrightness = 1; rawBrightness <= targetRaw; rawBrightness++) {
-    byte bytesToSend[] = {LCD_ADDR, rawBrightness};
-
-    noInterrupts();
-    for (int byte = 0; byte < 2; byte++) {
-      delayMicroseconds(T_START);
-
-      for (int i = 7; i >= 0; i--) {
-        bool bit = bytesToSend[byte] & (1 << i);
-        setPinLow(LCD_1W);
-        delayMicroseconds(bit ? T_L_HB : T_L_LB);
-        setPinHigh(LCD_1W);
-        delayMicroseconds(bit ? T_H_HB : T_H_LB);
-      }
+  // Backlight fully off: run the TPS61160 initialization sequence. A fade-out
+  // still in progress leaves LCD_1W high and skips this, turning the fade around.
+  if (!readPin(LCD_1W)) {
+    setPinLow(LCD_1W);
+    delayMicroseconds(T_OFF);
+    setPinHigh(LCD_1W);
+    delayMicroseconds(150);
+    setPinLow(LCD_1W);
+    delayMicroseconds(300);
+    setPinHigh(LCD_1W);
+    fade.current = 0;
+  }
 
-      setPinLow(LCD_1W);
-      delayMicroseconds(T_EOS);
-      setPinHigh(LCD_1W);
-    }
-    interrupts();
+  // Fade from the current level to target brightness in updateDisplayFade()
+  fade.target = BACKLIGHT_RAW(i2cdata.status.brightness);
+}
+
+// Advance a display fade by one step every FADE_STEP_MS without blocking the loop
+void updateDisplayFade(unsigned long currentTime) {
+  if (fade.current == fade.target || currentTime - fade.lastStep < FADE_STEP_MS) {
+    return;
+  }
+  fade.lastStep = currentTime;
+
+  if (fade.current < fade.target) {
+    fade.current++;
+  } else {
+    fade.current--;
+  }
 
-    delay(20);
+  if (fade.current) {
+    writeBacklightRaw(fade.current);
+  } else {
+    setPinLow(LCD_1W);
   }
 }
 
@@ -242,7 +224,7 @@ void checkDisplayButton() {
     state.dispPressed = false;
 
     // Check if display is currently off
-    if (!readPin(LCD_1W)) {
+    if (!i2cdata.status.display_on) {
       // Display is OFF - re-enable at current brightness
       enableDisplay();
     } else {
@@ -258,6 +240,24 @@ void updateGPIOStatusBits() {
   i2cdata.status.port_modified = (PORTB != 0xFF) || (PORTD != 0xFF);
 }
 
+// Leave a request for the bootloader in EEPROM and reset into it
+void rebootToBootloader() {
+  EEPROM.update(EEPROM_BL_REQUEST, BL_REQUEST_MAGIC);
+  eeprom_busy_wait();  // a reset mid-write could corrupt the marker
+
+  cli();
+  wdt_enable(WDTO_15MS);
+  for (;;) {}
+}
+
+bool bootloaderKeyValid() {
+  if (pendingLen != 1 + I2C_BOOTLOADER_KEY_LEN) return false;
+  for (uint8_t i = 0; i < I2C_BOOTLOADER_KEY_LEN; i++) {
+    if (rxData[1 + i] != (uint8_t)I2C_BOOTLOADER_KEY[i]) return false;
+  }
+  return true;
+}
+
 void processI2CCommand() {
   switch (rxData[0]) {
     case I2C_CMD_BRIGHT:
@@ -266,14 +266,12 @@ void processI2CCommand() {
         disableDisplay();
       } else if (rxData[1] == I2C_BRIGHT_ENABLE) {
         // Special value: enable display at previous brightness
-        if (!readPin(LCD_1W)) {
-          enableDisplay();
-        }
-      } else if (rxData[1] <= 7) {
+        enableDisplay();
+      } else if (rxData[1] <= I2C_BRIGHT_MAX) {
         i2cdata.status.brightness = rxData[1];
 
         // Check if display is currently off
-        if (!readPin(LCD_1W)) {
+        if (!i2cdata.status.display_on) {
           enableDisplay();  // Was off, enable at new brightness
         } else {
           setBrightness();  // Already on, just change brightness (also writes EEPROM)
@@ -307,6 +305,12 @@ void processI2CCommand() {
     case I2C_CMD_GPIO_READ:
       pinInfoMode = true;
       break;
+
+    case I2C_CMD_BOOTLOADER:
+      if (bootloaderKeyValid()) {
+        rebootToBootloader();
+      }
+      break;
   }
 }
 
@@ -330,41 +334,114 @@ void readButtons() {
   i2cdata.buttons = button_state;
 }
 
-void onRequest() {
+void publishReport() {
+  uint8_t back = reportFront ^ 1;
+
+  // Master is still clocking this buffer out; catch up on the next loop
+  if (back == reportInFlight) {
+    return;
+  }
+
+  if (i2cdata.status.crc_active) {
+    i2cdata.crc16 = topper_crc16((const uint8_t*)&i2cdata, REPORT_CRC);
+  }
+  reports[back] = i2cdata;
+  reportFront = back;
+}
+
+// Point the transmitter at the frame for this read (called on SLA+R)
+static inline void selectTxFrame() {
   if (versionMode) {
     versionMode = false;
-    uint8_t versionData[9];
-    memcpy(versionData, versionBytes, 7);
-    versionData[7] = (uint8_t)(versionCRC >> 8);
-    versionData[8] = (uint8_t)(versionCRC & 0xFF);
-    Wire.write(versionData, sizeof(versionData));
+    twiTxPtr = versionFrame;
+    twiTxLen = sizeof(versionFrame);
   } else if (pinInfoMode) {
     pinInfoMode = false;
-    uint8_t pinData[9] = { DDRB, DDRD, PORTB, PORTD, PINB, PIND, 0x00, 0x00, 0x00 };
-    uint16_t crc = calculateCRC(pinData, 7);
-    pinData[7] = (uint8_t)(crc >> 8);
-    pinData[8] = (uint8_t)(crc & 0xFF);
-    Wire.write(pinData, sizeof(pinData));
+    pinFrame[PINFRAME_DDRB] = DDRB;
+    pinFrame[PINFRAME_DDRD] = DDRD;
+    pinFrame[PINFRAME_PORTB] = PORTB;
+    pinFrame[PINFRAME_PORTD] = PORTD;
+    pinFrame[PINFRAME_PINB] = PINB;
+    pinFrame[PINFRAME_PIND] = PIND;
+    pinFrame[6] = 0x00;
+    uint16_t crc = topper_crc16(pinFrame, PINFRAME_CRC);
+    pinFrame[PINFRAME_CRC] = (uint8_t)(crc >> 8);
+    pinFrame[PINFRAME_CRC + 1] = (uint8_t)(crc & 0xFF);
+    twiTxPtr = pinFrame;
+    twiTxLen = sizeof(pinFrame);
   } else {
-    if (i2cdata.status.crc_active) {
-      i2cdata.crc16 = calculateCRC((const uint8_t*)&i2cdata, 7);
-    }
-    Wire.write((const uint8_t*)&i2cdata, sizeof(i2cdata));
+    uint8_t front = reportFront;
+    reportInFlight = front;
+    twiTxPtr = (const uint8_t*)&reports[front];
+    twiTxLen = sizeof(i2cStructure);
   }
 }
 
-void onReceive(int numBytes) {
-  // Read up to 4 bytes
-  for (int i = 0; i < 5 && Wire.available(); i++) {
-    rxData[i] = Wire.read();
-  }
+// Register-level TWI slave. Received bytes go straight into rxData and
+// transmitted bytes come straight from the selected frame buffer.
+ISR(TWI_vect) {
+  uint8_t twcr = TWI_CTRL_ACK;
 
-  // Drain any extra bytes
-  while (Wire.available()) {
-    Wire.read();
+  switch (TWSR & 0xF8) {
+    case TWI_SR_SLA_ACK:
+      twiRxLen = 0;
+      reportInFlight = REPORT_NONE;
+      break;
+
+    case TWI_SR_DATA_ACK:
+      // Bytes beyond the command buffer are acknowledged and dropped
+      if (twiRxLen < sizeof(rxData)) {
+        rxData[twiRxLen++] = TWDR;
+      }
+      break;
+
+    case TWI_SR_DATA_NACK:
+      break;
+
+    case TWI_SR_STOP:
+      // Empty writes (bus probes) must not re-run the previous command
+      if (twiRxLen) {
+        pendingLen = twiRxLen;
+        pendingCommand = true;
+      }
+      twiRxLen = 0;
+      break;
+
+    case TWI_ST_SLA_ACK:
+      selectTxFrame();
+      // fall through
+
+    case TWI_ST_DATA_ACK:
+      if (twiTxLen) {
+        TWDR = *twiTxPtr++;
+        twiTxLen--;
+      } else {
+        TWDR = 0xFF;
+      }
+      break;
+
+    case TWI_ST_DATA_NACK:
+    case TWI_ST_LAST_ACK:
+      twiTxLen = 0;
+      reportInFlight = REPORT_NONE;
+      break;
+
+    default:
+      // Bus error or unexpected state: release the bus
+      twcr |= (1<<TWSTO);
+      break;
   }
 
-  pendingCommand = true;
+  TWCR = twcr;
+}
+
+void initTWI() {
+  // Internal pull-ups on SDA (C4) and SCL (C5), as the Wire library did
+  setPinHigh(TWI_SDA);
+  setPinHigh(TWI_SCL);
+
+  TWAR = I2C_APP_ADDR << 1;
+  TWCR = (1<<TWEA) | (1<<TWEN) | (1<<TWIE);
 }
 
 void checkForIncomingI2CCommand() {
@@ -378,14 +455,23 @@ void normalModeFunctions() {
   readJoysticks();
   readButtons();
   checkDisplayButton();
+  publishReport();
 }
 
 void setup() {
   initGPIOs();
-  generateCRCTable();
 
-  strncpy((char*)versionBytes, FW_VERSION, sizeof(versionBytes));
-  versionCRC = calculateCRC(versionBytes, 7);
+  strncpy((char*)versionFrame, FW_VERSION, VERSIONFRAME_STR_LEN);
+  uint16_t versionCRC = topper_crc16(versionFrame, VERSIONFRAME_STR_LEN);
+  versionFrame[VERSIONFRAME_CRC] = (uint8_t)(versionCRC >> 8);
+  versionFrame[VERSIONFRAME_CRC + 1] = (uint8_t)(versionCRC & 0xFF);
+  // Build metadata is patched into flash by the Makefile after linking
+  for (uint8_t i = 0; i < META_LEN; i++) {
+    versionFrame[VERSIONFRAME_META + i] = pgm_read_byte_near(META_ADDR + i);
+  }
+  uint16_t metaCRC = topper_crc16(versionFrame + VERSIONFRAME_META, META_LEN);
+  versionFrame[VERSIONFRAME_META_CRC] = (uint8_t)(metaCRC >> 8);
+  versionFrame[VERSIONFRAME_META_CRC + 1] = (uint8_t)(metaCRC & 0xFF);
 
   // Initialize state
   state.currentJoystick = 0;
@@ -394,11 +480,18 @@ void setup() {
 
   readEEPROM();
   updateGPIOStatusBits();
-  enableDisplay();
+  readButtons();
+  // Fill all four axes so the first report carries real stick positions
+  for (uint8_t i = 0; i < 4; i++) {
+    readJoysticks();
+  }
+
+  // Bring TWI up before anything slow so the host can see 0x30 right away
+  publishReport();
+  initTWI();
 
-  Wire.begin(I2C_ADDR);
-  Wire.onRequest(onRequest);
-  Wire.onReceive(onReceive);
+  // Starts the fade-in; updateDisplayFade() finishes it from loop()
+  enableDisplay();
 }
 
 void loop() {
@@ -408,5 +501,6 @@ void loop() {
   if (UPDATE_INTERVAL_REACHED) {
     lastUpdateTime = currentTime;
     normalModeFunctions();
+    updateDisplayFade(currentTime);
   }
 }
@@ -0,0 +1,260 @@
+/*
+ * Topper I2C protocol
+ *
+ * Single source for the command IDs, frame layouts and CRC used by the ATmega
+ * firmware (atmega/firmware), the TWI bootloader (atmega/bootloader) and the
+ * Raspberry Pi utilities (rpi/). Include it from C or C++; on AVR the CRC
+ * table is placed in flash.
+ */
+
+#ifndef TOPPER_PROTOCOL_H
+#define TOPPER_PROTOCOL_H
+
+#include <stdint.h>
+
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define TOPPER_PROGMEM              PROGMEM
+#define TOPPER_READ_WORD(p)         pgm_read_word(p)
+#else
+#define TOPPER_PROGMEM
+#define TOPPER_READ_WORD(p)         (*(p))
+#endif
+
+/* ---- I2C addresses ---- */
+
+#define I2C_APP_ADDR                0x30    /* application firmware */
+#define I2C_BL_ADDR                 0x29    /* bootloader */
+
+/* ---- Application commands (first byte of a master write) ---- */
+
+#define I2C_CMD_BRIGHT              0x10    /* [cmd, level 0-7 | I2C_BRIGHT_*] */
+#define I2C_CMD_CRC                 0x20    /* [cmd, enable] */
+#define I2C_CMD_GPIO_ALL            0x30    /* [cmd, DDRB, DDRD, PORTB, PORTD] */
+#define I2C_CMD_GPIO_SAVE           0x40    /* [cmd] */
+#define I2C_CMD_VERSION             0x50    /* [cmd]; next read returns the version frame */
+#define I2C_CMD_GPIO_READ           0x60    /* [cmd]; next read returns the pin frame */
+#define I2C_CMD_BOOTLOADER          0x70    /* [cmd, I2C_BOOTLOADER_KEY]; reset into the bootloader */
+
+#define I2C_CMD_MAX_LEN             5       /* longest command including the ID byte */
+
+/* I2C_CMD_BOOTLOADER is ignored unless followed by exactly these 4 bytes */
+#define I2C_BOOTLOADER_KEY          "BLDR"
+#define I2C_BOOTLOADER_KEY_LEN      4
+
+/* Values for I2C_CMD_BRIGHT */
+#define I2C_BRIGHT_MAX              7
+#define I2C_BRIGHT_DISABLE          8       /* disable the display */
+#define I2C_BRIGHT_ENABLE           9       /* enable the display at the previous brightness */
+
+/*
+ * ---- Input report frame (any read not preceded by a mode command) ----
+ *
+ *   [0-1]  buttons  uint16_t little-endian, bit0-7 = PORTB, bit8-15 = PORTD, active-high
+ *   [2-5]  joyLX, joyLY, joyRX, joyRY
+ *   [6]    status   see REPORT_STATUS_*
+ *   [7-8]  CRC-16 over bytes 0-6, little-endian
+ */
+#define REPORT_LEN                  9
+#define REPORT_BUTTONS              0
+#define REPORT_JOY_LX               2
+#define REPORT_JOY_LY               3
+#define REPORT_JOY_RX               4
+#define REPORT_JOY_RY               5
+#define REPORT_STATUS               6
+#define REPORT_CRC                  7
+
+#define REPORT_STATUS_BRIGHTNESS    0x07    /* display brightness 0-7 */
+#define REPORT_STATUS_DISPLAY_ON    0x08
+#define REPORT_STATUS_CRC_ACTIVE    0x10
+#define REPORT_STATUS_DDR_MODIFIED  0x20    /* any pin direction changed from default */
+#define REPORT_STATUS_PORT_MODIFIED 0x40    /* any PORT value changed from default */
+
+/*
+ * ---- Pin frame (read after I2C_CMD_GPIO_READ) ----
+ *
+ *   [0-5]  DDRB, DDRD, PORTB, PORTD, PINB, PIND
+ *   [6]    padding, always 0
+ *   [7-8]  CRC-16 over bytes 0-6, big-endian
+ */
+#define PINFRAME_LEN                9
+#define PINFRAME_DDRB               0
+#define PINFRAME_DDRD               1
+#define PINFRAME_PORTB              2
+#define PINFRAME_PORTD              3
+#define PINFRAME_PINB               4
+#define PINFRAME_PIND               5
+#define PINFRAME_CRC                7
+
+/*
+ * ---- Version frame (read after I2C_CMD_VERSION) ----
+ *
+ *   [0-6]   version string, NUL padded
+ *   [7-8]   CRC-16 over bytes 0-6, big-endian
+ *   [9-24]  build metadata block copied from META_ADDR, see META_*
+ *   [25-26] CRC-16 over bytes 9-24, big-endian
+ *
+ * Masters that only want the version string may stop after 9 bytes.
+ */
+#define VERSIONFRAME_LEN            27
+#define VERSIONFRAME_STR_LEN        7
+#define VERSIONFRAME_CRC            7
+#define VERSIONFRAME_META           9
+#define VERSIONFRAME_META_CRC       25
+
+/*
+ * ---- Build metadata block (16 bytes of app flash just below the checksum) ----
+ *
+ *   [0-1]   META_MAGIC0, META_MAGIC1
+ *   [2]     META_LAYOUT
+ *   [3-9]   version string (FW_VERSION), NUL padded
+ *   [10-13] build hash: POSIX cksum CRC-32 of app flash 0x0000 to META_ADDR-1, little-endian
+ *   [14-15] code size in bytes, little-endian
+ *
+ * Appended by atmega/firmware/Makefile after linking. An image built any
+ * other way has 0xFF here and never matches.
+ */
+#define META_ADDR                   0x1BED  /* bootloader start - 3 checksum bytes - META_LEN */
+#define META_LEN                    16
+#define META_MAGIC0                 'T'
+#define META_MAGIC1                 'P'
+#define META_LAYOUT                 0x01
+#define META_VERSION                3
+#define META_VERSION_LEN            7
+#define META_HASH                   10
+#define META_CODE_SIZE              14
+
+/* ---- Bootloader commands ---- */
+
+#define CMD_READ_INFO               0x01
+#define CMD_WRITE_PAGE              0x03    /* page number byte precedes the 64 data bytes */
+#define CMD_FINALIZE                0x05
+#define CMD_READ_STATUS             0x07    /* [cmd]; next read returns the status frame (version 2+) */
+#define CMD_READ_PAGE_CRC           0x09    /* [cmd, first page, count]; next read returns page CRCs (version 3+) */
+#define CMD_READ_PAGE               0x0B    /* [cmd, flash page]; next read returns a read frame (version 4+) */
+#define CMD_READ_EEPROM             0x0D    /* [cmd, EEPROM block]; next read returns a read frame (version 4+) */
+#define CMD_WRITE_EEPROM            0x0F    /* [cmd, addr hi, addr lo, 1-16 data bytes] (version 4+) */
+#define CMD_WRITE_PAGE_CRC          0x11    /* [cmd, page, 64 data bytes, CRC-16 BE] (version 5+) */
+
+/*
+ * Protocol versions 2-5 added the commands marked above. update_firmware and
+ * sim:bootloader speak all of them, falling back on what an older bootloader
+ * lacks. The ATmega8 bootloader in atmega/bootloader implements version 1:
+ * nothing newer fits its 1KB boot section.
+ */
+#define BOOTLOADER_VERSION          0x05    /* newest protocol version */
+#define BOOTLOADER_VERSION_ATMEGA8  0x01    /* reported by atmega/bootloader */
+
+/*
+ * CMD_READ_INFO response:
+ *   [0-2]  signature bytes
+ *   [3]    protocol version, 1..BOOTLOADER_VERSION
+ *   [4]    number of application flash pages
+ *   [5]    verification status, see VERIFY_*
+ *   [6-8]  Fletcher-8 sum1, sum2 and XOR over bytes 0-5
+ */
+#define BL_INFO_LEN                 9
+
+/*
+ * CMD_READ_STATUS response:
+ *   [0]    flags, see BL_STATUS_*
+ *   [1]    last page programmed, 0xFF if none since reset
+ *   [2]    check byte, [0] ^ [1] ^ 0xFF
+ *
+ * The bootloader double-buffers CMD_WRITE_PAGE: a page is queued at STOP and
+ * programmed in the background, and the next page may be sent as soon as
+ * BL_STATUS_FULL is clear. A write sent while it is set is NACKed.
+ *
+ * CMD_WRITE_PAGE_CRC carries a CRC-16 over the page number and data bytes.
+ * The page is only queued if it matches; BL_STATUS_REJECTED tells the host
+ * to resend it and is cleared by the next page that is queued.
+ */
+#define BL_STATUS_LEN               3
+#define BL_STATUS_BUSY              0x01    /* at least one page queued or programming */
+#define BL_STATUS_FULL              0x02    /* both page buffers in use */
+#define BL_STATUS_EEPROM            0x04    /* CMD_WRITE_EEPROM data still being written */
+#define BL_STATUS_REJECTED          0x08    /* last CMD_WRITE_PAGE_CRC failed its CRC and was dropped */
+
+/*
+ * CMD_READ_PAGE_CRC response:
+ *   [0..2n-1]  CRC-16 of each of the n requested pages, big-endian
+ *   [2n..2n+1] CRC-16 over the preceding 2n bytes, big-endian
+ *
+ * n is 1..BL_PAGE_CRC_MAX and the range must lie within the app pages;
+ * otherwise the request is dropped and the read returns 0xFF, which fails the
+ * CRC. The bootloader NACKs its address while it computes the CRCs (about
+ * 0.3 ms per page).
+ */
+#define BL_PAGE_CRC_MAX             16
+
+/*
+ * CMD_READ_PAGE / CMD_READ_EEPROM response (read frame):
+ *   [0-63]  contents of the 64-byte flash page or EEPROM block
+ *   [64-65] CRC-16 over bytes 0-63, big-endian
+ *
+ * Any flash page may be read, including the bootloader's own. All bytes read
+ * 0xFF, failing the CRC, if the page number is out of range or a flash or
+ * EEPROM write is still in progress.
+ */
+#define BL_READ_BLOCK               64
+#define BL_READ_FRAME_LEN           (BL_READ_BLOCK + 2)
+
+/*
+ * CMD_WRITE_EEPROM is queued at STOP and written one byte per EEPROM cycle
+ * (~8.5 ms) in the background, skipping bytes that already match. While a
+ * previous write is still queued the high address byte is ACKed, everything
+ * after it is NACKed and the transaction is dropped; poll BL_STATUS_EEPROM.
+ * A write that would reach EEPROM_BL_FIRST or beyond is dropped as well.
+ */
+#define BL_EEPROM_WRITE_MAX         16
+
+/* Verification status codes (bit patterns with Hamming distance 8 from each other) */
+#define VERIFY_PENDING              0x00
+#define VERIFY_FAILED               0x55
+#define VERIFY_PASSED               0xAA
+
+/*
+ * EEPROM bytes owned by the bootloader (top of the ATmega8's 512-byte EEPROM).
+ * The application must not use them. A chip erase clears them since the
+ * EESAVE fuse is left unprogrammed.
+ */
+#define EEPROM_BL_VERIFIED          0x1FF   /* VERIFY_PASSED once the current app has been verified */
+#define EEPROM_BL_REQUEST           0x1FE   /* BL_REQUEST_MAGIC: app asked to stay in the bootloader */
+#define EEPROM_BL_FIRST             EEPROM_BL_REQUEST   /* lowest bootloader-owned byte */
+
+/*
+ * Written to EEPROM_BL_REQUEST by the app before a watchdog reset. The
+ * bootloader erases it on the next boot and only honours it after a
+ * watchdog reset, so a stale marker cannot trap a power-up.
+ */
+#define BL_REQUEST_MAGIC            0xB1
+
+/*
+ * ---- CRC-16-CCITT (poly 0x1021, init 0xFFFF, no reflection, no final XOR) ----
+ *
+ * Nibble-table variant: 32 bytes of table instead of 512, two lookups per byte.
+ */
+#define TOPPER_CRC16_POLY           0x1021
+#define TOPPER_CRC16_INIT           0xFFFF
+
+static const uint16_t topper_crc16_nibble[16] TOPPER_PROGMEM = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+static inline uint16_t topper_crc16_update(uint16_t crc, uint8_t b)
+{
+    crc = (uint16_t)(crc << 4) ^ TOPPER_READ_WORD(&topper_crc16_nibble[(crc >> 12) ^ (b >> 4)]);
+    crc = (uint16_t)(crc << 4) ^ TOPPER_READ_WORD(&topper_crc16_nibble[(crc >> 12) ^ (b & 0x0F)]);
+    return crc;
+}
+
+static inline uint16_t topper_crc16(const uint8_t *data, uint8_t len)
+{
+    uint16_t crc = TOPPER_CRC16_INIT;
+    while (len--)
+        crc = topper_crc16_update(crc, *data++);
+    return crc;
+}
+
+#endif /* TOPPER_PROTOCOL_H */
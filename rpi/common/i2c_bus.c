@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+
+#include "i2c_bus.h"
+#include "i2c_capture.h"
+
+/* --- Linux i2c-dev backend --- */
+
+/* Points fd at addr; skips the ioctl while the address is unchanged */
+static int set_slave(i2c_bus_t *bus, uint8_t addr)
+{
+    if (bus->slave == addr)
+        return 0;
+    if (ioctl(bus->fd, I2C_SLAVE, addr) < 0) {
+        bus->slave = -1;
+        return -1;
+    }
+    bus->slave = addr;
+    return 0;
+}
+
+static int dev_xfer(i2c_bus_t *bus, uint8_t addr,
+                    const uint8_t *wbuf, size_t wlen, uint8_t *rbuf, size_t rlen)
+{
+    /* I2C_RDWR guarantees a repeated START between the write and read phases */
+    if (wlen && rlen) {
+        struct i2c_msg msgs[2] = {
+            { .addr = addr, .flags = 0,        .len = (__u16)wlen, .buf = (uint8_t *)wbuf },
+            { .addr = addr, .flags = I2C_M_RD, .len = (__u16)rlen, .buf = rbuf            },
+        };
+        struct i2c_rdwr_ioctl_data data = { .msgs = msgs, .nmsgs = 2 };
+
+        return ioctl(bus->fd, I2C_RDWR, &data) < 0 ? -1 : 0;
+    }
+
+    if (set_slave(bus, addr) < 0)
+        return -1;
+    if (wlen)
+        return write(bus->fd, wbuf, wlen) == (ssize_t)wlen ? 0 : -1;
+    return read(bus->fd, rbuf, rlen) == (ssize_t)rlen ? 0 : -1;
+}
+
+static void dev_close(i2c_bus_t *bus)
+{
+    close(bus->fd);
+}
+
+static const i2c_bus_ops_t dev_ops = { dev_xfer, dev_close };
+
+/* --- i2c-stub backend --- */
+
+/*
+ * The i2c-stub module (modprobe i2c-stub chip_addr=0x30) adds an SMBus-only
+ * adapter whose chips are 256-byte register files, so plain reads and
+ * I2C_RDWR fail on it. This backend maps each transaction onto SMBus
+ * transfers the way the app selects its frames:
+ *   - a 1-byte write (a mode command) makes that byte the next read's register
+ *   - a longer write stores the data bytes at register <first byte>
+ *   - a read returns the block at the selected register, or at 0x00 (the
+ *     report frame) when no mode command preceded it
+ *   - a write-then-read reads the block at register <first byte>
+ * Load the frames with i2cset or i2ctransfer before running a tool.
+ */
+
+typedef struct {
+    uint8_t reg[128];           /* next read's register, per address */
+} stub_t;
+
+static int stub_smbus(i2c_bus_t *bus, char rw, uint8_t cmd, int size, union i2c_smbus_data *data)
+{
+    struct i2c_smbus_ioctl_data args = { .read_write = rw, .command = cmd, .size = (__u32)size, .data = data };
+
+    return ioctl(bus->fd, I2C_SMBUS, &args) < 0 ? -1 : 0;
+}
+
+static int stub_xfer(i2c_bus_t *bus, uint8_t addr,
+                     const uint8_t *wbuf, size_t wlen, uint8_t *rbuf, size_t rlen)
+{
+    stub_t               *st = bus->priv;
+    union i2c_smbus_data  data;
+    uint8_t               reg;
+
+    if (set_slave(bus, addr) < 0)
+        return -1;
+
+    if (wlen == 1 && !rlen) {
+        st->reg[addr & 0x7F] = wbuf[0];
+        return stub_smbus(bus, I2C_SMBUS_WRITE, wbuf[0], I2C_SMBUS_BYTE, NULL);
+    }
+    for (size_t off = 1; off < wlen; off += I2C_SMBUS_BLOCK_MAX) {
+        size_t n = wlen - off < I2C_SMBUS_BLOCK_MAX ? wlen - off : I2C_SMBUS_BLOCK_MAX;
+
+        data.block[0] = (uint8_t)n;
+        memcpy(data.block + 1, wbuf + off, n);
+        if (stub_smbus(bus, I2C_SMBUS_WRITE, (uint8_t)(wbuf[0] + off - 1), I2C_SMBUS_I2C_BLOCK_DATA, &data) < 0)
+            return -1;
+    }
+    if (!rlen) {
+        st->reg[addr & 0x7F] = 0;
+        return 0;
+    }
+
+    reg = wlen ? wbuf[0] : st->reg[addr & 0x7F];
+    st->reg[addr & 0x7F] = 0;
+    for (size_t off = 0; off < rlen; off += I2C_SMBUS_BLOCK_MAX) {
+        size_t n = rlen - off < I2C_SMBUS_BLOCK_MAX ? rlen - off : I2C_SMBUS_BLOCK_MAX;
+
+        data.block[0] = (uint8_t)n;
+        if (stub_smbus(bus, I2C_SMBUS_READ, (uint8_t)(reg + off), I2C_SMBUS_I2C_BLOCK_DATA, &data) < 0)
+            return -1;
+        memcpy(rbuf + off, data.block + 1, n);
+    }
+    return 0;
+}
+
+static void stub_close(i2c_bus_t *bus)
+{
+    close(bus->fd);
+    free(bus->priv);
+}
+
+static const i2c_bus_ops_t stub_ops = { stub_xfer, stub_close };
+
+/* --- Common --- */
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Starts a capture if $TOPPER_I2C_CAPTURE asks for one; the bus works either way */
+static i2c_bus_t *attach_capture(i2c_bus_t *bus)
+{
+    const char *path = getenv(I2C_CAPTURE_ENV);
+
+    if (path && *path)
+        bus->capture = i2c_capture_create(path);
+    return bus;
+}
+
+i2c_bus_t *i2c_bus_open(const char *spec)
+{
+    i2c_bus_t *bus = calloc(1, sizeof(*bus));
+    char       path[32];
+    char      *end;
+    long       num;
+
+    if (!bus) {
+        fprintf(stderr, "Out of memory.\n");
+        return NULL;
+    }
+    bus->fd    = -1;
+    bus->slave = -1;
+
+    if (strncmp(spec, "sim:", 4) == 0) {
+        const char *model = spec + 4;
+        const char *opts  = strchr(model, ':');
+        size_t      len   = opts ? (size_t)(opts - model) : strlen(model);
+
+        if (len == strlen("bootloader") && strncmp(model, "bootloader", len) == 0) {
+            if (sim_bootloader_open(bus, opts ? opts + 1 : "") == 0)
+                return attach_capture(bus);
+        } else if (len == strlen("atmega") && strncmp(model, "atmega", len) == 0) {
+            if (sim_atmega_open(bus, opts ? opts + 1 : "") == 0)
+                return attach_capture(bus);
+        } else {
+            fprintf(stderr, "Unknown simulated target '%.*s'.\n", (int)len, model);
+        }
+        free(bus);
+        return NULL;
+    }
+
+    if (strncmp(spec, "replay:", 7) == 0) {
+        if (i2c_replay_open(bus, spec + 7) == 0)
+            return attach_capture(bus);
+        free(bus);
+        return NULL;
+    }
+
+    if (strncmp(spec, "stub:", 5) == 0) {
+        bus->priv = calloc(1, sizeof(stub_t));
+        if (!bus->priv) {
+            fprintf(stderr, "Out of memory.\n");
+            free(bus);
+            return NULL;
+        }
+        spec += 5;
+    }
+
+    num = strtol(spec, &end, 10);
+    if (*end == '\0' && end != spec && num >= 0) {
+        snprintf(path, sizeof(path), "/dev/i2c-%ld", num);
+        spec = path;
+    }
+
+    bus->fd = open(spec, O_RDWR);
+    if (bus->fd < 0) {
+        fprintf(stderr, "Failed to open I2C device %s: %s\n", spec, strerror(errno));
+        free(bus->priv);
+        free(bus);
+        return NULL;
+    }
+    bus->ops = bus->priv ? &stub_ops : &dev_ops;
+    return attach_capture(bus);
+}
+
+void i2c_bus_close(i2c_bus_t *bus)
+{
+    if (!bus)
+        return;
+    bus->ops->close(bus);
+    i2c_capture_close(bus->capture);
+    free(bus);
+}
+
+int i2c_bus_xfer(i2c_bus_t *bus, uint8_t addr,
+                 const uint8_t *wbuf, size_t wlen, uint8_t *rbuf, size_t rlen)
+{
+    uint64_t start = bus->capture ? mono_ns() : 0;
+    int      ret   = bus->ops->xfer(bus, addr, wbuf, wlen, rbuf, rlen);
+
+    if (bus->capture)
+        i2c_capture_append(bus->capture, start, mono_ns(), addr, ret < 0, wbuf, wlen, rbuf, rlen);
+
+    bus->stats.xfers++;
+    bus->stats.messages += (wlen > 0) + (rlen > 0);
+    if (ret < 0) {
+        /* count the address byte the target did not acknowledge */
+        bus->stats.failed++;
+        bus->stats.bytes++;
+    } else {
+        bus->stats.bytes += (wlen > 0) + wlen + (rlen > 0) + rlen;
+    }
+    return ret;
+}
+
+double i2c_bus_wire_ms(const i2c_bus_stats_t *stats)
+{
+    return (stats->bytes * 9.0 + stats->messages * 2.0) * 1000.0 / I2C_BUS_HZ;
+}
@@ -0,0 +1,84 @@
+/*
+ * I2C transport for the Raspberry Pi utilities
+ *
+ * A bus is opened from a spec string:
+ *   "/dev/i2c-N" or "N"          Linux i2c-dev adapter
+ *   "stub:N" or "stub:/dev/i2c-N"  i2c-stub adapter, transactions mapped to SMBus
+ *   "sim:<model>[:opt[:opt]]"    in-process simulated target (atmega, bootloader), see sim_*.c
+ *   "replay:<file>[:loop][:paced]"  answers from a capture, see i2c_replay.c
+ *
+ * Every transfer goes through i2c_bus_xfer(), which also keeps the traffic
+ * counters used for timing reports and, with $TOPPER_I2C_CAPTURE set, logs
+ * the transaction (i2c_capture.h).
+ */
+
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Standard-mode SCL; used to turn byte counts into wire time */
+#define I2C_BUS_HZ                  100000
+
+typedef struct i2c_bus i2c_bus_t;
+
+typedef struct {
+    /*
+     * One transaction: write wlen bytes, then read rlen bytes after a
+     * repeated START. Either length may be 0; both 0 is not allowed.
+     * Returns 0 on success, -1 on NACK or bus error.
+     */
+    int  (*xfer)(i2c_bus_t *bus, uint8_t addr,
+                 const uint8_t *wbuf, size_t wlen, uint8_t *rbuf, size_t rlen);
+    void (*close)(i2c_bus_t *bus);
+} i2c_bus_ops_t;
+
+typedef struct {
+    unsigned long xfers;        /* transactions attempted */
+    unsigned long failed;       /* transactions NACKed or failed */
+    unsigned long bytes;        /* address and data bytes clocked on the wire */
+    unsigned long messages;     /* START conditions, repeated STARTs included */
+} i2c_bus_stats_t;
+
+struct i2c_bus {
+    const i2c_bus_ops_t *ops;
+    void                *priv;  /* backend state */
+    int                  fd;    /* i2c-dev and i2c-stub backends */
+    int                  slave; /* address last set with I2C_SLAVE on fd, -1 if none */
+    i2c_bus_stats_t      stats;
+    struct i2c_capture  *capture;
+};
+
+/* Opens a bus from its spec. Prints the reason and returns NULL on failure. */
+i2c_bus_t *i2c_bus_open(const char *spec);
+void       i2c_bus_close(i2c_bus_t *bus);
+
+int i2c_bus_xfer(i2c_bus_t *bus, uint8_t addr,
+                 const uint8_t *wbuf, size_t wlen, uint8_t *rbuf, size_t rlen);
+
+static inline int i2c_bus_write(i2c_bus_t *bus, uint8_t addr, const uint8_t *buf, size_t len)
+{
+    return i2c_bus_xfer(bus, addr, buf, len, NULL, 0);
+}
+
+static inline int i2c_bus_read(i2c_bus_t *bus, uint8_t addr, uint8_t *buf, size_t len)
+{
+    return i2c_bus_xfer(bus, addr, NULL, 0, buf, len);
+}
+
+/* Estimated time the traffic so far kept SCL busy: 9 clocks per byte plus START/STOP */
+double i2c_bus_wire_ms(const i2c_bus_stats_t *stats);
+
+/* ---- Simulated targets ---- */
+
+/* Behavioural model of atmega/bootloader (and the app it hands over to) */
+int sim_bootloader_open(i2c_bus_t *bus, const char *opts);
+
+/* Behavioural model of atmega/firmware on its own */
+int sim_atmega_open(i2c_bus_t *bus, const char *opts);
+
+/* Capture playback; spec is "<file>[:loop][:paced]" */
+int i2c_replay_open(i2c_bus_t *bus, const char *spec);
+
+#endif /* I2C_BUS_H */
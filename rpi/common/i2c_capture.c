@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "i2c_capture.h"
+
+/* Flush at least this often so a crash loses little; full buffering otherwise */
+#define CAPTURE_FLUSH_NS            1000000000ull
+
+/*
+ * One capture per path and process: every bus that opens the same path shares
+ * it, so several boards or a reconnect all land in one file. The first open
+ * truncates it; later ones append, even after every bus closed it again.
+ */
+struct i2c_capture {
+    i2c_capture_t   *next;
+    char            *path;
+    FILE            *f;
+    pthread_mutex_t  lock;      /* keeps each record contiguous */
+    uint64_t         t0;        /* CLOCK_MONOTONIC at creation */
+    uint64_t         flushed_at;
+};
+
+static pthread_mutex_t  captures_lock = PTHREAD_MUTEX_INITIALIZER;
+static i2c_capture_t   *captures;
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void put_le(uint8_t *p, uint64_t v, int n)
+{
+    for (int i = 0; i < n; i++)
+        p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint64_t get_le(const uint8_t *p, int n)
+{
+    uint64_t v = 0;
+    for (int i = n - 1; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/* --- Writer --- */
+
+/* Opens a new capture; called with captures_lock held. */
+static i2c_capture_t *capture_open(const char *path)
+{
+    i2c_capture_t  *cap;
+    uint8_t         hdr[I2C_CAPTURE_HEADER_LEN] = { 0 };
+    struct timespec now;
+
+    cap = calloc(1, sizeof(*cap));
+    if (!cap || !(cap->path = strdup(path))) {
+        fprintf(stderr, "Out of memory.\n");
+        free(cap);
+        return NULL;
+    }
+    cap->f = fopen(path, "wb");
+    if (!cap->f) {
+        fprintf(stderr, "Failed to create capture %s: %s\n", path, strerror(errno));
+        free(cap->path);
+        free(cap);
+        return NULL;
+    }
+    pthread_mutex_init(&cap->lock, NULL);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    memcpy(hdr, I2C_CAPTURE_MAGIC, 4);
+    put_le(hdr + 4, I2C_CAPTURE_VERSION, 2);
+    put_le(hdr + 8, (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec, 8);
+    fwrite(hdr, 1, sizeof(hdr), cap->f);
+
+    cap->t0 = cap->flushed_at = mono_ns();
+    cap->next = captures;
+    captures  = cap;
+    return cap;
+}
+
+i2c_capture_t *i2c_capture_create(const char *path)
+{
+    i2c_capture_t *cap;
+    char           expanded[256];
+    const char    *pid = strstr(path, "%p");
+
+    if (pid) {
+        snprintf(expanded, sizeof(expanded), "%.*s%ld%s",
+                 (int)(pid - path), path, (long)getpid(), pid + 2);
+        path = expanded;
+    }
+
+    pthread_mutex_lock(&captures_lock);
+    for (cap = captures; cap; cap = cap->next)
+        if (strcmp(cap->path, path) == 0)
+            break;
+    if (!cap)
+        cap = capture_open(path);
+    pthread_mutex_unlock(&captures_lock);
+    return cap;
+}
+
+void i2c_capture_append(i2c_capture_t *cap, uint64_t start_ns, uint64_t end_ns,
+                        uint8_t addr, int failed,
+                        const uint8_t *wbuf, size_t wlen, const uint8_t *rbuf, size_t rlen)
+{
+    uint8_t  rec[I2C_CAPTURE_RECORD_LEN];
+    uint64_t dur = end_ns - start_ns;
+
+    put_le(rec,      start_ns - cap->t0, 8);
+    put_le(rec + 8,  dur > 0xFFFFFFFFu ? 0xFFFFFFFFu : dur, 4);
+    rec[12] = addr;
+    rec[13] = failed ? 1 : 0;
+    put_le(rec + 14, wlen, 2);
+    put_le(rec + 16, rlen, 2);
+
+    pthread_mutex_lock(&cap->lock);
+    fwrite(rec, 1, sizeof(rec), cap->f);
+    if (wlen)
+        fwrite(wbuf, 1, wlen, cap->f);
+    if (rlen) {
+        if (failed) {
+            static const uint8_t zeros[64];
+            for (size_t left = rlen; left; ) {
+                size_t n = left < sizeof(zeros) ? left : sizeof(zeros);
+                fwrite(zeros, 1, n, cap->f);
+                left -= n;
+            }
+        } else {
+            fwrite(rbuf, 1, rlen, cap->f);
+        }
+    }
+
+    if (end_ns - cap->flushed_at >= CAPTURE_FLUSH_NS) {
+        fflush(cap->f);
+        cap->flushed_at = end_ns;
+    }
+    pthread_mutex_unlock(&cap->lock);
+}
+
+/* Flushes only: the file stays open for the next bus, and exit() closes it. */
+void i2c_capture_close(i2c_capture_t *cap)
+{
+    if (!cap)
+        return;
+    pthread_mutex_lock(&cap->lock);
+    fflush(cap->f);
+    pthread_mutex_unlock(&cap->lock);
+}
+
+/* --- Reader --- */
+
+i2c_capture_file_t *i2c_capture_load(const char *path)
+{
+    i2c_capture_file_t *file = calloc(1, sizeof(*file));
+    FILE               *f    = fopen(path, "rb");
+    long                size;
+    size_t              pos, n, cap = 0;
+
+    if (!file) {
+        fprintf(stderr, "Out of memory.\n");
+        if (f)
+            fclose(f);
+        return NULL;
+    }
+    if (!f) {
+        fprintf(stderr, "Failed to open capture %s: %s\n", path, strerror(errno));
+        free(file);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    file->data = malloc(size > 0 ? (size_t)size : 1);
+    if (!file->data || size < I2C_CAPTURE_HEADER_LEN ||
+        fread(file->data, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "Failed to read capture %s.\n", path);
+        fclose(f);
+        i2c_capture_free(file);
+        return NULL;
+    }
+    fclose(f);
+
+    if (memcmp(file->data, I2C_CAPTURE_MAGIC, 4) != 0 ||
+        get_le(file->data + 4, 2) != I2C_CAPTURE_VERSION) {
+        fprintf(stderr, "%s is not a version %d I2C capture.\n", path, I2C_CAPTURE_VERSION);
+        i2c_capture_free(file);
+        return NULL;
+    }
+    file->start_realtime_ns = get_le(file->data + 8, 8);
+
+    for (pos = I2C_CAPTURE_HEADER_LEN; pos + I2C_CAPTURE_RECORD_LEN <= (size_t)size; ) {
+        const uint8_t        *p = file->data + pos;
+        i2c_capture_record_t  r = {
+            .t_ns   = get_le(p, 8),
+            .dur_ns = (uint32_t)get_le(p + 8, 4),
+            .addr   = p[12],
+            .failed = p[13],
+            .wlen   = (uint16_t)get_le(p + 14, 2),
+            .rlen   = (uint16_t)get_le(p + 16, 2),
+        };
+
+        n = I2C_CAPTURE_RECORD_LEN + r.wlen + r.rlen;
+        if (pos + n > (size_t)size)
+            break;      /* cut off mid-record, e.g. the tool was killed */
+        r.wbuf = p + I2C_CAPTURE_RECORD_LEN;
+        r.rbuf = r.wbuf + r.wlen;
+
+        if (file->count == cap) {
+            i2c_capture_record_t *grown;
+            cap   = cap ? cap * 2 : 1024;
+            grown = realloc(file->records, cap * sizeof(*grown));
+            if (!grown) {
+                fprintf(stderr, "Out of memory.\n");
+                i2c_capture_free(file);
+                return NULL;
+            }
+            file->records = grown;
+        }
+        file->records[file->count++] = r;
+        pos += n;
+    }
+    return file;
+}
+
+void i2c_capture_free(i2c_capture_file_t *file)
+{
+    if (!file)
+        return;
+    free(file->records);
+    free(file->data);
+    free(file);
+}
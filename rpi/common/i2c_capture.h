@@ -0,0 +1,77 @@
+/*
+ * I2C transaction capture files
+ *
+ * With $TOPPER_I2C_CAPTURE set, i2c_bus_open() logs every transaction on the
+ * bus it opens to that file ("%p" in the path becomes the process ID, so
+ * several tools can capture at once). All buses of a process share the file
+ * and reopening a bus appends to it. rpi/i2c-capture/i2c-decode prints a
+ * capture, and the "replay:<file>" bus spec feeds one back to any tool.
+ *
+ * The file is a 16-byte header followed by one record per transaction, all
+ * little-endian:
+ *
+ *   header  [0-3]   I2C_CAPTURE_MAGIC
+ *           [4-5]   I2C_CAPTURE_VERSION
+ *           [6-7]   reserved, 0
+ *           [8-15]  CLOCK_REALTIME at the start of the capture, ns
+ *
+ *   record  [0-7]   start of the transaction, ns after the capture began
+ *           [8-11]  duration, ns (saturates at 4.29 s)
+ *           [12]    7-bit address
+ *           [13]    1 if the transaction was NACKed or failed, else 0
+ *           [14-15] bytes written
+ *           [16-17] bytes read
+ *           then the written bytes, then the read bytes (zeros when failed)
+ *
+ * A write-then-read with a repeated START is one record with both lengths set.
+ */
+
+#ifndef I2C_CAPTURE_H
+#define I2C_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define I2C_CAPTURE_ENV             "TOPPER_I2C_CAPTURE"
+#define I2C_CAPTURE_MAGIC           "TI2C"
+#define I2C_CAPTURE_VERSION         1
+#define I2C_CAPTURE_HEADER_LEN      16
+#define I2C_CAPTURE_RECORD_LEN      18
+
+typedef struct {
+    uint64_t       t_ns;
+    uint32_t       dur_ns;
+    uint8_t        addr;
+    uint8_t        failed;
+    uint16_t       wlen;
+    uint16_t       rlen;
+    const uint8_t *wbuf;        /* into the loaded file */
+    const uint8_t *rbuf;
+} i2c_capture_record_t;
+
+/* A capture read completely into memory */
+typedef struct {
+    uint64_t              start_realtime_ns;
+    size_t                count;
+    i2c_capture_record_t *records;
+    uint8_t              *data;
+} i2c_capture_file_t;
+
+typedef struct i2c_capture i2c_capture_t;
+
+/*
+ * Writer. create() returns the process's existing capture for the same path;
+ * close() only flushes it. Prints the reason and returns NULL on failure.
+ */
+i2c_capture_t *i2c_capture_create(const char *path);
+void           i2c_capture_append(i2c_capture_t *cap, uint64_t start_ns, uint64_t end_ns,
+                                  uint8_t addr, int failed,
+                                  const uint8_t *wbuf, size_t wlen, const uint8_t *rbuf, size_t rlen);
+void           i2c_capture_close(i2c_capture_t *cap);
+
+/* Reader. Prints the reason and returns NULL on failure or a malformed file. */
+i2c_capture_file_t *i2c_capture_load(const char *path);
+void                i2c_capture_free(i2c_capture_file_t *file);
+
+#endif /* I2C_CAPTURE_H */
@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "i2c_bus.h"
+#include "i2c_capture.h"
+
+/*
+ * "replay:<file>[:loop][:paced]" answers each transaction from a capture.
+ *
+ * The next record with the same address and the same write and read lengths
+ * supplies the result and the read bytes; records in between (traffic the
+ * replaying tool does not make, e.g. another tool's) are skipped. The search
+ * looks a limited way ahead, so a request that never appears in the capture
+ * is NACKed instead of consuming the rest of the file. Without "paced" the
+ * capture replays as fast as the tool asks, which makes runs deterministic
+ * and usable as benchmarks; "paced" holds each answer until its original time.
+ */
+
+#define REPLAY_LOOKAHEAD            64
+
+typedef struct {
+    i2c_capture_file_t *file;
+    size_t              pos;
+    int                 loop;
+    int                 paced;
+    int                 ended;
+    uint64_t            t0;         /* CLOCK_MONOTONIC when pacing (re)started */
+    uint64_t            base_ns;    /* capture time that maps to t0, or UINT64_MAX */
+    unsigned long       served;
+    unsigned long       skipped;
+    unsigned long       mismatched;
+    unsigned long       loops;
+} replay_t;
+
+static uint64_t mono_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void pace(replay_t *r, const i2c_capture_record_t *rec)
+{
+    struct timespec ts;
+    uint64_t        due;
+
+    if (r->base_ns == UINT64_MAX) {
+        r->base_ns = rec->t_ns;
+        r->t0      = mono_ns();
+    }
+    due = r->t0 + (rec->t_ns - r->base_ns) + rec->dur_ns;
+    ts.tv_sec  = (time_t)(due / 1000000000ull);
+    ts.tv_nsec = (long)(due % 1000000000ull);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static int replay_xfer(i2c_bus_t *bus, uint8_t addr,
+                       const uint8_t *wbuf, size_t wlen, uint8_t *rbuf, size_t rlen)
+{
+    replay_t *r = bus->priv;
+
+    for (int pass = 0; pass < 2; pass++) {
+        size_t end = r->pos + REPLAY_LOOKAHEAD;
+
+        if (end > r->file->count)
+            end = r->file->count;
+        for (size_t i = r->pos; i < end; i++) {
+            const i2c_capture_record_t *rec = &r->file->records[i];
+
+            if (rec->addr != addr || rec->wlen != wlen || rec->rlen != rlen)
+                continue;
+
+            r->skipped += i - r->pos;
+            r->pos      = i + 1;
+            if (wlen && memcmp(rec->wbuf, wbuf, wlen) != 0)
+                r->mismatched++;
+            if (r->paced)
+                pace(r, rec);
+            if (rec->failed)
+                return -1;
+            if (rlen)
+                memcpy(rbuf, rec->rbuf, rlen);
+            r->served++;
+            return 0;
+        }
+
+        /* not within reach: NACK, unless the capture is used up and may wrap */
+        if (end < r->file->count)
+            return -1;
+        if (!r->loop || !r->file->count)
+            break;
+        r->pos     = 0;
+        r->base_ns = UINT64_MAX;
+        r->loops++;
+    }
+
+    if (!r->ended) {
+        fprintf(stderr, "replay: end of capture after %lu transaction(s)\n", r->served);
+        r->ended = 1;
+    }
+    return -1;
+}
+
+static void replay_close(i2c_bus_t *bus)
+{
+    replay_t *r = bus->priv;
+
+    fprintf(stderr, "replay: %lu transaction(s) served, %lu skipped, %lu with different write data, %lu loop(s)\n",
+            r->served, r->skipped, r->mismatched, r->loops);
+    i2c_capture_free(r->file);
+    free(r);
+}
+
+static const i2c_bus_ops_t replay_ops = { replay_xfer, replay_close };
+
+int i2c_replay_open(i2c_bus_t *bus, const char *spec)
+{
+    replay_t *r = calloc(1, sizeof(*r));
+    char      path[256];
+    char     *opt;
+
+    if (!r) {
+        fprintf(stderr, "Out of memory.\n");
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s", spec);
+
+    /* options are trailing ":loop" / ":paced", so the path itself may contain ':' */
+    while ((opt = strrchr(path, ':')) != NULL) {
+        if (strcmp(opt + 1, "loop") == 0)
+            r->loop = 1;
+        else if (strcmp(opt + 1, "paced") == 0)
+            r->paced = 1;
+        else
+            break;
+        *opt = '\0';
+    }
+
+    r->file = i2c_capture_load(path);
+    if (!r->file) {
+        free(r);
+        return -1;
+    }
+    r->base_ns = UINT64_MAX;
+    bus->ops   = &replay_ops;
+    bus->priv  = r;
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <string.h>
+
+#include "lat_hist.h"
+
+#define BAR_WIDTH   40
+
+void lat_hist_reset(lat_hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+uint32_t lat_hist_bucket_low(unsigned i)
+{
+    unsigned shift;
+
+    if (i < 2 * LAT_HIST_SUB)
+        return i;
+    shift = i / LAT_HIST_SUB - 1;
+    return (LAT_HIST_SUB + i % LAT_HIST_SUB) << shift;
+}
+
+uint32_t lat_hist_bucket_high(unsigned i)
+{
+    return i + 1 < LAT_HIST_BUCKETS ? lat_hist_bucket_low(i + 1) - 1
+                                    : (1u << LAT_HIST_MAX_BITS) - 1;
+}
+
+uint32_t lat_hist_percentile(const lat_hist_t *h, double pct)
+{
+    uint64_t want, seen = 0;
+    unsigned i;
+
+    if (!h->count)
+        return 0;
+    want = (uint64_t)(pct / 100.0 * (double)h->count + 0.5);
+    if (want < 1)
+        want = 1;
+    for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= want) {
+            uint32_t high = lat_hist_bucket_high(i);
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
+
+void lat_hist_print(FILE *f, const char *label, const lat_hist_t *h, const char *unit)
+{
+    if (!h->count) {
+        fprintf(f, "  %-18s n=0\n", label);
+        return;
+    }
+    fprintf(f, "  %-18s n=%-8llu min %-6u mean %-8.1f p50 %-6u p90 %-6u p99 %-6u p99.9 %-6u max %u %s\n",
+            label, (unsigned long long)h->count, h->min, (double)h->sum / (double)h->count,
+            lat_hist_percentile(h, 50), lat_hist_percentile(h, 90),
+            lat_hist_percentile(h, 99), lat_hist_percentile(h, 99.9), h->max, unit);
+}
+
+void lat_hist_print_distribution(FILE *f, const lat_hist_t *h, const char *unit, unsigned rows)
+{
+    unsigned first = 0, last = 0, span, i, j;
+    uint64_t peak = 0;
+
+    if (!h->count || !rows)
+        return;
+    for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+        if (h->buckets[i]) {
+            if (!peak && !last)
+                first = i;
+            last = i;
+            peak = 1;
+        }
+    }
+
+    /* merge neighbouring buckets so the table fits in rows lines */
+    span = (last - first) / rows + 1;
+
+    peak = 0;
+    for (i = first; i <= last; i += span) {
+        uint64_t n = 0;
+        for (j = i; j < i + span && j <= last; j++)
+            n += h->buckets[j];
+        if (n > peak)
+            peak = n;
+    }
+
+    for (i = first; i <= last; i += span) {
+        uint64_t n = 0;
+        unsigned end = i + span - 1 > last ? last : i + span - 1;
+        char     bar[BAR_WIDTH + 1];
+        unsigned len;
+
+        for (j = i; j <= end; j++)
+            n += h->buckets[j];
+        if (!n)
+            continue;
+        len = (unsigned)((n * BAR_WIDTH + peak - 1) / peak);
+        memset(bar, '#', len);
+        bar[len] = '\0';
+        fprintf(f, "    %8u - %-8u %-3s %9llu  %s\n", lat_hist_bucket_low(i), lat_hist_bucket_high(end),
+                unit, (unsigned long long)n, bar);
+    }
+}
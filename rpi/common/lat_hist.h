@@ -0,0 +1,68 @@
+/*
+ * Log-linear latency histogram for the Raspberry Pi utilities
+ *
+ * HDR-style bucketing: values below 32 get exact buckets; above that each
+ * power of two is split into 32 linear sub-buckets, so any recorded value is
+ * reported within 1/32 (about 3%) of its true size. Values are plain integers,
+ * usually microseconds; recording is a few instructions and never allocates.
+ */
+
+#ifndef LAT_HIST_H
+#define LAT_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LAT_HIST_SUB_BITS           5
+#define LAT_HIST_SUB                (1u << LAT_HIST_SUB_BITS)
+#define LAT_HIST_MAX_BITS           26      /* values up to 2^26 - 1 (67 s in us) */
+#define LAT_HIST_BUCKETS            ((LAT_HIST_MAX_BITS - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint32_t min;
+    uint32_t max;
+    uint32_t buckets[LAT_HIST_BUCKETS];
+} lat_hist_t;
+
+static inline unsigned lat_hist_index(uint32_t v)
+{
+    unsigned msb, shift;
+
+    if (v < LAT_HIST_SUB)
+        return v;
+    if (v >= (1u << LAT_HIST_MAX_BITS))
+        v = (1u << LAT_HIST_MAX_BITS) - 1;
+    msb   = 31 - (unsigned)__builtin_clz(v);
+    shift = msb - LAT_HIST_SUB_BITS;
+    return (shift + 1) * LAT_HIST_SUB + ((v >> shift) & (LAT_HIST_SUB - 1));
+}
+
+static inline void lat_hist_record(lat_hist_t *h, uint32_t v)
+{
+    if (!h->count || v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+    h->count++;
+    h->sum += v;
+    h->buckets[lat_hist_index(v)]++;
+}
+
+void lat_hist_reset(lat_hist_t *h);
+
+/* Smallest and largest value that land in bucket i */
+uint32_t lat_hist_bucket_low(unsigned i);
+uint32_t lat_hist_bucket_high(unsigned i);
+
+/* Upper bound of the bucket holding the pct-th percentile (0-100), clamped to max */
+uint32_t lat_hist_percentile(const lat_hist_t *h, double pct);
+
+/* One line: "label  n=...  min ...  p50 ...  p90 ...  p99 ...  p99.9 ...  max ... unit" */
+void lat_hist_print(FILE *f, const char *label, const lat_hist_t *h, const char *unit);
+
+/* Non-empty buckets with counts and a bar, adjacent buckets merged down to at most rows */
+void lat_hist_print_distribution(FILE *f, const lat_hist_t *h, const char *unit, unsigned rows);
+
+#endif /* LAT_HIST_H */
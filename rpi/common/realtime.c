@@ -0,0 +1,80 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "realtime.h"
+
+static struct rusage baseline;      /* taken once realtime_enter() has run */
+static int           entered;
+
+/* noinline so the frame is really allocated and written, not optimised away */
+static void __attribute__((noinline)) prefault_stack(void)
+{
+    volatile unsigned char stack[REALTIME_STACK_PREFAULT];
+
+    for (size_t i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+}
+
+int realtime_enter(const realtime_config_t *cfg)
+{
+    struct sched_param param = { .sched_priority = cfg->priority };
+    int                rc    = 0;
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        fprintf(stderr, "Failed to lock memory: %s\n", strerror(errno));
+        rc = -1;
+    }
+    prefault_stack();
+
+    if (cfg->cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cfg->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+            fprintf(stderr, "Failed to pin to CPU %d: %s\n", cfg->cpu, strerror(errno));
+            rc = -1;
+        }
+    }
+
+    if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+        fprintf(stderr, "Failed to set SCHED_FIFO priority %d: %s\n", cfg->priority, strerror(errno));
+        rc = -1;
+    }
+
+    getrusage(RUSAGE_SELF, &baseline);
+    entered = 1;
+    return rc;
+}
+
+void realtime_report(FILE *f)
+{
+    struct sched_param param  = { 0 };
+    int                policy = sched_getscheduler(0);
+    struct rusage      ru;
+    cpu_set_t          set;
+    int                cpu = -1;
+
+    sched_getparam(0, &param);
+    getrusage(RUSAGE_SELF, &ru);
+
+    /* name the CPU only when pinned to exactly one */
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) == 1)
+        for (cpu = 0; !CPU_ISSET(cpu, &set); cpu++)
+            ;
+
+    fprintf(f, "Scheduling: %s", policy == SCHED_FIFO ? "SCHED_FIFO" : policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER");
+    if (policy == SCHED_FIFO || policy == SCHED_RR)
+        fprintf(f, " %d", param.sched_priority);
+    if (cpu >= 0)
+        fprintf(f, ", CPU %d", cpu);
+    fprintf(f, ", %ld involuntary / %ld voluntary context switches, %ld major / %ld minor page faults%s\n",
+            ru.ru_nivcsw - baseline.ru_nivcsw, ru.ru_nvcsw - baseline.ru_nvcsw,
+            ru.ru_majflt - baseline.ru_majflt, ru.ru_minflt - baseline.ru_minflt,
+            entered ? " since entering real-time mode" : "");
+}
@@ -0,0 +1,34 @@
+/*
+ * Real-time execution for the input daemons
+ *
+ * Under emulator load a SCHED_OTHER poll loop on a Pi Zero can wake tens of
+ * milliseconds late. realtime_enter() moves the calling process to SCHED_FIFO,
+ * locks its memory so a page fault never stalls a poll, optionally pins it to
+ * one CPU, and touches a slab of stack up front so the first deep call path
+ * does not fault either. Call it after start-up allocations are done.
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include <stdio.h>
+
+#define REALTIME_DEFAULT_PRIORITY   50
+#define REALTIME_STACK_PREFAULT     (256 * 1024)
+
+typedef struct {
+    int priority;               /* SCHED_FIFO priority, 1-99 */
+    int cpu;                    /* CPU to pin to, or -1 */
+} realtime_config_t;
+
+/*
+ * Applies cfg to the whole process. Each step that fails is reported on
+ * stderr and the rest are still tried; returns 0 when all succeeded, -1
+ * otherwise (usually EPERM without CAP_SYS_NICE / CAP_IPC_LOCK).
+ */
+int realtime_enter(const realtime_config_t *cfg);
+
+/* One line with the policy in effect and the context switches and page faults since realtime_enter() */
+void realtime_report(FILE *f);
+
+#endif /* REALTIME_H */
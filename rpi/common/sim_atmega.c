@@ -0,0 +1,547 @@
+/*
+ * Simulated ATmega8 running the application firmware
+ *
+ * The app model (sim_app_*) follows atmega/firmware/firmware.ino, see
+ * sim_atmega.h. "sim:atmega[:opt...]" runs it on its own at 0x30, with the
+ * inputs driven from the options, so the gamepad, gpio and backlight tools
+ * can run end to end without a board.
+ *
+ * Options (colon separated):
+ *   buttons=HEX      buttons held down from the start, bit0-7 = PORTB, bit8-15 = PORTD
+ *   axes=LX,LY,RX,RY stick positions from the start (default 128 each)
+ *   input=PATH       input script, one "<ms> <buttons hex> [<lx> <ly> <rx> <ry>]"
+ *                    line per change, ms counted from open; '#' starts a comment
+ *   input-loop       restart the script at the time of its last line
+ *   start=US         count the script from this CLOCK_MONOTONIC time in
+ *                    microseconds instead of from open, so another process
+ *                    knows exactly when each change happens
+ *   version=STR      version string in the version frame (default "sim")
+ *   state=PATH       keep the chip powered between runs: load the EEPROM and
+ *                    the registers (pins, brightness, display, CRC) from PATH
+ *                    and save them back on close; without it every run is a
+ *                    power-up with an erased EEPROM
+ *   seed=N           seed for the fault injection below
+ *   nack=PCT         NACK PCT% of all transactions
+ *   corrupt=PCT      flip a bit in PCT% of the frames read
+ *
+ * A valid I2C_CMD_BOOTLOADER resets the app, as on a chip without the
+ * bootloader; use sim:bootloader to model the update path.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "i2c_bus.h"
+#include "sim_atmega.h"
+
+/* firmware.ino timing, in seconds */
+#define CMD_LATENCY_S       0.0002      /* STOP until the main loop runs the command */
+#define DEBOUNCE_S          0.010       /* BTN_DEBOUNCE_DURATION loops of LOOP_MS */
+#define APP_RESET_S         0.020       /* watchdog reset until TWI is up again */
+
+/* config.h */
+#define EEPROM_BRIGHT_ADDR  0
+#define EEPROM_DDRB         1
+#define EEPROM_PORTB        2
+#define EEPROM_DDRD         3
+#define EEPROM_PORTD        4
+#define BRIGHTNESS_DEFAULT  4
+
+#define SCRIPT_MAX_EVENTS   4096
+
+#define STATE_MAGIC         "TSAT"
+#define STATE_REGS          9           /* DDRB DDRD PORTB PORTD brightness display CRC-on CRC (LE) */
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* --- Application model --- */
+
+/* Inputs idle high (pull-ups on the board) and read low while pressed; outputs read their PORT bit */
+static uint16_t pin_levels(const sim_app_t *app)
+{
+    uint16_t ddr  = (uint16_t)(app->ddrd << 8 | app->ddrb);
+    uint16_t port = (uint16_t)(app->portd << 8 | app->portb);
+
+    return (uint16_t)((ddr & port) | (~ddr & ~app->pressed));
+}
+
+/* Recomputes the pins, starting the debounce hold of any that went high */
+static void update_pins(sim_app_t *app, double now)
+{
+    uint16_t pins = pin_levels(app);
+    uint16_t rose = (uint16_t)(pins & ~app->pins);
+
+    for (int i = 0; i < 16; i++)
+        if (rose & (1u << i))
+            app->low_until[i] = now + DEBOUNCE_S;
+    app->pins = pins;
+}
+
+static uint16_t debounced_buttons(const sim_app_t *app, double now)
+{
+    uint16_t buttons = (uint16_t)~app->pins;
+
+    for (int i = 0; i < 16; i++)
+        if (now < app->low_until[i])
+            buttons |= (uint16_t)(1u << i);
+    return buttons;
+}
+
+void sim_app_reset(sim_app_t *app)
+{
+    const uint8_t *ee = app->eeprom;
+
+    app->ddrb       = (uint8_t)~ee[EEPROM_DDRB];
+    app->ddrd       = (uint8_t)~ee[EEPROM_DDRD];
+    app->portb      = ee[EEPROM_PORTB];
+    app->portd      = ee[EEPROM_PORTD];
+    app->brightness = ee[EEPROM_BRIGHT_ADDR] > I2C_BRIGHT_MAX ? BRIGHTNESS_DEFAULT : ee[EEPROM_BRIGHT_ADDR];
+    app->display_on = 1;
+    app->crc_active = 1;
+    app->crc        = 0;
+    app->mode       = 0;
+    app->cmd_len    = 0;
+    app->pins       = pin_levels(app);
+    memset(app->low_until, 0, sizeof(app->low_until));
+}
+
+void sim_app_set_input(sim_app_t *app, double now, uint16_t pressed, const uint8_t axes[4])
+{
+    app->pressed = pressed;
+    memcpy(app->axes, axes, sizeof(app->axes));
+    update_pins(app, now);
+}
+
+/* processI2CCommand() */
+static void run_command(sim_app_t *app, double now)
+{
+    const uint8_t *c   = app->cmd;
+    size_t         len = app->cmd_len;
+
+    app->cmd_len = 0;
+    switch (c[0]) {
+    case I2C_CMD_BRIGHT:
+        if (len < 2)
+            break;
+        if (c[1] == I2C_BRIGHT_DISABLE) {
+            app->display_on = 0;
+        } else if (c[1] == I2C_BRIGHT_ENABLE) {
+            app->display_on = 1;
+            app->eeprom[EEPROM_BRIGHT_ADDR] = app->brightness;
+        } else if (c[1] <= I2C_BRIGHT_MAX) {
+            app->brightness = c[1];
+            app->display_on = 1;
+            app->eeprom[EEPROM_BRIGHT_ADDR] = app->brightness;
+        }
+        break;
+    case I2C_CMD_CRC:
+        if (len >= 2)
+            app->crc_active = c[1] != 0;
+        break;
+    case I2C_CMD_GPIO_ALL:
+        if (len < 5)
+            break;
+        app->ddrb  = c[1];
+        app->ddrd  = c[2];
+        app->portb = c[3];
+        app->portd = c[4];
+        update_pins(app, now);
+        break;
+    case I2C_CMD_GPIO_SAVE:
+        app->eeprom[EEPROM_DDRB]  = (uint8_t)~app->ddrb;
+        app->eeprom[EEPROM_DDRD]  = (uint8_t)~app->ddrd;
+        app->eeprom[EEPROM_PORTB] = app->portb;
+        app->eeprom[EEPROM_PORTD] = app->portd;
+        break;
+    case I2C_CMD_VERSION:
+    case I2C_CMD_GPIO_READ:
+        app->mode = c[0];
+        break;
+    }
+}
+
+static void put_crc_be(uint8_t *frame, size_t len)
+{
+    uint16_t crc = topper_crc16(frame, (uint8_t)len);
+
+    frame[len]     = (uint8_t)(crc >> 8);
+    frame[len + 1] = (uint8_t)crc;
+}
+
+/* selectTxFrame() */
+static size_t build_frame(sim_app_t *app, double now, uint8_t *frame)
+{
+    if (app->mode == I2C_CMD_VERSION) {
+        app->mode = 0;
+        memcpy(frame, app->version, strnlen(app->version, VERSIONFRAME_STR_LEN));
+        put_crc_be(frame, VERSIONFRAME_STR_LEN);
+        memcpy(frame + VERSIONFRAME_META, app->meta, META_LEN);
+        put_crc_be(frame + VERSIONFRAME_META, META_LEN);
+        return VERSIONFRAME_LEN;
+    }
+
+    if (app->mode == I2C_CMD_GPIO_READ) {
+        app->mode = 0;
+        frame[PINFRAME_DDRB]  = app->ddrb;
+        frame[PINFRAME_DDRD]  = app->ddrd;
+        frame[PINFRAME_PORTB] = app->portb;
+        frame[PINFRAME_PORTD] = app->portd;
+        frame[PINFRAME_PINB]  = (uint8_t)app->pins;
+        frame[PINFRAME_PIND]  = (uint8_t)(app->pins >> 8);
+        frame[6]              = 0;
+        put_crc_be(frame, PINFRAME_CRC);
+        return PINFRAME_LEN;
+    }
+
+    uint16_t buttons = debounced_buttons(app, now);
+
+    frame[REPORT_BUTTONS]     = (uint8_t)buttons;
+    frame[REPORT_BUTTONS + 1] = (uint8_t)(buttons >> 8);
+    memcpy(frame + REPORT_JOY_LX, app->axes, 4);
+    frame[REPORT_STATUS] = (uint8_t)(app->brightness & REPORT_STATUS_BRIGHTNESS);
+    if (app->display_on)
+        frame[REPORT_STATUS] |= REPORT_STATUS_DISPLAY_ON;
+    if (app->crc_active)
+        frame[REPORT_STATUS] |= REPORT_STATUS_CRC_ACTIVE;
+    if (app->ddrb | app->ddrd)
+        frame[REPORT_STATUS] |= REPORT_STATUS_DDR_MODIFIED;
+    if (app->portb != 0xFF || app->portd != 0xFF)
+        frame[REPORT_STATUS] |= REPORT_STATUS_PORT_MODIFIED;
+
+    /* with CRC off the firmware keeps sending the last CRC it computed */
+    if (app->crc_active)
+        app->crc = topper_crc16(frame, REPORT_CRC);
+    frame[REPORT_CRC]     = (uint8_t)app->crc;
+    frame[REPORT_CRC + 1] = (uint8_t)(app->crc >> 8);
+    return REPORT_LEN;
+}
+
+void sim_app_settle(sim_app_t *app)
+{
+    if (app->cmd_len)
+        run_command(app, app->cmd_at);
+}
+
+int sim_app_xfer(sim_app_t *app, double now,
+                 const uint8_t *w, size_t wlen, uint8_t *r, size_t rlen)
+{
+    uint8_t frame[VERSIONFRAME_LEN];
+    size_t  len;
+
+    if (app->cmd_len && now >= app->cmd_at)
+        run_command(app, now);
+
+    /* the read of a write-then-read is selected before the main loop sees the write */
+    if (rlen) {
+        memset(frame, 0, sizeof(frame));
+        len = build_frame(app, now, frame);
+        memset(r, 0xFF, rlen);
+        memcpy(r, frame, rlen < len ? rlen : len);
+    }
+
+    /* empty writes (bus probes) do not re-run the previous command */
+    if (!wlen)
+        return 0;
+
+    if (w[0] == I2C_CMD_BOOTLOADER && wlen == 1 + I2C_BOOTLOADER_KEY_LEN &&
+        memcmp(w + 1, I2C_BOOTLOADER_KEY, I2C_BOOTLOADER_KEY_LEN) == 0) {
+        app->eeprom[EEPROM_BL_REQUEST] = BL_REQUEST_MAGIC;
+        app->cmd_len = 0;
+        return SIM_APP_REBOOT;
+    }
+
+    /* a new write lands in the same receive buffer; finish the old one first */
+    if (app->cmd_len)
+        run_command(app, now);
+    len = wlen < I2C_CMD_MAX_LEN ? wlen : I2C_CMD_MAX_LEN;
+    memcpy(app->cmd, w, len);
+    app->cmd_len = len;
+    app->cmd_at  = now + CMD_LATENCY_S;
+    return 0;
+}
+
+/* --- Standalone target --- */
+
+typedef struct {
+    double   t;                         /* seconds after the script started */
+    uint16_t pressed;
+    uint8_t  axes[4];
+} sim_event_t;
+
+typedef struct {
+    sim_app_t    app;
+    uint8_t      eeprom[SIM_EEPROM_SIZE];
+    uint8_t      meta[META_LEN];
+    double       ready_at;              /* NACKs until then after a reset */
+
+    sim_event_t *events;
+    size_t       n_events;
+    size_t       next_event;
+    int          loop;
+    double       script_start;
+
+    unsigned     seed;
+    int          nack_pct;
+    int          corrupt_pct;
+
+    char         state_path[256];
+} sim_atmega_t;
+
+static int chance(sim_atmega_t *s, int pct)
+{
+    return pct > 0 && (int)(rand_r(&s->seed) % 100) < pct;
+}
+
+/* Applies the script lines that are due */
+static void play_script(sim_atmega_t *s, double now)
+{
+    while (s->n_events) {
+        if (s->next_event == s->n_events) {
+            double period = s->events[s->n_events - 1].t;
+
+            if (!s->loop || period <= 0)
+                return;
+            s->script_start += period;
+            s->next_event    = 0;
+        }
+
+        const sim_event_t *e = &s->events[s->next_event];
+
+        if (s->script_start + e->t > now)
+            return;
+        sim_app_set_input(&s->app, s->script_start + e->t, e->pressed, e->axes);
+        s->next_event++;
+    }
+}
+
+static int load_script(sim_atmega_t *s, const char *path)
+{
+    FILE    *f = fopen(path, "r");
+    char     line[256];
+    int      lineno = 0;
+    uint8_t  axes[4];
+    double   last = 0;
+
+    if (!f) {
+        fprintf(stderr, "sim: cannot open input script %s\n", path);
+        return -1;
+    }
+    s->events = calloc(SCRIPT_MAX_EVENTS, sizeof(*s->events));
+    if (!s->events) {
+        fclose(f);
+        return -1;
+    }
+    memcpy(axes, s->app.axes, sizeof(axes));
+
+    while (fgets(line, sizeof(line), f)) {
+        char        *hash = strchr(line, '#');
+        double       ms;
+        unsigned     buttons, a[4];
+        int          n;
+        sim_event_t *e;
+
+        lineno++;
+        if (hash)
+            *hash = '\0';
+        n = sscanf(line, "%lf %x %u %u %u %u", &ms, &buttons, &a[0], &a[1], &a[2], &a[3]);
+        if (n <= 0)
+            continue;
+        if ((n != 2 && n != 6) || ms < 0 || ms / 1000.0 < last || buttons > 0xFFFF ||
+            (n == 6 && (a[0] > 255 || a[1] > 255 || a[2] > 255 || a[3] > 255))) {
+            fprintf(stderr, "sim: %s:%d: expected \"<ms> <buttons hex> [<lx> <ly> <rx> <ry>]\" in time order\n",
+                    path, lineno);
+            fclose(f);
+            return -1;
+        }
+        if (s->n_events == SCRIPT_MAX_EVENTS) {
+            fprintf(stderr, "sim: %s: more than %d lines\n", path, SCRIPT_MAX_EVENTS);
+            fclose(f);
+            return -1;
+        }
+        if (n == 6)
+            for (int i = 0; i < 4; i++)
+                axes[i] = (uint8_t)a[i];
+
+        e          = &s->events[s->n_events++];
+        e->t       = ms / 1000.0;
+        e->pressed = (uint16_t)buttons;
+        memcpy(e->axes, axes, sizeof(axes));
+        last = e->t;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int atmega_xfer(i2c_bus_t *bus, uint8_t addr,
+                       const uint8_t *w, size_t wlen, uint8_t *r, size_t rlen)
+{
+    sim_atmega_t *s   = bus->priv;
+    double        now = now_s();
+
+    play_script(s, now);
+
+    if (addr != I2C_APP_ADDR || chance(s, s->nack_pct))
+        return -1;
+    if (now < s->ready_at)
+        return -1;
+    if (s->ready_at) {
+        sim_app_reset(&s->app);
+        s->ready_at = 0;
+    }
+
+    if (sim_app_xfer(&s->app, now, w, wlen, r, rlen) == SIM_APP_REBOOT) {
+        /* no bootloader to honour the request: the app simply starts again */
+        s->eeprom[EEPROM_BL_REQUEST] = 0xFF;
+        s->ready_at = now + APP_RESET_S;
+    }
+
+    if (rlen && chance(s, s->corrupt_pct))
+        r[rand_r(&s->seed) % rlen] ^= (uint8_t)(1u << (rand_r(&s->seed) % 8));
+    return 0;
+}
+
+static void atmega_close(i2c_bus_t *bus)
+{
+    sim_atmega_t *s = bus->priv;
+    FILE         *f;
+
+    sim_app_settle(&s->app);
+    if (s->state_path[0]) {
+        const sim_app_t *app = &s->app;
+        uint8_t          regs[STATE_REGS] = {
+            app->ddrb, app->ddrd, app->portb, app->portd, app->brightness,
+            (uint8_t)app->display_on, (uint8_t)app->crc_active, (uint8_t)app->crc, (uint8_t)(app->crc >> 8),
+        };
+
+        f = fopen(s->state_path, "wb");
+        if (!f || fwrite(STATE_MAGIC, 4, 1, f) != 1 ||
+            fwrite(s->eeprom, sizeof(s->eeprom), 1, f) != 1 ||
+            fwrite(regs, sizeof(regs), 1, f) != 1)
+            fprintf(stderr, "sim: failed to save %s\n", s->state_path);
+        if (f)
+            fclose(f);
+    }
+    free(s->events);
+    free(s);
+}
+
+static const i2c_bus_ops_t atmega_ops = { atmega_xfer, atmega_close };
+
+static int parse_axes(const char *arg, uint8_t axes[4])
+{
+    unsigned a[4];
+
+    if (sscanf(arg, "%u,%u,%u,%u", &a[0], &a[1], &a[2], &a[3]) != 4 ||
+        a[0] > 255 || a[1] > 255 || a[2] > 255 || a[3] > 255)
+        return 0;
+    for (int i = 0; i < 4; i++)
+        axes[i] = (uint8_t)a[i];
+    return 1;
+}
+
+/* Restores a chip saved by atmega_close(); call after sim_app_reset() */
+static int load_state(sim_atmega_t *s)
+{
+    FILE      *f = fopen(s->state_path, "rb");
+    char       magic[4];
+    uint8_t    regs[STATE_REGS];
+    sim_app_t *app = &s->app;
+    int        ok;
+
+    if (!f)
+        return 0;   /* first run: power-up */
+    ok = fread(magic, 4, 1, f) == 1 && memcmp(magic, STATE_MAGIC, 4) == 0 &&
+         fread(s->eeprom, sizeof(s->eeprom), 1, f) == 1 &&
+         fread(regs, sizeof(regs), 1, f) == 1;
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "sim: %s is not an atmega state file\n", s->state_path);
+        return -1;
+    }
+    app->ddrb       = regs[0];
+    app->ddrd       = regs[1];
+    app->portb      = regs[2];
+    app->portd      = regs[3];
+    app->brightness = regs[4] & REPORT_STATUS_BRIGHTNESS;
+    app->display_on = regs[5] != 0;
+    app->crc_active = regs[6] != 0;
+    app->crc        = (uint16_t)(regs[7] | regs[8] << 8);
+    return 0;
+}
+
+int sim_atmega_open(i2c_bus_t *bus, const char *opts)
+{
+    sim_atmega_t *s = calloc(1, sizeof(*s));
+    char          buf[512];
+    char         *tok, *save;
+    char          script[256] = "";
+    unsigned      buttons = 0;
+    int           axes_ok = 1;
+    double        now, start = 0;
+
+    if (!s)
+        return -1;
+
+    memset(s->eeprom, 0xFF, sizeof(s->eeprom));
+    memset(s->meta, 0xFF, sizeof(s->meta));     /* an image without build metadata */
+    memset(s->app.axes, 0x80, sizeof(s->app.axes));
+    snprintf(s->app.version, sizeof(s->app.version), "sim");
+    s->seed = 1;
+
+    snprintf(buf, sizeof(buf), "%s", opts);
+    for (tok = strtok_r(buf, ":", &save); tok; tok = strtok_r(NULL, ":", &save)) {
+        if      (strncmp(tok, "buttons=", 8) == 0) buttons        = (unsigned)strtoul(tok + 8, NULL, 16) & 0xFFFF;
+        else if (strncmp(tok, "axes=", 5) == 0)    axes_ok        = parse_axes(tok + 5, s->app.axes);
+        else if (strncmp(tok, "input=", 6) == 0)   snprintf(script, sizeof(script), "%s", tok + 6);
+        else if (strcmp(tok, "input-loop") == 0)   s->loop        = 1;
+        else if (strncmp(tok, "start=", 6) == 0)   start          = strtod(tok + 6, NULL) / 1e6;
+        else if (strncmp(tok, "version=", 8) == 0) snprintf(s->app.version, sizeof(s->app.version), "%s", tok + 8);
+        else if (strncmp(tok, "state=", 6) == 0)   snprintf(s->state_path, sizeof(s->state_path), "%s", tok + 6);
+        else if (strncmp(tok, "seed=", 5) == 0)    s->seed        = (unsigned)atoi(tok + 5);
+        else if (strncmp(tok, "nack=", 5) == 0)    s->nack_pct    = atoi(tok + 5);
+        else if (strncmp(tok, "corrupt=", 8) == 0) s->corrupt_pct = atoi(tok + 8);
+        else {
+            fprintf(stderr, "sim: unknown atmega option '%s'\n", tok);
+            free(s);
+            return -1;
+        }
+    }
+
+    if (!axes_ok) {
+        fprintf(stderr, "sim: axes= takes four values 0-255\n");
+        free(s);
+        return -1;
+    }
+    if (script[0] && load_script(s, script) < 0) {
+        free(s->events);
+        free(s);
+        return -1;
+    }
+
+    now              = now_s();
+    s->app.eeprom    = s->eeprom;
+    s->app.meta      = s->meta;
+    s->script_start  = start > 0 ? start : now;
+    sim_app_reset(&s->app);
+    if (s->state_path[0] && load_state(s) < 0) {
+        free(s->events);
+        free(s);
+        return -1;
+    }
+    sim_app_set_input(&s->app, now, (uint16_t)buttons, s->app.axes);
+    memset(s->app.low_until, 0, sizeof(s->app.low_until));     /* nothing was released before power-up */
+    play_script(s, now);
+
+    bus->ops  = &atmega_ops;
+    bus->priv = s;
+    return 0;
+}
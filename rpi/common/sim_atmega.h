@@ -0,0 +1,66 @@
+/*
+ * Behavioural model of the ATmega application (atmega/firmware/firmware.ino)
+ *
+ * Shared by "sim:atmega", which runs the app on its own, and sim:bootloader,
+ * which hands over to it after a passed finalize. The model keeps the
+ * firmware's registers and modes rather than canned frames:
+ *
+ *   - report frames carry the debounced buttons (a released button stays
+ *     pressed for 10 ms), the axes and the status bits, and keep the last
+ *     CRC when CRC is switched off
+ *   - a command takes effect a moment after its STOP, so a read chained to
+ *     the write with a repeated START still sees the old mode
+ *   - DDRB/DDRD/PORTB/PORTD behave as on the chip: output pins read back
+ *     their PORT level and show up as buttons when driven low, and
+ *     I2C_CMD_GPIO_SAVE and the brightness persist in EEPROM
+ */
+
+#ifndef SIM_ATMEGA_H
+#define SIM_ATMEGA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "topper_protocol.h"
+
+#define SIM_EEPROM_SIZE     512
+
+#define SIM_APP_REBOOT      1           /* sim_app_xfer(): valid I2C_CMD_BOOTLOADER received */
+
+typedef struct {
+    uint8_t       *eeprom;              /* SIM_EEPROM_SIZE bytes, owned by the caller */
+    const uint8_t *meta;                /* META_LEN bytes of flash at META_ADDR */
+    char           version[VERSIONFRAME_STR_LEN + 1];
+
+    /* firmware state */
+    uint8_t        ddrb, ddrd, portb, portd;
+    uint8_t        brightness;
+    int            display_on;
+    int            crc_active;
+    uint16_t       crc;                 /* last report CRC computed */
+    uint8_t        mode;                /* I2C_CMD_VERSION, I2C_CMD_GPIO_READ or 0 */
+    uint8_t        cmd[I2C_CMD_MAX_LEN];
+    size_t         cmd_len;             /* 0 when no command is pending */
+    double         cmd_at;              /* when the main loop picks it up */
+
+    /* inputs */
+    uint16_t       pressed;             /* buttons held down, bit0-7 = PORTB, bit8-15 = PORTD */
+    uint8_t        axes[4];
+    uint16_t       pins;                /* PIND << 8 | PINB */
+    double         low_until[16];       /* debounce: reported pressed until then */
+} sim_app_t;
+
+/* Power-up or reset: loads pins and brightness from EEPROM like setup() */
+void sim_app_reset(sim_app_t *app);
+
+/* Changes the buttons held down and the stick positions at time now */
+void sim_app_set_input(sim_app_t *app, double now, uint16_t pressed, const uint8_t axes[4]);
+
+/* Runs a command still waiting for the main loop, e.g. before the EEPROM is saved */
+void sim_app_settle(sim_app_t *app);
+
+/* One transaction at 0x30. Returns 0 or SIM_APP_REBOOT; the app never NACKs. */
+int sim_app_xfer(sim_app_t *app, double now,
+                 const uint8_t *w, size_t wlen, uint8_t *r, size_t rlen);
+
+#endif /* SIM_ATMEGA_H */
@@ -0,0 +1,520 @@
+/*
+ * Simulated ATmega8 behind the TWI bootloader
+ *
+ * A behavioural model of atmega/bootloader/bootloader.c, reached through the
+ * i2c_bus transport as "sim:bootloader[:opt...]". It follows the bootloader's
+ * command set and timing closely enough to run update_firmware end to end:
+ * page programming takes 4.5 ms per page behind a two-page queue, the
+ * finalize checksum and page CRCs NACK the bus while they are computed, and a
+ * passed finalize hands over to the app model of sim_atmega.c at 0x30.
+ *
+ * Options (colon separated):
+ *   version=N        emulate bootloader version N (1..BOOTLOADER_VERSION)
+ *   app              start in the app if the flash checksum is valid
+ *   state=PATH       load flash, EEPROM and app/bootloader mode from PATH and
+ *                    save them back on close
+ *   seed=N           seed for the fault injection below
+ *   nack=PCT         NACK PCT% of all transactions
+ *   corrupt=PCT      flip a bit in PCT% of received pages
+ *   drop=N           acknowledge the Nth page write but never program it
+ *   info-corrupt=N   corrupt the first N CMD_READ_INFO responses
+ *   verify-fail      fail every CMD_FINALIZE checksum
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "i2c_bus.h"
+#include "sim_atmega.h"
+#include "topper_protocol.h"
+
+#define SIM_PAGESIZE        64
+#define SIM_FLASH_SIZE      8192
+#define SIM_BL_START        0x1C00
+#define SIM_APP_PAGES       (SIM_BL_START / SIM_PAGESIZE)
+
+/* ATmega8 timing, in seconds */
+#define PAGE_PROG_S         0.0045      /* page erase + write */
+#define CHECKSUM_S          0.007       /* compute_flash_checksum */
+#define PAGE_CRC_S          0.0003      /* compute_page_crcs, per page */
+#define EEPROM_BYTE_S       0.0085      /* one EEPROM byte write */
+#define APP_START_S         0.005       /* bootloader jump until the app's TWI is up */
+#define BL_ENTRY_S          0.030       /* I2C_CMD_BOOTLOADER until 0x29 answers */
+
+#define STATE_MAGIC         "TSIM"
+
+typedef struct {
+    uint8_t page;
+    uint8_t data[SIM_PAGESIZE];
+    int     drop;
+} sim_page_t;
+
+typedef struct {
+    uint8_t     flash[SIM_FLASH_SIZE];
+    uint8_t     eeprom[SIM_EEPROM_SIZE];
+    int         version;
+    int         in_app;
+    double      app_ready_at;
+    double      bl_ready_at;
+
+    /* bootloader state */
+    uint8_t     cmd;
+    uint8_t     args[3];
+    sim_page_t  queue[2];
+    int         queued;
+    double      busy_until;             /* queue[0] finishes programming */
+    uint8_t     last_page;
+    int         rejected;
+    uint8_t     verify_status;
+    int         verifying;
+    double      nack_until;             /* checksum or page CRCs being computed */
+    uint16_t    ee_addr;
+    uint8_t     ee_buf[BL_EEPROM_WRITE_MAX];
+    int         ee_len;
+    int         ee_pos;
+    double      ee_next;
+
+    sim_app_t   app;
+
+    /* faults */
+    unsigned    seed;
+    int         nack_pct;
+    int         corrupt_pct;
+    int         drop_nth;
+    int         info_corrupt;
+    int         verify_fail;
+    int         pages_received;
+
+    char        state_path[256];
+} sim_bl_t;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int chance(sim_bl_t *s, int pct)
+{
+    return pct > 0 && (int)(rand_r(&s->seed) % 100) < pct;
+}
+
+static int checksum_valid(const sim_bl_t *s)
+{
+    uint8_t  sum1 = 0, sum2 = 0, xor = 0;
+    uint16_t i;
+
+    for (i = 0; i < SIM_BL_START - 3; i++) {
+        sum1 += s->flash[i];
+        sum2 += sum1;
+        xor  ^= s->flash[i];
+    }
+    return sum1 == s->flash[SIM_BL_START - 3] &&
+           sum2 == s->flash[SIM_BL_START - 2] &&
+           xor  == s->flash[SIM_BL_START - 1];
+}
+
+/* Hands over to the application, which boots from the EEPROM and flash contents */
+static void start_app(sim_bl_t *s)
+{
+    const uint8_t *meta = s->flash + META_ADDR;
+
+    s->in_app     = 1;
+    s->app.eeprom = s->eeprom;
+    s->app.meta   = meta;
+    if (meta[0] == META_MAGIC0 && meta[1] == META_MAGIC1)
+        snprintf(s->app.version, sizeof(s->app.version), "%.*s", META_VERSION_LEN, (const char *)meta + META_VERSION);
+    else
+        snprintf(s->app.version, sizeof(s->app.version), "sim");
+    sim_app_reset(&s->app);
+}
+
+/* Catches the model up with wall-clock time: programming, EEPROM and finalize */
+static void advance(sim_bl_t *s, double now)
+{
+    while (s->queued && now >= s->busy_until) {
+        if (!s->queue[0].drop)
+            memcpy(s->flash + s->queue[0].page * SIM_PAGESIZE, s->queue[0].data, SIM_PAGESIZE);
+        s->last_page = s->queue[0].page;
+        s->queue[0]  = s->queue[1];
+        if (--s->queued)
+            s->busy_until += PAGE_PROG_S;
+    }
+
+    while (s->ee_len && now >= s->ee_next) {
+        uint16_t addr = s->ee_addr + s->ee_pos;
+        if (s->eeprom[addr] != s->ee_buf[s->ee_pos]) {
+            s->eeprom[addr] = s->ee_buf[s->ee_pos];
+            s->ee_next += EEPROM_BYTE_S;
+        }
+        if (++s->ee_pos >= s->ee_len)
+            s->ee_len = 0;
+    }
+
+    if (s->verifying && now >= s->nack_until) {
+        s->verifying = 0;
+        if (!s->verify_fail && checksum_valid(s)) {
+            s->verify_status = VERIFY_PASSED;
+            start_app(s);
+            s->app_ready_at  = s->nack_until + APP_START_S;
+        } else {
+            s->verify_status = VERIFY_FAILED;
+        }
+    }
+}
+
+static int cmd_min_version(uint8_t cmd)
+{
+    switch (cmd) {
+        case CMD_READ_INFO:
+        case CMD_WRITE_PAGE:
+        case CMD_FINALIZE:       return 1;
+        case CMD_READ_STATUS:    return 2;
+        case CMD_READ_PAGE_CRC:  return 3;
+        case CMD_READ_PAGE:
+        case CMD_READ_EEPROM:
+        case CMD_WRITE_EEPROM:   return 4;
+        case CMD_WRITE_PAGE_CRC: return 5;
+        default:                 return 0x100;
+    }
+}
+
+static int bl_queue_page(sim_bl_t *s, double now, const uint8_t *w, size_t wlen)
+{
+    int         with_crc = w[0] == CMD_WRITE_PAGE_CRC;
+    size_t      need     = 2 + SIM_PAGESIZE + (with_crc ? 2 : 0);
+    int         slots    = s->version >= 2 ? 2 : 1;
+    sim_page_t *p;
+
+    /* the page byte is ACKed, the first data byte NACKed */
+    if (w[1] >= SIM_APP_PAGES || s->queued >= slots) {
+        if (with_crc)
+            s->rejected = 1;
+        return -1;
+    }
+    if (wlen < need) {
+        if (with_crc)
+            s->rejected = 1;
+        return 0;
+    }
+
+    p = &s->queue[s->queued];
+    p->page = w[1];
+    memcpy(p->data, w + 2, SIM_PAGESIZE);
+    p->drop = 0;
+
+    if (chance(s, s->corrupt_pct)) {
+        unsigned bit = rand_r(&s->seed) % (SIM_PAGESIZE * 8);
+        p->data[bit / 8] ^= (uint8_t)(1 << (bit % 8));
+    }
+    if (with_crc) {
+        uint16_t crc = topper_crc16_update(TOPPER_CRC16_INIT, p->page);
+        int      i;
+        for (i = 0; i < SIM_PAGESIZE; i++)
+            crc = topper_crc16_update(crc, p->data[i]);
+        if (crc != (uint16_t)(w[2 + SIM_PAGESIZE] << 8 | w[3 + SIM_PAGESIZE])) {
+            s->rejected = 1;
+            return 0;
+        }
+        s->rejected = 0;
+    }
+
+    if (++s->pages_received == s->drop_nth)
+        p->drop = 1;
+    if (!s->queued)
+        s->busy_until = now + PAGE_PROG_S;
+    s->queued++;
+    return 0;
+}
+
+/* Write phase of a bootloader transaction. Returns -1 where the ATmega would NACK. */
+static int bl_write(sim_bl_t *s, double now, const uint8_t *w, size_t wlen)
+{
+    double idle_at = s->queued ? s->busy_until + (s->queued - 1) * PAGE_PROG_S : now;
+
+    if (s->version < cmd_min_version(w[0]))
+        return -1;
+
+    s->cmd = w[0];
+    memcpy(s->args, w + 1, wlen > 3 ? 2 : wlen - 1);
+
+    switch (w[0]) {
+        case CMD_WRITE_PAGE:
+        case CMD_WRITE_PAGE_CRC:
+            return wlen < 2 ? 0 : bl_queue_page(s, now, w, wlen);
+
+        case CMD_FINALIZE:
+            s->verifying  = 1;
+            s->nack_until = (idle_at > now ? idle_at : now) + CHECKSUM_S;
+            return 0;
+
+        case CMD_READ_PAGE_CRC:
+            if (wlen >= 3 && w[2] > 0 && w[2] <= BL_PAGE_CRC_MAX &&
+                w[1] < SIM_APP_PAGES && w[2] <= SIM_APP_PAGES - w[1])
+                s->nack_until = (idle_at > now ? idle_at : now) + w[2] * PAGE_CRC_S;
+            else
+                s->args[1] = 0;
+            return 0;
+
+        case CMD_WRITE_EEPROM:
+            if (s->ee_len || now < s->ee_next)
+                return -1;
+            if (wlen > 3 && wlen - 3 <= BL_EEPROM_WRITE_MAX &&
+                ((w[1] << 8) | w[2]) + (wlen - 3) <= EEPROM_BL_FIRST) {
+                s->ee_addr = (uint16_t)(w[1] << 8 | w[2]);
+                s->ee_len  = (int)(wlen - 3);
+                s->ee_pos  = 0;
+                s->ee_next = now;
+                memcpy(s->ee_buf, w + 3, s->ee_len);
+            }
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+static void put_crc_be(uint8_t *frame, size_t len)
+{
+    uint16_t crc = topper_crc16(frame, (uint8_t)len);
+    frame[len]     = (uint8_t)(crc >> 8);
+    frame[len + 1] = (uint8_t)crc;
+}
+
+/* Read phase of a bootloader transaction: the response to the last command */
+static void bl_read(sim_bl_t *s, double now, uint8_t *r, size_t rlen)
+{
+    uint8_t resp[BL_READ_FRAME_LEN + BL_PAGE_CRC_MAX * 2];
+    size_t  len = 0;
+    int     i;
+
+    memset(resp, 0xFF, sizeof(resp));
+
+    switch (s->cmd) {
+        case CMD_READ_INFO: {
+            uint8_t sum1 = 0, sum2 = 0, xor = 0;
+
+            resp[0] = 0x1E;
+            resp[1] = 0x93;
+            resp[2] = 0x07;
+            resp[3] = (uint8_t)s->version;
+            resp[4] = SIM_APP_PAGES;
+            resp[5] = s->verify_status;
+            for (i = 0; i < 6; i++) {
+                sum1 += resp[i];
+                sum2 += sum1;
+                xor  ^= resp[i];
+            }
+            resp[6] = sum1;
+            resp[7] = sum2;
+            resp[8] = xor;
+            if (s->info_corrupt > 0) {
+                s->info_corrupt--;
+                resp[rand_r(&s->seed) % BL_INFO_LEN] ^= 0x10;
+            }
+            len = BL_INFO_LEN;
+            break;
+        }
+
+        case CMD_READ_STATUS: {
+            uint8_t flags = 0;
+
+            if (s->queued)
+                flags |= BL_STATUS_BUSY;
+            if (s->queued > 1)
+                flags |= BL_STATUS_FULL;
+            if (s->ee_len || now < s->ee_next)
+                flags |= BL_STATUS_EEPROM;
+            if (s->rejected)
+                flags |= BL_STATUS_REJECTED;
+            resp[0] = flags;
+            resp[1] = s->last_page;
+            resp[2] = flags ^ s->last_page ^ 0xFF;
+            len = BL_STATUS_LEN;
+            break;
+        }
+
+        case CMD_READ_PAGE_CRC:
+            if (!s->args[1])
+                break;
+            for (i = 0; i < s->args[1]; i++) {
+                uint16_t crc = topper_crc16(s->flash + (s->args[0] + i) * SIM_PAGESIZE, SIM_PAGESIZE);
+                resp[i * 2]     = (uint8_t)(crc >> 8);
+                resp[i * 2 + 1] = (uint8_t)crc;
+            }
+            len = (size_t)s->args[1] * 2;
+            put_crc_be(resp, len);
+            len += 2;
+            break;
+
+        case CMD_READ_PAGE:
+        case CMD_READ_EEPROM: {
+            int eeprom = s->cmd == CMD_READ_EEPROM;
+            int blocks = eeprom ? SIM_EEPROM_SIZE / BL_READ_BLOCK : SIM_FLASH_SIZE / SIM_PAGESIZE;
+
+            if (s->args[0] >= blocks || s->queued || s->ee_len || now < s->ee_next)
+                break;
+            memcpy(resp, (eeprom ? s->eeprom : s->flash) + s->args[0] * BL_READ_BLOCK, BL_READ_BLOCK);
+            put_crc_be(resp, BL_READ_BLOCK);
+            len = BL_READ_FRAME_LEN;
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    (void)len;
+    memset(r, 0xFF, rlen);
+    memcpy(r, resp, rlen < sizeof(resp) ? rlen : sizeof(resp));
+}
+
+/* --- Transport glue --- */
+
+static int sim_xfer(i2c_bus_t *bus, uint8_t addr,
+                    const uint8_t *w, size_t wlen, uint8_t *r, size_t rlen)
+{
+    sim_bl_t *s   = bus->priv;
+    double    now = now_s();
+
+    advance(s, now);
+
+    if (chance(s, s->nack_pct))
+        return -1;
+
+    if (addr == I2C_APP_ADDR && s->in_app && now >= s->app_ready_at) {
+        if (sim_app_xfer(&s->app, now, w, wlen, r, rlen) == SIM_APP_REBOOT) {
+            /* the bootloader honours the request and erases the marker */
+            s->eeprom[EEPROM_BL_REQUEST] = 0xFF;
+            s->in_app        = 0;
+            s->bl_ready_at   = now + BL_ENTRY_S;
+            s->cmd           = 0;
+            s->queued        = 0;
+            s->verify_status = VERIFY_PENDING;
+            s->last_page     = 0xFF;
+        }
+        return 0;
+    }
+
+    if (addr != I2C_BL_ADDR || s->in_app || now < s->bl_ready_at || now < s->nack_until)
+        return -1;
+
+    /* version 1 clears TWEA for the whole page write */
+    if (s->version < 2 && s->queued)
+        return -1;
+
+    if (wlen && bl_write(s, now, w, wlen) < 0)
+        return -1;
+    if (rlen) {
+        /* a command that starts a computation NACKs the repeated START */
+        if (now_s() < s->nack_until)
+            return -1;
+        bl_read(s, now, r, rlen);
+    }
+    return 0;
+}
+
+static void sim_close(i2c_bus_t *bus)
+{
+    sim_bl_t *s = bus->priv;
+    FILE     *f;
+    uint8_t   in_app;
+
+    advance(s, now_s() + 1.0);
+    if (s->in_app)
+        sim_app_settle(&s->app);
+
+    if (s->state_path[0]) {
+        in_app = (uint8_t)s->in_app;
+        f = fopen(s->state_path, "wb");
+        if (!f || fwrite(STATE_MAGIC, 4, 1, f) != 1 ||
+            fwrite(s->flash, sizeof(s->flash), 1, f) != 1 ||
+            fwrite(s->eeprom, sizeof(s->eeprom), 1, f) != 1 ||
+            fwrite(&in_app, 1, 1, f) != 1)
+            fprintf(stderr, "sim: failed to save %s\n", s->state_path);
+        if (f)
+            fclose(f);
+    }
+    free(s);
+}
+
+static const i2c_bus_ops_t sim_ops = { sim_xfer, sim_close };
+
+static int load_state(sim_bl_t *s)
+{
+    FILE   *f = fopen(s->state_path, "rb");
+    char    magic[4];
+    uint8_t in_app;
+    int     ok;
+
+    if (!f)
+        return 0;   /* first run: start blank */
+    ok = fread(magic, 4, 1, f) == 1 && memcmp(magic, STATE_MAGIC, 4) == 0 &&
+         fread(s->flash, sizeof(s->flash), 1, f) == 1 &&
+         fread(s->eeprom, sizeof(s->eeprom), 1, f) == 1 &&
+         fread(&in_app, 1, 1, f) == 1;
+    fclose(f);
+    if (!ok) {
+        fprintf(stderr, "sim: %s is not a simulator state file\n", s->state_path);
+        return -1;
+    }
+    if (in_app && checksum_valid(s))
+        start_app(s);
+    return 0;
+}
+
+int sim_bootloader_open(i2c_bus_t *bus, const char *opts)
+{
+    sim_bl_t *s = calloc(1, sizeof(*s));
+    char      buf[512];
+    char     *tok, *save;
+    int       app = 0;
+
+    if (!s)
+        return -1;
+
+    memset(s->flash, 0xFF, sizeof(s->flash));
+    memset(s->eeprom, 0xFF, sizeof(s->eeprom));
+    s->version   = BOOTLOADER_VERSION;
+    s->last_page = 0xFF;
+    s->seed      = 1;
+
+    snprintf(buf, sizeof(buf), "%s", opts);
+    for (tok = strtok_r(buf, ":", &save); tok; tok = strtok_r(NULL, ":", &save)) {
+        if      (strncmp(tok, "version=", 8) == 0)       s->version      = atoi(tok + 8);
+        else if (strcmp(tok, "app") == 0)                app             = 1;
+        else if (strncmp(tok, "state=", 6) == 0)         snprintf(s->state_path, sizeof(s->state_path), "%s", tok + 6);
+        else if (strncmp(tok, "seed=", 5) == 0)          s->seed         = (unsigned)atoi(tok + 5);
+        else if (strncmp(tok, "nack=", 5) == 0)          s->nack_pct     = atoi(tok + 5);
+        else if (strncmp(tok, "corrupt=", 8) == 0)       s->corrupt_pct  = atoi(tok + 8);
+        else if (strncmp(tok, "drop=", 5) == 0)          s->drop_nth     = atoi(tok + 5);
+        else if (strncmp(tok, "info-corrupt=", 13) == 0) s->info_corrupt = atoi(tok + 13);
+        else if (strcmp(tok, "verify-fail") == 0)        s->verify_fail  = 1;
+        else {
+            fprintf(stderr, "sim: unknown bootloader option '%s'\n", tok);
+            free(s);
+            return -1;
+        }
+    }
+
+    if (s->version < 1 || s->version > BOOTLOADER_VERSION) {
+        fprintf(stderr, "sim: bootloader version must be 1..%d\n", BOOTLOADER_VERSION);
+        free(s);
+        return -1;
+    }
+    if (s->state_path[0] && load_state(s) < 0) {
+        free(s);
+        return -1;
+    }
+    if (app && checksum_valid(s))
+        start_app(s);
+
+    bus->ops  = &sim_ops;
+    bus->priv = s;
+    return 0;
+}
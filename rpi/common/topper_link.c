@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "topper_link.h"
+
+struct topper_link {
+    int        sock;        /* topperd connection, or -1 */
+    i2c_bus_t *bus;         /* direct access when sock < 0 */
+};
+
+const char *topperd_socket_path(void)
+{
+    const char *path = getenv("TOPPERD_SOCKET");
+    return path && *path ? path : TOPPERD_SOCKET;
+}
+
+static int daemon_connect(void)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int                fd   = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if (fd < 0)
+        return -1;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", topperd_socket_path());
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+topper_link_t *topper_link_open(const char *bus_spec, int direct)
+{
+    topper_link_t *link = calloc(1, sizeof(*link));
+
+    if (!link) {
+        fprintf(stderr, "Out of memory.\n");
+        return NULL;
+    }
+
+    link->sock = direct ? -1 : daemon_connect();
+    if (link->sock >= 0)
+        return link;
+
+    link->bus = i2c_bus_open(bus_spec ? bus_spec : TOPPER_DEFAULT_BUS);
+    if (!link->bus) {
+        free(link);
+        return NULL;
+    }
+    return link;
+}
+
+void topper_link_close(topper_link_t *link)
+{
+    if (!link)
+        return;
+    if (link->sock >= 0)
+        close(link->sock);
+    i2c_bus_close(link->bus);
+    free(link);
+}
+
+int topper_link_is_daemon(const topper_link_t *link)
+{
+    return link->sock >= 0;
+}
+
+int topper_report_valid(const uint8_t frame[REPORT_LEN])
+{
+    uint16_t computed = topper_crc16(frame, REPORT_CRC);
+    uint16_t received = (uint16_t)frame[REPORT_CRC] | ((uint16_t)frame[REPORT_CRC + 1] << 8);
+    return computed == received;
+}
+
+/* One request/response round trip with topperd. Copies up to len response bytes to out. */
+static int daemon_call(topper_link_t *link, const topperd_req_t *req, uint8_t *out, size_t len)
+{
+    topperd_resp_t resp;
+    ssize_t        n;
+
+    if (send(link->sock, req, sizeof(*req), MSG_NOSIGNAL) != (ssize_t)sizeof(*req))
+        return TOPPER_ERR_IO;
+    do {
+        n = recv(link->sock, &resp, sizeof(resp), 0);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)sizeof(resp))
+        return TOPPER_ERR_IO;
+
+    if (out) {
+        if (resp.len < len)
+            return TOPPER_ERR_IO;
+        memcpy(out, resp.data, len);
+    }
+    return resp.status;
+}
+
+int topper_link_report(topper_link_t *link, uint8_t frame[REPORT_LEN], uint32_t max_age_us)
+{
+    if (link->sock >= 0) {
+        topperd_req_t req = { .op = TOPPERD_OP_REPORT, .max_age_us = max_age_us };
+        return daemon_call(link, &req, frame, REPORT_LEN);
+    }
+
+    if (i2c_bus_read(link->bus, I2C_APP_ADDR, frame, REPORT_LEN) < 0)
+        return TOPPER_ERR_IO;
+    return topper_report_valid(frame) ? TOPPER_OK : TOPPER_ERR_CRC;
+}
+
+int topper_link_command(topper_link_t *link, const uint8_t *cmd, size_t len)
+{
+    if (len == 0 || len > TOPPERD_MAX_DATA)
+        return TOPPER_ERR_IO;
+
+    if (link->sock >= 0) {
+        topperd_req_t req = { .op = TOPPERD_OP_COMMAND, .len = (uint8_t)len };
+        memcpy(req.data, cmd, len);
+        return daemon_call(link, &req, NULL, 0);
+    }
+
+    return i2c_bus_write(link->bus, I2C_APP_ADDR, cmd, len) < 0 ? TOPPER_ERR_IO : TOPPER_OK;
+}
+
+int topper_link_query(topper_link_t *link, uint8_t cmd, uint8_t *frame, size_t len)
+{
+    if (len == 0 || len > TOPPERD_MAX_DATA)
+        return TOPPER_ERR_IO;
+
+    if (link->sock >= 0) {
+        topperd_req_t req = { .op = TOPPERD_OP_QUERY, .len = 1, .reply_len = (uint8_t)len };
+        req.data[0] = cmd;
+        return daemon_call(link, &req, frame, len);
+    }
+
+    if (i2c_bus_write(link->bus, I2C_APP_ADDR, &cmd, 1) < 0)
+        return TOPPER_ERR_IO;
+    usleep(TOPPER_CMD_DELAY_US);
+    return i2c_bus_read(link->bus, I2C_APP_ADDR, frame, len) < 0 ? TOPPER_ERR_IO : TOPPER_OK;
+}
@@ -0,0 +1,85 @@
+/*
+ * Access to the ATmega application (0x30) for the Raspberry Pi utilities
+ *
+ * A link talks to topperd when it is running, so every tool shares one bus
+ * owner and a mode command (I2C_CMD_GPIO_READ, I2C_CMD_VERSION) can never be
+ * split from its read by another tool. Without the daemon the link opens the
+ * bus itself.
+ *
+ * The daemon protocol is one request and one response per SOCK_SEQPACKET
+ * message. Both ends run on the same host, so the structs go over the socket
+ * as they are.
+ */
+
+#ifndef TOPPER_LINK_H
+#define TOPPER_LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "i2c_bus.h"
+#include "topper_protocol.h"
+
+#define TOPPERD_SOCKET              "/run/topperd.sock"
+#define TOPPER_DEFAULT_BUS          "/dev/i2c-1"
+
+/* The app handles a command in its 1ms main loop; wait this long before reading the reply */
+#define TOPPER_CMD_DELAY_US         5000
+
+#define TOPPERD_MAX_DATA            32
+
+typedef enum {
+    TOPPERD_OP_REPORT  = 1,         /* read a report frame, or the cached one if fresh enough */
+    TOPPERD_OP_COMMAND = 2,         /* write data[0..len) */
+    TOPPERD_OP_QUERY   = 3,         /* write data, wait TOPPER_CMD_DELAY_US, read reply_len bytes */
+} topperd_op_t;
+
+typedef struct {
+    uint8_t  op;                    /* topperd_op_t */
+    uint8_t  len;                   /* bytes in data */
+    uint8_t  reply_len;             /* TOPPERD_OP_QUERY */
+    uint8_t  reserved;
+    uint32_t max_age_us;            /* TOPPERD_OP_REPORT: 0 always reads the bus */
+    uint8_t  data[TOPPERD_MAX_DATA];
+} topperd_req_t;
+
+typedef struct {
+    int8_t   status;                /* TOPPER_OK or a negative TOPPER_ERR_* */
+    uint8_t  len;                   /* bytes in data */
+    uint16_t reserved;
+    uint32_t age_us;                /* TOPPERD_OP_REPORT: how old the frame is */
+    uint8_t  data[TOPPERD_MAX_DATA];
+} topperd_resp_t;
+
+#define TOPPER_OK                   0
+#define TOPPER_ERR_IO               -1      /* NACK, bus or daemon failure */
+#define TOPPER_ERR_CRC              -2      /* frame read but its CRC is wrong */
+
+typedef struct topper_link topper_link_t;
+
+/* TOPPERD_SOCKET, or $TOPPERD_SOCKET when set */
+const char *topperd_socket_path(void);
+
+/*
+ * Connects to topperd, or opens bus_spec (NULL for TOPPER_DEFAULT_BUS) when
+ * the daemon is not running or direct is set. Prints the reason and returns
+ * NULL on failure.
+ */
+topper_link_t *topper_link_open(const char *bus_spec, int direct);
+void           topper_link_close(topper_link_t *link);
+
+/* 1 when requests go through topperd */
+int topper_link_is_daemon(const topper_link_t *link);
+
+/* Reads a report frame; the frame is filled in even on TOPPER_ERR_CRC. */
+int topper_link_report(topper_link_t *link, uint8_t frame[REPORT_LEN], uint32_t max_age_us);
+
+int topper_link_command(topper_link_t *link, const uint8_t *cmd, size_t len);
+
+/* Sends a mode command and reads the frame it selects. The caller checks the frame CRC. */
+int topper_link_query(topper_link_t *link, uint8_t cmd, uint8_t *frame, size_t len);
+
+/* CRC check of a report frame (little-endian CRC) */
+int topper_report_valid(const uint8_t frame[REPORT_LEN]);
+
+#endif /* TOPPER_LINK_H */
@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "topper_shm.h"
+
+const topper_shm_t *topper_shm_open(const char *path)
+{
+    struct stat   st;
+    topper_shm_t *shm;
+    int           fd = open(path ? path : TOPPER_SHM_PATH, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(topper_shm_t)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED)
+        return NULL;
+
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != TOPPER_SHM_MAGIC ||
+        shm->version != TOPPER_SHM_VERSION || shm->slots != TOPPER_SHM_SLOTS ||
+        shm->slot_size != sizeof(topper_shm_slot_t)) {
+        munmap(shm, sizeof(*shm));
+        errno = EPROTO;
+        return NULL;
+    }
+    return shm;
+}
+
+void topper_shm_close(const topper_shm_t *shm)
+{
+    if (shm)
+        munmap((void *)shm, sizeof(*shm));
+}
+
+topper_shm_t *topper_shm_create(const char *path)
+{
+    topper_shm_t *shm;
+    int           fd;
+
+    /* a new file, so readers still mapping an old ring keep a consistent one */
+    unlink(path);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, sizeof(*shm)) < 0) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        unlink(path);
+        return NULL;
+    }
+
+    shm->version    = TOPPER_SHM_VERSION;
+    shm->slots      = TOPPER_SHM_SLOTS;
+    shm->slot_size  = sizeof(topper_shm_slot_t);
+    shm->writer_pid = (uint32_t)getpid();
+    __atomic_store_n(&shm->magic, TOPPER_SHM_MAGIC, __ATOMIC_RELEASE);
+    return shm;
+}
+
+void topper_shm_publish(topper_shm_t *shm, const topper_sample_t *sample)
+{
+    topper_shm_slot_t *slot = &shm->ring[sample->seq & (TOPPER_SHM_SLOTS - 1)];
+    uint32_t           lock = slot->lock;
+
+    __atomic_store_n(&slot->lock, lock + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->sample = *sample;
+    __atomic_store_n(&slot->lock, lock + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->head, sample->seq, __ATOMIC_RELEASE);
+}
+
+void topper_shm_destroy(topper_shm_t *shm, const char *path)
+{
+    if (!shm)
+        return;
+    munmap(shm, sizeof(*shm));
+    unlink(path);
+}
@@ -0,0 +1,99 @@
+/*
+ * Shared-memory input ring published by topperd --shm
+ *
+ * topperd writes every validated report frame into a ring of samples in a
+ * file under /run. Readers map the file read-only and take samples without
+ * syscalls or locks: each slot is a seqlock, so a reader retries when it
+ * catches the writer mid-update, and the writer never waits for readers.
+ *
+ *   const topper_shm_t *shm = topper_shm_open(NULL);
+ *   topper_sample_t     s;
+ *   if (topper_shm_latest(shm, &s) == 0)
+ *       ... s.buttons, s.axes[], s.timestamp_ns ...
+ *
+ * Samples are numbered from 1; topper_shm_get() fetches an older one while it
+ * is still in the ring (the last TOPPER_SHM_SLOTS samples).
+ */
+
+#ifndef TOPPER_SHM_H
+#define TOPPER_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define TOPPER_SHM_PATH             "/run/topper-input"
+#define TOPPER_SHM_MAGIC            0x48535054u     /* "TPSH" */
+#define TOPPER_SHM_VERSION          1
+#define TOPPER_SHM_SLOTS            256             /* power of two */
+
+typedef struct {
+    uint64_t seq;               /* sample number, 1-based */
+    uint64_t timestamp_ns;      /* CLOCK_MONOTONIC when the frame read completed */
+    uint16_t buttons;           /* REPORT_BUTTONS, bit0-7 = PORTB, bit8-15 = PORTD */
+    uint8_t  axes[4];           /* joyLX, joyLY, joyRX, joyRY */
+    uint8_t  status;            /* REPORT_STATUS */
+    uint8_t  reserved;
+} topper_sample_t;
+
+typedef struct {
+    uint32_t        lock;       /* odd while the writer updates the slot */
+    uint32_t        reserved;
+    topper_sample_t sample;
+} topper_shm_slot_t;
+
+typedef struct {
+    uint32_t          magic;
+    uint32_t          version;
+    uint32_t          slots;
+    uint32_t          slot_size;
+    uint64_t          head;     /* seq of the newest complete sample, 0 before the first */
+    uint32_t          writer_pid;
+    uint8_t           reserved[36];
+    topper_shm_slot_t ring[TOPPER_SHM_SLOTS];
+} topper_shm_t;
+
+/* Maps path (NULL for TOPPER_SHM_PATH) read-only. Returns NULL and sets errno on failure. */
+const topper_shm_t *topper_shm_open(const char *path);
+void                topper_shm_close(const topper_shm_t *shm);
+
+/* Writer side, used by topperd */
+topper_shm_t *topper_shm_create(const char *path);
+void          topper_shm_publish(topper_shm_t *shm, const topper_sample_t *sample);
+void          topper_shm_destroy(topper_shm_t *shm, const char *path);
+
+/*
+ * Copies sample seq. Returns 0, or -1 if it has not been published yet or
+ * was already overwritten.
+ */
+static inline int topper_shm_get(const topper_shm_t *shm, uint64_t seq, topper_sample_t *out)
+{
+    const topper_shm_slot_t *slot = &shm->ring[seq & (TOPPER_SHM_SLOTS - 1)];
+    uint32_t                 before, after;
+
+    if (seq == 0 || seq > __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE))
+        return -1;
+    do {
+        before = __atomic_load_n(&slot->lock, __ATOMIC_ACQUIRE);
+        memcpy(out, (const void *)&slot->sample, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&slot->lock, __ATOMIC_RELAXED);
+    } while ((before & 1) || before != after);
+
+    return out->seq == seq ? 0 : -1;
+}
+
+/* Copies the newest sample. Returns -1 before the first one is published. */
+static inline int topper_shm_latest(const topper_shm_t *shm, topper_sample_t *out)
+{
+    uint64_t head;
+
+    /* the writer may lap the slot between reading head and copying it */
+    do {
+        head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+        if (!head)
+            return -1;
+    } while (topper_shm_get(shm, head, out) < 0);
+    return 0;
+}
+
+#endif /* TOPPER_SHM_H */
@@ -0,0 +1,118 @@
+#!/bin/sh
+#
+# Runs update_firmware against the simulated bootloader (sim:bootloader) and
+# reports wall time and I2C bytes per scenario. Exits non-zero if any scenario
+# does not end the way it should, so it doubles as an end-to-end check.
+#
+# Usage: bench.sh <update_firmware binary>
+
+UF=${1:-host/update_firmware}
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Writes a deterministic HEX image of SIZE code bytes (rest 0xFF) with the
+# Fletcher/XOR trailer the bootloader verifies at 0x1BFD. SEED only changes
+# pages 30-39, so two seeds differ by ten pages. A third argument embeds a
+# build metadata block at 0x1BED with that version string.
+gen_hex() {
+    awk -v size="$1" -v seed="$2" -v version="$3" '
+    function xor8(p, q,    r, bit) {
+        r = 0
+        for (bit = 1; bit < 256; bit *= 2)
+            if ((int(p / bit) + int(q / bit)) % 2) r += bit
+        return r
+    }
+    BEGIN {
+        for (a = 0; a < 7168; a++) {
+            page = int(a / 64)
+            b[a] = a < size ? (a * 37 + page + (page >= 30 && page < 40 ? seed * 11 : 0)) % 256 : 255
+        }
+        if (version != "") {
+            m = 7149                            # META_ADDR
+            b[m] = 84; b[m + 1] = 80; b[m + 2] = 1  # "TP", layout 1
+            for (i = 0; i < 7; i++) {
+                c = substr(version, i + 1, 1)
+                b[m + 3 + i] = c == "" ? 0 : index(" !\"#$%&\047()*+,-./0123456789:;<=>?@ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`abcdefghijklmnopqrstuvwxyz{|}~", c) + 31
+            }
+            b[m + 10] = seed; b[m + 11] = 0; b[m + 12] = 0; b[m + 13] = 0
+            b[m + 14] = size % 256; b[m + 15] = int(size / 256)
+        }
+        s1 = 0; s2 = 0; x = 0
+        for (a = 0; a < 7165; a++) {
+            s1 = (s1 + b[a]) % 256; s2 = (s2 + s1) % 256
+            x = xor8(x, b[a])
+        }
+        b[7165] = s1; b[7166] = s2; b[7167] = x
+        for (a = 0; a < 7168; a += 16) {
+            blank = 1
+            for (i = 0; i < 16; i++) if (b[a + i] != 255) blank = 0
+            if (blank) continue
+            line = sprintf(":10%04X00", a); sum = 16 + int(a / 256) + a % 256
+            for (i = 0; i < 16; i++) { line = line sprintf("%02X", b[a + i]); sum += b[a + i] }
+            print line sprintf("%02X", (256 - sum % 256) % 256)
+        }
+        print ":00000001FF"
+    }'
+}
+
+gen_hex 6000 1 > "$WORK/a.hex"
+gen_hex 6000 2 > "$WORK/b.hex"
+gen_hex 6000 1 bench > "$WORK/m.hex"
+
+fails=0
+printf '%-28s %-8s %-8s %9s %10s\n' "Scenario" "Expect" "Result" "Time" "Bytes"
+
+# run NAME EXPECT(ok|fail) ARGS...
+run() {
+    name=$1; expect=$2; shift 2
+    start=$(date +%s.%N)
+    "$UF" "$@" > "$WORK/log" 2>&1
+    status=$?
+    end=$(date +%s.%N)
+    result=ok; [ $status -eq 0 ] || result=fail
+    bytes=$(sed -n 's/^Bus traffic: .*NACKed, \([0-9]*\) byte.*/\1/p' "$WORK/log" | tail -n 1)
+    mark=""
+    if [ "$result" != "$expect" ]; then
+        mark=" <-- unexpected"
+        fails=$((fails + 1))
+        sed 's/^/    /' "$WORK/log"
+    fi
+    printf '%-28s %-8s %-8s %8.2fs %10s%s\n' "$name" "$expect" "$result" \
+        "$(awk -v a="$start" -v b="$end" 'BEGIN { print b - a }')" "${bytes:--}" "$mark"
+}
+
+S="$WORK/board.state"
+run "full flash (v5)"           ok   --bus "sim:bootloader:state=$S" "$WORK/a.hex"
+run "already current"           ok   --bus "sim:bootloader:state=$S" "$WORK/a.hex"
+run "verify only"               ok   --bus "sim:bootloader:state=$S" --verify-only "$WORK/a.hex"
+run "changed image"             ok   --bus "sim:bootloader:state=$S" "$WORK/b.hex"
+run "forced, CRC skip"          ok   --bus "sim:bootloader:state=$S" --force "$WORK/b.hex"
+run "forced --full"             ok   --bus "sim:bootloader:state=$S" --force --full "$WORK/b.hex"
+run "noisy bus, app running"    ok   --bus "sim:bootloader:state=$S:app:nack=5:seed=3" --force --full "$WORK/b.hex"
+run "legacy v1 bootloader"      ok   --bus "sim:bootloader:version=1" "$WORK/a.hex"
+run "v2 (status, no CRCs)"      ok   --bus "sim:bootloader:version=2" "$WORK/a.hex"
+run "corrupted pages"           ok   --bus "sim:bootloader:corrupt=10:seed=3" "$WORK/a.hex"
+run "corrupted info"            ok   --bus "sim:bootloader:info-corrupt=3" "$WORK/a.hex"
+run "4 boards in parallel"      ok   --bus "sim:bootloader,sim:bootloader,sim:bootloader,sim:bootloader" "$WORK/a.hex"
+run "checksum failure"          fail --bus "sim:bootloader:verify-fail" "$WORK/a.hex"
+run "dropped page (v4)"         fail --bus "sim:bootloader:version=4:drop=20" "$WORK/a.hex"
+
+# Images with build metadata: a running app that reports the same build is
+# left alone without entering the bootloader.
+M="$WORK/meta.state"
+run "metadata, full flash"      ok   --bus "sim:bootloader:state=$M" "$WORK/m.hex"
+run "metadata, app current"     ok   --bus "sim:bootloader:state=$M" "$WORK/m.hex"
+
+# Same build resident behind the bootloader, but page 5 no longer matches and
+# the app failed its checksum: the page CRC diff must still repair it.
+poke() { printf "$2" | dd of="$M" bs=1 seek="$1" conv=notrunc 2>/dev/null; }
+poke $((4 + 5 * 64 + 1)) '\000'            # flash byte 0x141
+poke $((4 + 8192 + 512)) '\000'            # state: in the bootloader
+run "metadata, corrupt app"     ok   --bus "sim:bootloader:state=$M" "$WORK/m.hex"
+run "metadata, repaired"        ok   --bus "sim:bootloader:state=$M" --verify-only "$WORK/m.hex"
+
+if [ $fails -ne 0 ]; then
+    echo "$fails scenario(s) did not behave as expected."
+    exit 1
+fi
+echo "All scenarios behaved as expected."
@@ -3,20 +3,30 @@
 #include <string.h>
 #include <stdint.h>
 #include <unistd.h>
-#include <fcntl.h>
 #include <errno.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
-#include <linux/i2c.h>
+#include <pthread.h>
+#include <time.h>
+#include <strings.h>
+#include <elf.h>
 
-#define BL_ADDR                 0x29
-#define APP_ADDR                0x30
+#include "topper_protocol.h"
+#include "i2c_bus.h"
+#include "topper_link.h"
 
-#define CMD_READ_INFO           0x01
-#define CMD_WRITE_PAGE          0x03  /* page number byte precedes the 64 data bytes */
-#define CMD_FINALIZE            0x05
+#define BL_ADDR                 I2C_BL_ADDR
+#define APP_ADDR                I2C_APP_ADDR
 
-#define EXPECTED_BL_VERSION     0x01
+/* First bootloader version with CMD_READ_STATUS and double-buffered page writes */
+#define BL_VERSION_STATUS       0x02
+
+/* First bootloader version with CMD_READ_PAGE_CRC */
+#define BL_VERSION_PAGE_CRC     0x03
+
+/* First bootloader version with CMD_READ_PAGE, CMD_READ_EEPROM and CMD_WRITE_EEPROM */
+#define BL_VERSION_READBACK     0x04
+
+/* First bootloader version with CMD_WRITE_PAGE_CRC */
+#define BL_VERSION_WRITE_CRC    0x05
 
 /* ATmega8 factory signature bytes (datasheet section 24.8) */
 #define EXPECTED_SIG_0          0x1E
@@ -27,14 +37,37 @@
 #define FLASH_SIZE              8192
 #define BOOTLOADER_START        0x1C00
 #define NUM_PAGES               (FLASH_SIZE / SPM_PAGESIZE)
+#define EEPROM_SIZE             512
+
+/* Fletcher+XOR trailer over the app region, checked by the bootloader's finalize */
+#define TRAILER_ADDR            (BOOTLOADER_START - 3)
 
-/* ATmega8 max flash write time is 4.5ms. Sleep 10x that for safety. */
+/* avr-ld maps SRAM at 0x800000 and EEPROM at 0x810000; flash starts at 0 */
+#define ELF_AVR_DATA_BASE       0x800000
+
+/*
+ * Version 1 bootloaders have no status command.
+ * ATmega8 max flash write time is 4.5ms. Sleep 10x that for safety.
+ */
 #define FLASH_WRITE_SLEEP_US    45000
 
-/* Verification status codes, must match bootloader */
-#define VERIFY_PENDING          0x00
-#define VERIFY_FAILED           0x55
-#define VERIFY_PASSED           0xAA
+/* Interval between CMD_READ_STATUS polls, and how long to wait for a buffer */
+#define STATUS_POLL_US          500
+#define STATUS_TIMEOUT_US       100000
+
+/* A queued CMD_WRITE_EEPROM takes up to 8.5ms per byte */
+#define EEPROM_TIMEOUT_US       (BL_EEPROM_WRITE_MAX * 10000)
+
+/* Intel HEX data bytes per record written by --backup */
+#define HEX_RECORD_LEN          16
+
+/*
+ * compute_flash_checksum takes ~7ms after CMD_FINALIZE. Version 1 bootloaders
+ * get 10x that; with status polling the pages are known to be programmed
+ * already, so 3x is enough.
+ */
+#define FINALIZE_SLEEP_US       100000
+#define FINALIZE_STATUS_SLEEP_US 20000
 
 /* How many times to retry a corrupt CMD_READ_INFO response */
 #define INFO_READ_RETRIES       10
@@ -42,6 +75,9 @@
 /* How many times to retry a single page write before giving up on the sequence */
 #define PAGE_WRITE_RETRIES      3
 
+/* How many times to resend a page the bootloader rejected for a CRC mismatch */
+#define PAGE_CRC_RETRIES        10
+
 /*
  * After CMD_FINALIZE the bootloader jumps to the app if verification passes,
  * so 0x29 disappears. Wait this long for the application to start before
@@ -49,6 +85,21 @@
  */
 #define APP_STARTUP_WAIT_US     500000
 
+/*
+ * After I2C_CMD_BOOTLOADER the app finishes an EEPROM write (~8.5ms) and
+ * waits for a 15ms watchdog reset. Poll 0x29 this often, for this long.
+ */
+#define BL_ENTRY_POLL_US        10000
+#define BL_ENTRY_TIMEOUT_US     1000000
+
+/* The app handles a command in its 1ms main loop; wait this long before reading the reply */
+#define APP_CMD_DELAY_US        5000
+
+/* Most adapters --bus accepts; one thread runs per adapter */
+#define MAX_DEVICES             16
+
+#define DEFAULT_BUS             "/dev/i2c-1"
+
 typedef struct {
     uint8_t  data[FLASH_SIZE];
     uint8_t  page_has_data[NUM_PAGES];
@@ -62,51 +113,112 @@ typedef struct {
     uint8_t verify_status;
 } bl_info_t;
 
-static int i2c_fd = -1;
+typedef enum {
+    MODE_FLASH,
+    MODE_VERIFY,
+    MODE_BACKUP,
+    MODE_EEPROM_READ,
+    MODE_EEPROM_WRITE,
+} run_mode_t;
+
+/* What to do on each device; shared read-only between device threads */
+typedef struct {
+    run_mode_t           mode;
+    const flash_image_t *image;     /* MODE_FLASH and MODE_VERIFY */
+    int                  full;
+    int                  force;     /* flash even if the board runs the same build */
+    const char          *file;      /* --backup / --eeprom file */
+    int                  daemon;    /* no --bus: reach a running app through topperd */
+} job_t;
+
+/*
+ * One board on one I2C adapter. All bus I/O and output for the board goes
+ * through it, so boards on separate adapters can run in their own threads.
+ */
+typedef struct {
+    char        path[128];      /* /dev/i2c-N or a sim: spec */
+    i2c_bus_t  *bus;
+    topper_link_t *app;         /* topperd, when it serves this bus; NULL for direct access */
+    int         has_status;     /* bootloader supports CMD_READ_STATUS */
+    int         has_write_crc;  /* bootloader supports CMD_WRITE_PAGE_CRC */
+    FILE       *out;            /* progress and results */
+    FILE       *err;            /* warnings and errors */
+    int         progress;       /* print \r progress counters */
+    const job_t *job;
+
+    /* summary */
+    int         ret;
+    uint8_t     bl_version;
+    int         pages_written;
+    double      seconds;
+    i2c_bus_stats_t traffic;
+} device_t;
 
 /* --- I2C layer --- */
 
-static int i2c_open(const char *device)
+static int i2c_open(device_t *dev)
 {
-    i2c_fd = open(device, O_RDWR);
-    if (i2c_fd < 0) {
-        fprintf(stderr, "Failed to open I2C device %s: %s\n", device, strerror(errno));
-        return -1;
-    }
-    return 0;
+    dev->bus = i2c_bus_open(dev->path);
+    return dev->bus ? 0 : -1;
 }
 
-static int i2c_write(uint8_t addr, const uint8_t *buf, size_t len)
+static int i2c_write(device_t *dev, uint8_t addr, const uint8_t *buf, size_t len)
 {
-    if (ioctl(i2c_fd, I2C_SLAVE, addr) < 0)
-        return -1;
-    if (write(i2c_fd, buf, len) != (ssize_t)len)
-        return -1;
-    return 0;
+    return i2c_bus_write(dev->bus, addr, buf, len);
 }
 
-/* Uses I2C_RDWR to guarantee a repeated START between write and read phases. */
-static int i2c_write_then_read(uint8_t addr,
+/* The transport guarantees a repeated START between write and read phases. */
+static int i2c_write_then_read(device_t *dev, uint8_t addr,
                                const uint8_t *wbuf, size_t wlen,
                                uint8_t *rbuf,        size_t rlen)
 {
-    struct i2c_msg msgs[2] = {
-        { .addr = addr, .flags = 0,        .len = (__u16)wlen, .buf = (uint8_t *)wbuf },
-        { .addr = addr, .flags = I2C_M_RD, .len = (__u16)rlen, .buf = rbuf            },
-    };
-    struct i2c_rdwr_ioctl_data data = { .msgs = msgs, .nmsgs = 2 };
+    return i2c_bus_xfer(dev->bus, addr, wbuf, wlen, rbuf, rlen);
+}
 
-    if (ioctl(i2c_fd, I2C_RDWR, &data) < 0)
-        return -1;
-    return 0;
+static int i2c_read(device_t *dev, uint8_t addr, uint8_t *buf, size_t len)
+{
+    return i2c_bus_read(dev->bus, addr, buf, len);
 }
 
-static int i2c_probe(uint8_t addr)
+static int i2c_probe(device_t *dev, uint8_t addr)
 {
     uint8_t dummy;
-    if (ioctl(i2c_fd, I2C_SLAVE, addr) < 0)
-        return -1;
-    return read(i2c_fd, &dummy, 1) == 1 ? 0 : -1;
+    return i2c_bus_read(dev->bus, addr, &dummy, 1);
+}
+
+/* Probes the bootloader, allowing for the odd NACK from a noisy bus. */
+static int bl_probe_retry(device_t *dev)
+{
+    int attempt;
+
+    for (attempt = 0; attempt < INFO_READ_RETRIES; attempt++) {
+        if (attempt > 0)
+            usleep(STATUS_POLL_US);
+        if (i2c_probe(dev, BL_ADDR) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+/*
+ * The running app is reached through topperd when the daemon serves the bus,
+ * so a mode command is never split from its read by the daemon's own polling.
+ * The bootloader at 0x29 is always addressed directly.
+ */
+static int app_probe(device_t *dev)
+{
+    uint8_t frame[REPORT_LEN];
+
+    if (dev->app)   /* a CRC error still means the app answered */
+        return topper_link_report(dev->app, frame, 0) == TOPPER_ERR_IO ? -1 : 0;
+    return i2c_probe(dev, APP_ADDR);
+}
+
+static int app_write(device_t *dev, const uint8_t *buf, size_t len)
+{
+    if (dev->app)
+        return topper_link_command(dev->app, buf, len) == TOPPER_OK ? 0 : -1;
+    return i2c_write(dev, APP_ADDR, buf, len);
 }
 
 /* --- Checksum --- */
@@ -134,10 +246,10 @@ static void compute_fletcher_xor(const uint8_t *data, uint16_t len,
  * Fletcher+XOR checksum over the first 6 info bytes. Retries on a
  * corrupt read to mitigate RPi I2C read unreliability.
  */
-static int bl_read_info(bl_info_t *info)
+static int bl_read_info(device_t *dev, bl_info_t *info)
 {
     uint8_t cmd = CMD_READ_INFO;
-    uint8_t buf[9];
+    uint8_t buf[BL_INFO_LEN];
     uint8_t f_a, f_b, xor;
     int     attempt;
 
@@ -145,13 +257,13 @@ static int bl_read_info(bl_info_t *info)
         if (attempt > 0)
             usleep(10000);
 
-        if (i2c_write_then_read(BL_ADDR, &cmd, 1, buf, 9) < 0)
+        if (i2c_write_then_read(dev, BL_ADDR, &cmd, 1, buf, BL_INFO_LEN) < 0)
             continue;
 
         /* Validate checksum over bytes 0-5 */
         compute_fletcher_xor(buf, 6, &f_a, &f_b, &xor);
         if (f_a != buf[6] || f_b != buf[7] || xor != buf[8]) {
-            fprintf(stderr, "  CMD_READ_INFO checksum mismatch (attempt %d/%d), retrying...\n",
+            fprintf(dev->err, "  CMD_READ_INFO checksum mismatch (attempt %d/%d), retrying...\n",
                     attempt + 1, INFO_READ_RETRIES);
             continue;
         }
@@ -166,37 +278,184 @@ static int bl_read_info(bl_info_t *info)
         return 0;
     }
 
-    fprintf(stderr, "Failed to read valid info after %d attempts.\n", INFO_READ_RETRIES);
+    fprintf(dev->err, "Failed to read valid info after %d attempts.\n", INFO_READ_RETRIES);
     return -1;
 }
 
 /*
- * Sends CMD_WRITE_PAGE followed by the page number and 64 data bytes,
- * then sleeps 10x the ATmega8 max flash write time (4.5ms) to ensure
- * the write completes before the next transaction.
+ * Reads the 3-byte CMD_READ_STATUS frame. Fails on a bus error or a bad
+ * check byte; the bootloader NACKs its address while verifying the checksum.
  */
-static int bl_write_page(uint8_t page, const uint8_t *data)
+static int bl_read_status(device_t *dev, uint8_t *flags, uint8_t *last_page)
 {
-    uint8_t buf[2 + SPM_PAGESIZE];
-    buf[0] = CMD_WRITE_PAGE;
+    uint8_t cmd = CMD_READ_STATUS;
+    uint8_t buf[BL_STATUS_LEN];
+
+    if (i2c_write_then_read(dev, BL_ADDR, &cmd, 1, buf, BL_STATUS_LEN) < 0)
+        return -1;
+    if ((uint8_t)(buf[0] ^ buf[1] ^ 0xFF) != buf[2])
+        return -1;
+
+    *flags     = buf[0];
+    *last_page = buf[1];
+    return 0;
+}
+
+/* Polls CMD_READ_STATUS until none of the bits in mask are set. */
+static int bl_wait_status(device_t *dev, uint8_t mask, int timeout_us, uint8_t *flags_out, uint8_t *last_page)
+{
+    uint8_t flags, page;
+    int     waited;
+
+    for (waited = 0; waited <= timeout_us; waited += STATUS_POLL_US) {
+        if (bl_read_status(dev, &flags, &page) == 0 && !(flags & mask)) {
+            if (flags_out)
+                *flags_out = flags;
+            if (last_page)
+                *last_page = page;
+            return 0;
+        }
+        usleep(STATUS_POLL_US);
+    }
+    return -1;
+}
+
+/*
+ * Reads the CRC-16 of count pages starting at first. The bootloader NACKs
+ * while it computes them, so the read is a separate transaction that is
+ * retried until it is ACKed. A failed command write or a frame whose CRC
+ * does not match starts the request over.
+ */
+static int bl_read_page_crcs(device_t *dev, uint8_t first, uint8_t count, uint16_t *crcs)
+{
+    uint8_t cmd[3] = { CMD_READ_PAGE_CRC, first, count };
+    uint8_t buf[BL_PAGE_CRC_MAX * 2 + 2];
+    size_t  len = (size_t)count * 2 + 2;
+    int     attempt;
+    int     waited;
+    int     i;
+
+    if (count == 0 || count > BL_PAGE_CRC_MAX)
+        return -1;
+
+    for (attempt = 0; attempt < INFO_READ_RETRIES; attempt++) {
+        if (attempt > 0)
+            usleep(STATUS_POLL_US);
+
+        if (i2c_write(dev, BL_ADDR, cmd, sizeof(cmd)) < 0)
+            continue;
+
+        for (waited = 0; waited <= STATUS_TIMEOUT_US; waited += STATUS_POLL_US) {
+            usleep(STATUS_POLL_US);
+            if (i2c_read(dev, BL_ADDR, buf, len) >= 0)
+                break;
+        }
+        if (waited > STATUS_TIMEOUT_US)
+            continue;
+        if (topper_crc16(buf, (uint8_t)(count * 2)) !=
+            (uint16_t)(buf[len - 2] << 8 | buf[len - 1]))
+            continue;
+
+        for (i = 0; i < count; i++)
+            crcs[i] = (uint16_t)(buf[i * 2] << 8 | buf[i * 2 + 1]);
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * Reads a 64-byte flash page (CMD_READ_PAGE) or EEPROM block
+ * (CMD_READ_EEPROM), retrying while the frame CRC does not match.
+ */
+static int bl_read_block(device_t *dev, uint8_t cmd_id, uint8_t block, uint8_t *data)
+{
+    uint8_t cmd[2] = { cmd_id, block };
+    uint8_t buf[BL_READ_FRAME_LEN];
+    int     attempt;
+
+    for (attempt = 0; attempt < INFO_READ_RETRIES; attempt++) {
+        if (attempt > 0)
+            usleep(STATUS_POLL_US);
+
+        if (i2c_write_then_read(dev, BL_ADDR, cmd, sizeof(cmd), buf, sizeof(buf)) < 0)
+            continue;
+        if (topper_crc16(buf, BL_READ_BLOCK) !=
+            (uint16_t)(buf[BL_READ_BLOCK] << 8 | buf[BL_READ_BLOCK + 1]))
+            continue;
+
+        memcpy(data, buf, BL_READ_BLOCK);
+        return 0;
+    }
+    return -1;
+}
+
+/* Queues up to BL_EEPROM_WRITE_MAX bytes once the previous EEPROM write has finished. */
+static int bl_write_eeprom(device_t *dev, uint16_t addr, const uint8_t *data, uint8_t len)
+{
+    uint8_t buf[3 + BL_EEPROM_WRITE_MAX];
+
+    if (bl_wait_status(dev, BL_STATUS_EEPROM, EEPROM_TIMEOUT_US, NULL, NULL) < 0)
+        return -1;
+
+    buf[0] = CMD_WRITE_EEPROM;
+    buf[1] = (uint8_t)(addr >> 8);
+    buf[2] = (uint8_t)addr;
+    memcpy(buf + 3, data, len);
+    return i2c_write(dev, BL_ADDR, buf, 3 + len);
+}
+
+/*
+ * Sends CMD_WRITE_PAGE followed by the page number and 64 data bytes, or
+ * CMD_WRITE_PAGE_CRC with a trailing CRC-16 when the bootloader has it.
+ *
+ * With status support the page programs while the next one is transferred;
+ * this waits until a page buffer is free again and returns -2 if the
+ * bootloader dropped the page for a CRC mismatch. Otherwise sleeps 10x the
+ * ATmega8 max flash write time (4.5ms) to ensure the write completes before
+ * the next transaction.
+ */
+static int bl_write_page(device_t *dev, uint8_t page, const uint8_t *data)
+{
+    uint8_t  buf[2 + SPM_PAGESIZE + 2];
+    size_t   len = 2 + SPM_PAGESIZE;
+    uint8_t  flags;
+
+    buf[0] = dev->has_write_crc ? CMD_WRITE_PAGE_CRC : CMD_WRITE_PAGE;
     buf[1] = page;
     memcpy(buf + 2, data, SPM_PAGESIZE);
-    if (i2c_write(BL_ADDR, buf, sizeof(buf)) < 0)
+    if (dev->has_write_crc) {
+        uint16_t crc = topper_crc16(buf + 1, 1 + SPM_PAGESIZE);
+        buf[len++] = (uint8_t)(crc >> 8);
+        buf[len++] = (uint8_t)crc;
+    }
+
+    if (i2c_write(dev, BL_ADDR, buf, len) < 0)
         return -1;
-    usleep(FLASH_WRITE_SLEEP_US);
-    return 0;
+
+    if (!dev->has_status) {
+        usleep(FLASH_WRITE_SLEEP_US);
+        return 0;
+    }
+    if (bl_wait_status(dev, BL_STATUS_FULL, STATUS_TIMEOUT_US, &flags, NULL) < 0)
+        return -1;
+    return (flags & BL_STATUS_REJECTED) ? -2 : 0;
 }
 
 /*
  * Sends CMD_FINALIZE, prompting the bootloader to verify the checksum
  * already embedded in the final 3 bytes of the app flash region.
  */
-static int bl_finalize(void)
+static int bl_finalize(device_t *dev)
 {
     uint8_t cmd = CMD_FINALIZE;
-    if (i2c_write(BL_ADDR, &cmd, 1) < 0)
-        return -1;
-    usleep(100000); /* 10x time for compute_flash_checksum to complete */
+    int     attempt;
+
+    for (attempt = 0; i2c_write(dev, BL_ADDR, &cmd, 1) < 0; attempt++) {
+        if (attempt + 1 >= INFO_READ_RETRIES)
+            return -1;
+        usleep(STATUS_POLL_US);
+    }
+    usleep(dev->has_status ? FINALIZE_STATUS_SLEEP_US : FINALIZE_SLEEP_US);
     return 0;
 }
 
@@ -204,201 +463,634 @@ static int bl_finalize(void)
 
 /* --- Flash image --- */
 
-static int parse_hex_file(const char *path, flash_image_t *image)
+/*
+ * Hex digit values with bit 4 set; 0 marks a non-hex character, so one AND
+ * validates both digits of a byte.
+ */
+static const uint8_t hex_digit[256] = {
+    ['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+    ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+    ['A'] = 0x1A, ['B'] = 0x1B, ['C'] = 0x1C, ['D'] = 0x1D, ['E'] = 0x1E, ['F'] = 0x1F,
+    ['a'] = 0x1A, ['b'] = 0x1B, ['c'] = 0x1C, ['d'] = 0x1D, ['e'] = 0x1E, ['f'] = 0x1F,
+};
+
+/* Copies len bytes to addr and marks their pages. Fails if they pass the end of flash. */
+static int image_store(flash_image_t *image, uint32_t addr, const uint8_t *data, uint32_t len)
+{
+    uint32_t i;
+
+    if (addr > FLASH_SIZE || len > FLASH_SIZE - addr)
+        return -1;
+    memcpy(image->data + addr, data, len);
+    for (i = addr / SPM_PAGESIZE; len && i <= (addr + len - 1) / SPM_PAGESIZE; i++)
+        image->page_has_data[i] = 1;
+    return 0;
+}
+
+static int parse_hex(const char *path, const char *text, size_t size, flash_image_t *image)
+{
+    const char *line = text;
+    const char *end  = text + size;
+    uint32_t    base = 0;
+    int         line_num;
+
+    for (line_num = 1; line < end; line_num++) {
+        const char *eol = memchr(line, '\n', end - line);
+        size_t      len;
+        uint8_t     rec[5 + 255];
+        uint8_t     sum = 0;
+        size_t      i;
+
+        if (!eol)
+            eol = end;
+        len = eol - line;
+        if (len && line[len - 1] == '\r')
+            len--;
+
+        if (len == 0 || line[0] != ':') {
+            line = eol + 1;
+            continue;
+        }
+
+        /* count, address hi/lo, type, data..., checksum */
+        if (len < 11 || (len - 1) % 2 || (len - 1) / 2 > sizeof(rec)) {
+            fprintf(stderr, "%s: malformed HEX record at line %d.\n", path, line_num);
+            return -1;
+        }
+        for (i = 0; i < (len - 1) / 2; i++) {
+            uint8_t hi = hex_digit[(uint8_t)line[1 + i * 2]];
+            uint8_t lo = hex_digit[(uint8_t)line[2 + i * 2]];
+            if (!(hi & lo & 0x10)) {
+                fprintf(stderr, "%s: invalid hex digit at line %d.\n", path, line_num);
+                return -1;
+            }
+            rec[i] = (uint8_t)(hi << 4 | (lo & 0x0F));
+            sum   += rec[i];
+        }
+        if (i != 5u + rec[0]) {
+            fprintf(stderr, "%s: record length mismatch at line %d.\n", path, line_num);
+            return -1;
+        }
+        /* Per-record checksum: sum of all header, data, and checksum bytes must be 0x00 mod 256. */
+        if (sum != 0) {
+            fprintf(stderr, "%s: checksum error at line %d.\n", path, line_num);
+            return -1;
+        }
+
+        switch (rec[3]) {
+            case 0x00: {
+                uint32_t addr = base + (uint32_t)(rec[1] << 8 | rec[2]);
+                if (image_store(image, addr, rec + 4, rec[0]) < 0) {
+                    fprintf(stderr, "%s: data at 0x%04X (line %d) exceeds flash size.\n",
+                            path, addr, line_num);
+                    return -1;
+                }
+                break;
+            }
+            case 0x01:
+                return 0;
+            case 0x02:      /* extended segment address */
+                if (rec[0] == 2)
+                    base = (uint32_t)(rec[4] << 8 | rec[5]) << 4;
+                break;
+            case 0x04:      /* extended linear address */
+                if (rec[0] == 2)
+                    base = (uint32_t)(rec[4] << 8 | rec[5]) << 16;
+                break;
+            default:
+                break;
+        }
+        line = eol + 1;
+    }
+    return 0;
+}
+
+static int parse_bin(const char *path, const uint8_t *data, size_t size, flash_image_t *image)
+{
+    if (image_store(image, 0, data, (uint32_t)(size < FLASH_SIZE ? size : FLASH_SIZE)) < 0 ||
+        size > FLASH_SIZE) {
+        fprintf(stderr, "%s is larger than the %d-byte flash.\n", path, FLASH_SIZE);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Loads the flash contents of an AVR ELF: every PT_LOAD segment at its load
+ * address, i.e. .text followed by the .data initialisers the startup code
+ * copies to RAM. Segments in the data and EEPROM address spaces are skipped.
+ */
+static int parse_elf(const char *path, const uint8_t *data, size_t size, flash_image_t *image)
+{
+    const Elf32_Ehdr *eh = (const Elf32_Ehdr *)data;
+    uint32_t          top = 0;
+    int               i;
+
+    if (size < sizeof(*eh) || eh->e_ident[EI_CLASS] != ELFCLASS32 ||
+        eh->e_ident[EI_DATA] != ELFDATA2LSB || eh->e_machine != EM_AVR) {
+        fprintf(stderr, "%s is not a 32-bit little-endian AVR ELF file.\n", path);
+        return -1;
+    }
+    if (eh->e_phentsize != sizeof(Elf32_Phdr) ||
+        eh->e_phoff + (size_t)eh->e_phnum * sizeof(Elf32_Phdr) > size) {
+        fprintf(stderr, "%s has a truncated program header table.\n", path);
+        return -1;
+    }
+
+    for (i = 0; i < eh->e_phnum; i++) {
+        const Elf32_Phdr *ph = (const Elf32_Phdr *)(data + eh->e_phoff) + i;
+
+        if (ph->p_type != PT_LOAD || ph->p_filesz == 0 || ph->p_paddr >= ELF_AVR_DATA_BASE)
+            continue;
+        if (ph->p_offset + (size_t)ph->p_filesz > size) {
+            fprintf(stderr, "%s: segment %d lies outside the file.\n", path, i);
+            return -1;
+        }
+        if (ph->p_paddr + ph->p_filesz > TRAILER_ADDR) {
+            fprintf(stderr, "%s: code at 0x%04X-0x%04X overlaps the checksum at 0x%04X.\n",
+                    path, ph->p_paddr, ph->p_paddr + ph->p_filesz - 1, TRAILER_ADDR);
+            return -1;
+        }
+        image_store(image, ph->p_paddr, data + ph->p_offset, ph->p_filesz);
+        if (ph->p_paddr + ph->p_filesz > top)
+            top = ph->p_paddr + ph->p_filesz;
+    }
+
+    if (!top) {
+        fprintf(stderr, "%s has no flash contents.\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Makes sure the image carries the Fletcher+XOR trailer the bootloader
+ * verifies. A blank trailer (ELF, BIN, or HEX straight from objcopy) is
+ * computed and added; one that does not match the app bytes is an error.
+ */
+static int image_check_trailer(const char *path, flash_image_t *image)
 {
-    FILE *f;
-    char  line[256];
-    int   line_num = 0;
-    int   ret      = -1;
+    uint8_t *t = image->data + TRAILER_ADDR;
+    uint8_t  f_a, f_b, xor;
+
+    compute_fletcher_xor(image->data, TRAILER_ADDR, &f_a, &f_b, &xor);
+    if (t[0] == f_a && t[1] == f_b && t[2] == xor)
+        return 0;
+
+    if (t[0] != 0xFF || t[1] != 0xFF || t[2] != 0xFF) {
+        fprintf(stderr, "%s: checksum at 0x%04X is %02X %02X %02X, app data gives %02X %02X %02X.\n",
+                path, TRAILER_ADDR, t[0], t[1], t[2], f_a, f_b, xor);
+        return -1;
+    }
+
+    t[0] = f_a;
+    t[1] = f_b;
+    t[2] = xor;
+    image->page_has_data[TRAILER_ADDR / SPM_PAGESIZE] = 1;
+    printf("  Added checksum %02X %02X %02X at 0x%04X.\n", f_a, f_b, xor, TRAILER_ADDR);
+    return 0;
+}
 
-    f = fopen(path, "r");
+/* Loads an Intel HEX, raw binary (.bin) or AVR ELF image. ELF is detected by its magic. */
+static int load_image(const char *path, flash_image_t *image)
+{
+    FILE    *f;
+    uint8_t *buf;
+    long     size;
+    size_t   len = strlen(path);
+    int      ret;
+    int      i;
+
+    f = fopen(path, "rb");
     if (!f) {
-        fprintf(stderr, "Failed to open HEX file %s: %s\n", path, strerror(errno));
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fseek(f, 0, SEEK_END) < 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) < 0) {
+        fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+        fclose(f);
+        return -1;
+    }
+    buf = malloc(size ? (size_t)size : 1);
+    if (!buf || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "Failed to read %s.\n", path);
+        free(buf);
+        fclose(f);
         return -1;
     }
+    fclose(f);
 
     memset(image->data,          0xFF, sizeof(image->data));
     memset(image->page_has_data, 0,    sizeof(image->page_has_data));
     image->num_pages = 0;
 
-    while (fgets(line, sizeof(line), f)) {
-        unsigned int byte_count, addr_val, record_type;
-        unsigned int checksum_accum, record_checksum;
-        unsigned int i;
+    if (size >= SELFMAG && memcmp(buf, ELFMAG, SELFMAG) == 0)
+        ret = parse_elf(path, buf, (size_t)size, image);
+    else if (len > 4 && strcasecmp(path + len - 4, ".bin") == 0)
+        ret = parse_bin(path, buf, (size_t)size, image);
+    else
+        ret = parse_hex(path, (const char *)buf, (size_t)size, image);
+    free(buf);
 
-        line_num++;
+    if (ret == 0)
+        ret = image_check_trailer(path, image);
 
-        if (line[0] != ':')
-            continue;
+    for (i = 0; i < NUM_PAGES; i++)
+        if (image->page_has_data[i])
+            image->num_pages++;
 
-        if (sscanf(line + 1, "%02X%04X%02X", &byte_count, &addr_val, &record_type) != 3) {
-            fprintf(stderr, "Malformed HEX record at line %d.\n", line_num);
-            goto fail;
-        }
+    return ret;
+}
 
-        if (record_type == 0x01)
-            break;
+static int write_hex_file(const char *path, const uint8_t *data, uint16_t len)
+{
+    FILE    *f;
+    uint16_t addr;
 
-        if (record_type != 0x00)
-            continue;
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+        return -1;
+    }
 
-        if (addr_val + byte_count > FLASH_SIZE) {
-            fprintf(stderr, "HEX data at 0x%04X (line %d) exceeds flash size.\n",
-                    addr_val, line_num);
-            goto fail;
+    for (addr = 0; addr < len; addr += HEX_RECORD_LEN) {
+        uint8_t n   = len - addr < HEX_RECORD_LEN ? (uint8_t)(len - addr) : HEX_RECORD_LEN;
+        uint8_t sum = n + (uint8_t)(addr >> 8) + (uint8_t)addr;
+        uint8_t i;
+
+        fprintf(f, ":%02X%04X00", n, addr);
+        for (i = 0; i < n; i++) {
+            fprintf(f, "%02X", data[addr + i]);
+            sum += data[addr + i];
         }
+        fprintf(f, "%02X\n", (uint8_t)-sum);
+    }
+    fprintf(f, ":00000001FF\n");
 
-        /* Per-record checksum: sum of all header, data, and checksum bytes must be 0x00 mod 256. */
-        checksum_accum = byte_count + ((addr_val >> 8) & 0xFF) + (addr_val & 0xFF) + record_type;
+    if (fclose(f) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
 
-        for (i = 0; i < byte_count; i++) {
-            unsigned int byte_val;
-            if (sscanf(line + 9 + i * 2, "%02X", &byte_val) != 1) {
-                fprintf(stderr, "Failed to parse data byte at line %d.\n", line_num);
-                goto fail;
-            }
-            checksum_accum += byte_val;
-            image->data[addr_val + i] = (uint8_t)byte_val;
-            image->page_has_data[(addr_val + i) / SPM_PAGESIZE] = 1;
-        }
+/*
+ * Compares the installed CRC of each of the first fw_pages pages with the
+ * image and marks those that differ. Returns the number of marked pages, or
+ * -1 if the CRCs cannot be read.
+ */
+static int find_mismatches(device_t *dev, const flash_image_t *image, uint8_t fw_pages, uint8_t *mismatch)
+{
+    uint16_t crcs[BL_PAGE_CRC_MAX];
+    int      count = 0;
+    int      first, i;
 
-        if (sscanf(line + 9 + byte_count * 2, "%02X", &record_checksum) != 1) {
-            fprintf(stderr, "Missing checksum byte at line %d.\n", line_num);
-            goto fail;
-        }
-        if (((checksum_accum + record_checksum) & 0xFF) != 0x00) {
-            fprintf(stderr, "Checksum error at line %d.\n", line_num);
-            goto fail;
+    for (first = 0; first < fw_pages; first += BL_PAGE_CRC_MAX) {
+        int n = fw_pages - first;
+        if (n > BL_PAGE_CRC_MAX)
+            n = BL_PAGE_CRC_MAX;
+
+        if (bl_read_page_crcs(dev, (uint8_t)first, (uint8_t)n, crcs) < 0)
+            return -1;
+        for (i = 0; i < n; i++) {
+            mismatch[first + i] = crcs[i] !=
+                topper_crc16(image->data + (first + i) * SPM_PAGESIZE, SPM_PAGESIZE);
+            count += mismatch[first + i];
         }
     }
+    return count;
+}
 
-    for (int i = 0; i < NUM_PAGES; i++)
-        if (image->page_has_data[i])
-            image->num_pages++;
+/*
+ * Marks the pages that need writing. Every page is marked when full is set,
+ * the bootloader predates CMD_READ_PAGE_CRC or the CRCs cannot be read.
+ * Returns the number of marked pages.
+ */
+static int plan_pages(device_t *dev, const flash_image_t *image, const bl_info_t *info, int full,
+                      uint8_t *dirty)
+{
+    int count;
 
-    ret = 0;
+    if (!full && info->version >= BL_VERSION_PAGE_CRC) {
+        count = find_mismatches(dev, image, info->fw_pages, dirty);
+        if (count >= 0)
+            return count;
+        fprintf(dev->err, "Could not read page CRCs; writing all pages.\n");
+    }
 
-    fail:
-    fclose(f);
-    return ret;
+    memset(dirty, 1, info->fw_pages);
+    return info->fw_pages;
 }
 
-static int flash_image(const flash_image_t *image, uint8_t fw_pages)
+/* Reports the pages that do not match the image. Returns the mismatch count or -1. */
+static int verify_pages(device_t *dev, const flash_image_t *image, uint8_t fw_pages)
+{
+    uint8_t mismatch[NUM_PAGES];
+    int     count = find_mismatches(dev, image, fw_pages, mismatch);
+    int     page;
+
+    if (count < 0) {
+        fprintf(dev->err, "Failed to read page CRCs.\n");
+        return -1;
+    }
+    for (page = 0; page < fw_pages; page++)
+        if (mismatch[page])
+            fprintf(dev->err, "  page %d (0x%04X) does not match the image\n",
+                    page, page * SPM_PAGESIZE);
+    return count;
+}
+
+static int flash_image(device_t *dev, const flash_image_t *image, uint8_t fw_pages, const uint8_t *dirty,
+                       int num_dirty)
 {
     int page;
+    int written   = 0;
+    int last_page = -1;
 
-    printf("Flashing %d page(s)...\n", fw_pages);
+    fprintf(dev->out, "Flashing %d of %d page(s)...\n", num_dirty, fw_pages);
 
     for (page = 0; page < fw_pages; page++) {
         int retry;
-        int ok = 0;
+        int ret;
+        int ok          = 0;
+        int crc_retries = 0;
+
+        if (!dirty[page])
+            continue;
 
         for (retry = 0; retry <= PAGE_WRITE_RETRIES; retry++) {
             if (retry > 0) {
                 usleep(FLASH_WRITE_SLEEP_US);
-                if (i2c_probe(BL_ADDR) < 0) {
-                    fprintf(stderr, "\n  page %d: device not responding after write failure.\n",
+                if (bl_probe_retry(dev) < 0) {
+                    fprintf(dev->err, "\n  page %d: device not responding after write failure.\n",
                             page);
                     return -1;
                 }
-                fprintf(stderr, "\n  page %d: device still responding, retrying write "
+                fprintf(dev->err, "\n  page %d: device still responding, retrying write "
                         "(%d/%d)...\n", page, retry, PAGE_WRITE_RETRIES);
             }
 
-            if (bl_write_page((uint8_t)page, image->data + page * SPM_PAGESIZE) == 0) {
+            ret = bl_write_page(dev, (uint8_t)page, image->data + page * SPM_PAGESIZE);
+
+            /* Corrupted in transit: resend straight away, it does not count as a bus failure */
+            while (ret == -2 && crc_retries < PAGE_CRC_RETRIES) {
+                crc_retries++;
+                fprintf(dev->err, "\n  page %d: CRC mismatch at bootloader, resending...\n", page);
+                ret = bl_write_page(dev, (uint8_t)page, image->data + page * SPM_PAGESIZE);
+            }
+
+            if (ret == 0) {
                 ok = 1;
                 break;
             }
+            if (ret == -2)
+                break;
         }
 
+        if (!ok && ret == -2) {
+            fprintf(dev->err, "\n  page %d: rejected for CRC mismatch %d times.\n",
+                    page, crc_retries + 1);
+            return -1;
+        }
         if (!ok) {
-            fprintf(stderr, "\n  page %d: bl_write_page failed after %d attempts.\n",
+            fprintf(dev->err, "\n  page %d: bl_write_page failed after %d attempts.\n",
                     page, PAGE_WRITE_RETRIES + 1);
             return -1;
         }
 
-        printf("\r  [%d/%d] written", page + 1, fw_pages);
-        fflush(stdout);
+        last_page = page;
+        dev->pages_written = ++written;
+        if (dev->progress) {
+            fprintf(dev->out, "\r  [%d/%d] written", written, num_dirty);
+            fflush(dev->out);
+        }
     }
 
-    printf("\nFlashing complete.\n");
+    /* Up to two pages may still be queued in the bootloader */
+    if (dev->has_status) {
+        uint8_t bl_last;
+
+        if (bl_wait_status(dev, BL_STATUS_BUSY, STATUS_TIMEOUT_US, NULL, &bl_last) < 0) {
+            fprintf(dev->err, "\n  Bootloader did not finish programming.\n");
+            return -1;
+        }
+        if (last_page >= 0 && bl_last != last_page) {
+            fprintf(dev->err, "\n  Bootloader reports page %d as last programmed, expected %d.\n",
+                    bl_last, last_page);
+            return -1;
+        }
+    }
+
+    fprintf(dev->out, "\nFlashing complete.\n");
     return 0;
 }
 
+/* --- Build metadata --- */
+
+static int meta_valid(const uint8_t *meta)
+{
+    return meta[0] == META_MAGIC0 && meta[1] == META_MAGIC1 && meta[2] == META_LAYOUT;
+}
+
+static void print_meta(device_t *dev, const char *label, const uint8_t *meta)
+{
+    fprintf(dev->out, "%-19s %.*s, build %02X%02X%02X%02X, %u bytes\n", label,
+            META_VERSION_LEN, (const char *)meta + META_VERSION,
+            meta[META_HASH + 3], meta[META_HASH + 2], meta[META_HASH + 1], meta[META_HASH],
+            meta[META_CODE_SIZE] | meta[META_CODE_SIZE + 1] << 8);
+}
+
+/* Reads the metadata block from a running app through I2C_CMD_VERSION. */
+static int app_read_meta(device_t *dev, uint8_t *meta)
+{
+    uint8_t cmd = I2C_CMD_VERSION;
+    uint8_t frame[VERSIONFRAME_LEN];
+
+    if (dev->app) {
+        if (topper_link_query(dev->app, cmd, frame, sizeof(frame)) != TOPPER_OK)
+            return -1;
+    } else {
+        if (i2c_write(dev, APP_ADDR, &cmd, 1) < 0)
+            return -1;
+        usleep(APP_CMD_DELAY_US);
+        if (i2c_read(dev, APP_ADDR, frame, sizeof(frame)) < 0)
+            return -1;
+    }
+    if (topper_crc16(frame + VERSIONFRAME_META, META_LEN) !=
+        (uint16_t)(frame[VERSIONFRAME_META_CRC] << 8 | frame[VERSIONFRAME_META_CRC + 1]))
+        return -1;
+
+    memcpy(meta, frame + VERSIONFRAME_META, META_LEN);
+    return 0;
+}
+
+/* Reads the metadata block from flash through the bootloader (version 4+). */
+static int bl_read_meta(device_t *dev, uint8_t *meta)
+{
+    uint8_t page[BL_READ_BLOCK];
+
+    if (bl_read_block(dev, CMD_READ_PAGE, META_ADDR / SPM_PAGESIZE, page) < 0)
+        return -1;
+    memcpy(meta, page + META_ADDR % SPM_PAGESIZE, META_LEN);
+    return 0;
+}
+
+/*
+ * Returns 1 if a running app reports the same build as the image, without
+ * entering the bootloader.
+ */
+static int app_is_current(device_t *dev, const flash_image_t *image)
+{
+    const uint8_t *want = image->data + META_ADDR;
+    uint8_t        have[META_LEN];
+
+    if (!meta_valid(want) || app_probe(dev) < 0 || app_read_meta(dev, have) < 0)
+        return 0;
+
+    print_meta(dev, "Running firmware:", have);
+    return memcmp(have, want, META_LEN) == 0;
+}
+
 /* --- Entry point --- */
 
 static void usage(const char *prog)
 {
-    fprintf(stderr, "Usage: %s <firmware.hex>\n", prog);
+    fprintf(stderr, "Usage: %s [--bus LIST] [--full] [--force] <image>\n"
+                    "       %s [--bus LIST] --verify-only <image>\n"
+                    "       %s [--bus BUS] --backup <out.hex>\n"
+                    "       %s [--bus BUS] --eeprom read|write <file.bin>\n"
+                    "  --bus           comma-separated I2C bus numbers or device paths\n"
+                    "                  (default %s); mux channels are separate buses.\n"
+                    "                  Each bus is flashed in its own thread.\n"
+                    "                  stub:N uses an i2c-stub adapter, sim:bootloader[:opt...]\n"
+                    "                  a simulated board, replay:<capture>[:loop][:paced] a\n"
+                    "                  recorded session (rpi/i2c-capture).\n"
+                    "  --full          write every page, even those whose CRC already matches\n"
+                    "  --force         flash even if the board already runs the image's build\n"
+                    "  --verify-only   compare the installed app with the image, write nothing\n"
+                    "  --backup        save the installed app flash as Intel HEX\n"
+                    "  --eeprom        save or restore the %d-byte EEPROM as raw binary\n"
+                    "  <image> is Intel HEX, raw .bin or AVR ELF; a missing checksum trailer\n"
+                    "  is computed and added.\n",
+            prog, prog, prog, prog, DEFAULT_BUS, EEPROM_SIZE);
 }
 
 /*
- * Runs one full probe -> read_info -> flash -> finalize -> verify sequence.
+ * Asks a running application to reset into the bootloader and waits for
+ * 0x29 to appear. Fails if no app answers or it ignores the command.
+ */
+static int app_enter_bootloader(device_t *dev)
+{
+    uint8_t cmd[1 + I2C_BOOTLOADER_KEY_LEN] = { I2C_CMD_BOOTLOADER };
+    int     attempt;
+    int     waited;
+
+    /* A NACKed probe is retried, and may equally have hidden the bootloader */
+    for (attempt = 0; app_probe(dev) < 0; attempt++) {
+        if (attempt + 1 >= INFO_READ_RETRIES)
+            return -1;
+        usleep(STATUS_POLL_US);
+        if (i2c_probe(dev, BL_ADDR) == 0)
+            return 0;
+    }
+
+    fprintf(dev->out, "Application found at 0x%02X%s, requesting bootloader...\n", APP_ADDR,
+            dev->app ? " (via topperd)" : "");
+    memcpy(cmd + 1, I2C_BOOTLOADER_KEY, I2C_BOOTLOADER_KEY_LEN);
+    for (attempt = 0; app_write(dev, cmd, sizeof(cmd)) < 0; attempt++) {
+        if (attempt + 1 >= INFO_READ_RETRIES)
+            return -1;
+        usleep(STATUS_POLL_US);
+    }
+
+    for (waited = 0; waited < BL_ENTRY_TIMEOUT_US; waited += BL_ENTRY_POLL_US) {
+        usleep(BL_ENTRY_POLL_US);
+        if (i2c_probe(dev, BL_ADDR) == 0)
+            return 0;
+    }
+
+    fprintf(dev->err, "Application did not reset into the bootloader; "
+                    "its firmware may predate I2C_CMD_BOOTLOADER.\n");
+    return -1;
+}
+
+/*
+ * Probes the bootloader, rebooting a running app into it first if needed,
+ * then reads and prints its info block and checks the signature.
  *
  * Returns:
  *   0   success
- *  -1   I/O or verification failure
- *  -2   unrecoverable error (bad signature, image out of range, etc.)
+ *  -1   I/O failure
+ *  -2   bootloader missing or wrong device
  */
-static int run_flash_sequence(flash_image_t *image)
+static int bl_connect(device_t *dev, bl_info_t *info)
 {
-    bl_info_t info;
-    bl_info_t verify_info;
-
-    printf("--- Bootloader ---\n");
-    if (i2c_probe(BL_ADDR) < 0) {
-        fprintf(stderr,
+    fprintf(dev->out, "--- Bootloader ---\n");
+    if (i2c_probe(dev, BL_ADDR) < 0 && app_enter_bootloader(dev) < 0) {
+        fprintf(dev->err,
                 "Bootloader not found at 0x%02X.\n"
                 "To enter bootloader mode: fully shut down the device, then\n"
                 "hold the display button at power-on. Then re-run this tool.\n",
                 BL_ADDR);
         return -2;
     }
-    printf("Bootloader detected at 0x%02X.\n", BL_ADDR);
+    fprintf(dev->out, "Bootloader detected at 0x%02X.\n", BL_ADDR);
 
-    if (bl_read_info(&info) < 0)
+    if (bl_read_info(dev, info) < 0)
         return -1;
+    dev->bl_version = info->version;
 
-    printf("Signature:          0x%02X 0x%02X 0x%02X\n",
-           info.sig[0], info.sig[1], info.sig[2]);
-    printf("Bootloader version: 0x%02X\n", info.version);
-    printf("App flash pages:    %d\n\n", info.fw_pages);
+    fprintf(dev->out, "Signature:          0x%02X 0x%02X 0x%02X\n",
+           info->sig[0], info->sig[1], info->sig[2]);
+    fprintf(dev->out, "Bootloader version: 0x%02X\n", info->version);
+    fprintf(dev->out, "App flash pages:    %d\n\n", info->fw_pages);
 
-    if (info.sig[0] != EXPECTED_SIG_0 ||
-        info.sig[1] != EXPECTED_SIG_1 ||
-        info.sig[2] != EXPECTED_SIG_2) {
-        fprintf(stderr, "Signature mismatch: expected 0x%02X 0x%02X 0x%02X. Aborting.\n",
+    if (info->sig[0] != EXPECTED_SIG_0 ||
+        info->sig[1] != EXPECTED_SIG_1 ||
+        info->sig[2] != EXPECTED_SIG_2) {
+        fprintf(dev->err, "Signature mismatch: expected 0x%02X 0x%02X 0x%02X. Aborting.\n",
                 EXPECTED_SIG_0, EXPECTED_SIG_1, EXPECTED_SIG_2);
         return -2;
     }
 
-    if (info.version != EXPECTED_BL_VERSION)
-        fprintf(stderr, "Warning: unexpected bootloader version 0x%02X (expected 0x%02X). "
-                "Proceeding anyway.\n\n", info.version, EXPECTED_BL_VERSION);
+    if (info->version > BOOTLOADER_VERSION)
+        fprintf(dev->err, "Warning: bootloader version 0x%02X is newer than this tool (0x%02X). "
+                "Proceeding anyway.\n\n", info->version, BOOTLOADER_VERSION);
 
-    for (int i = info.fw_pages; i < NUM_PAGES; i++) {
-        if (image->page_has_data[i]) {
-            fprintf(stderr, "Error: firmware image has data in page %d, "
-                    "but app flash only has %d page(s). Aborting.\n", i, info.fw_pages);
-            return -2;
-        }
-    }
+    dev->has_status    = info->version >= BL_VERSION_STATUS;
+    dev->has_write_crc = info->version >= BL_VERSION_WRITE_CRC;
+    if (!dev->has_status)
+        fprintf(dev->out, "Bootloader has no status command; using fixed write delays.\n\n");
 
-    printf("--- Flash ---\n");
+    return 0;
+}
 
-    if (flash_image(image, info.fw_pages) < 0)
-        return -1;
-    printf("\n");
+static int require_version(device_t *dev, const bl_info_t *info, uint8_t version, const char *what)
+{
+    if (info->version >= version)
+        return 0;
+    fprintf(dev->err, "%s needs bootloader version 0x%02X or later.\n", what, version);
+    return -2;
+}
 
-    printf("--- Finalize ---\n");
-    if (bl_finalize() < 0) {
-        fprintf(stderr, "Failed to send CMD_FINALIZE.\n");
+/*
+ * Sends CMD_FINALIZE and works out whether the bootloader verified the app
+ * and jumped to it. Used after every mode so the device is left running.
+ */
+static int finalize_and_check(device_t *dev)
+{
+    bl_info_t verify_info;
+    int       attempt;
+
+    fprintf(dev->out, "--- Finalize ---\n");
+    if (bl_finalize(dev) < 0) {
+        fprintf(dev->err, "Failed to send CMD_FINALIZE.\n");
         return -1;
     }
 
     /*
      * The bootloader runs compute_flash_checksum (~7ms) after CMD_FINALIZE.
-     * bl_finalize() already slept 100ms, so the result is ready by now.
+     * bl_finalize(dev) already slept at least 3x that, so the result is ready by now.
      *
      * On VERIFY_PASSED the bootloader immediately jumps to the application
      * and stops responding at 0x29. On VERIFY_FAILED it stays at 0x29.
@@ -406,69 +1098,496 @@ static int run_flash_sequence(flash_image_t *image)
      * Probe 0x29 first to determine the outcome without assuming the
      * bootloader is still present.
      */
-    printf("Checking verification result...\n");
+    fprintf(dev->out, "Checking verification result...\n");
 
-    if (i2c_probe(BL_ADDR) == 0) {
+    if (i2c_probe(dev, BL_ADDR) == 0) {
         /*
          * Bootloader still present. This is either a genuine verification
          * failure, or a bootloader variant that passes but stays resident
          * until power-cycled rather than jumping to the app. Read verify_status
          * to tell them apart.
          */
-        if (bl_read_info(&verify_info) == 0) {
+        if (bl_read_info(dev, &verify_info) == 0) {
             if (verify_info.verify_status == VERIFY_PASSED) {
-                printf("Verification passed. Bootloader will remain until power cycle.\n");
+                fprintf(dev->out, "Verification passed. Bootloader will remain until power cycle.\n");
                 return 0;
             }
-            fprintf(stderr, "Verification FAILED (status 0x%02X). Flash may be corrupt.\n",
+            fprintf(dev->err, "Verification FAILED (status 0x%02X). Flash may be corrupt.\n",
                     verify_info.verify_status);
         } else {
-            fprintf(stderr, "Verification FAILED. Bootloader still active.\n");
+            fprintf(dev->err, "Verification FAILED. Bootloader still active.\n");
         }
         return -1;
     }
 
     /*
      * 0x29 is gone: the bootloader jumped to the application.
-     * Wait for the app's I2C slave to initialize, then probe once.
+     * Wait for the app's I2C slave to initialize, then probe it.
      */
-    printf("Bootloader jumped to application. Waiting for app at 0x%02X...\n", APP_ADDR);
+    fprintf(dev->out, "Bootloader jumped to application. Waiting for app at 0x%02X...\n", APP_ADDR);
     usleep(APP_STARTUP_WAIT_US);
-    if (i2c_probe(APP_ADDR) == 0) {
-        printf("Verification passed. Application running at 0x%02X.\n", APP_ADDR);
+    for (attempt = 0; attempt < INFO_READ_RETRIES && i2c_probe(dev, APP_ADDR) < 0; attempt++)
+        usleep(STATUS_POLL_US);
+    if (attempt < INFO_READ_RETRIES) {
+        fprintf(dev->out, "Verification passed. Application running at 0x%02X.\n", APP_ADDR);
         return 0;
     }
 
-    fprintf(stderr,
+    fprintf(dev->err,
             "Bootloader jumped (checksum passed) but application did not respond at "
             "0x%02X. The firmware may still be running.\n",
             APP_ADDR);
     return -1;
 }
 
+/*
+ * Runs one full probe -> read_info -> flash -> finalize -> verify sequence.
+ *
+ * Returns:
+ *   0   success
+ *  -1   I/O or verification failure
+ *  -2   unrecoverable error (bad signature, image out of range, etc.)
+ */
+static int run_flash_sequence(device_t *dev, const flash_image_t *image, int full, int force)
+{
+    bl_info_t info;
+    uint8_t   dirty[NUM_PAGES];
+    uint8_t   meta[META_LEN];
+    int       num_dirty;
+    int       ret;
+
+    if (meta_valid(image->data + META_ADDR))
+        print_meta(dev, "Image:", image->data + META_ADDR);
+
+    if (!force && app_is_current(dev, image)) {
+        fprintf(dev->out, "Board already runs this build; nothing to do (--force to reflash).\n");
+        return 0;
+    }
+
+    if ((ret = bl_connect(dev, &info)) < 0)
+        return ret;
+
+    for (int i = info.fw_pages; i < NUM_PAGES; i++) {
+        if (image->page_has_data[i]) {
+            fprintf(dev->err, "Error: firmware image has data in page %d, "
+                    "but app flash only has %d page(s). Aborting.\n", i, info.fw_pages);
+            return -2;
+        }
+    }
+
+    /*
+     * Bootloader already resident: the installed build may still match, but
+     * the app did not start, so a page may be damaged. The page CRC diff
+     * below finds and rewrites it.
+     */
+    if (!force && info.version >= BL_VERSION_READBACK && meta_valid(image->data + META_ADDR) &&
+        bl_read_meta(dev, meta) == 0) {
+        print_meta(dev, "Installed firmware:", meta);
+        if (memcmp(meta, image->data + META_ADDR, META_LEN) == 0)
+            fprintf(dev->out, "Installed build matches the image; checking its pages.\n");
+    }
+
+    fprintf(dev->out, "--- Flash ---\n");
+
+    num_dirty = plan_pages(dev, image, &info, full, dirty);
+    if (num_dirty == 0)
+        fprintf(dev->out, "All %d page(s) already match the image.\n", info.fw_pages);
+    else if (flash_image(dev, image, info.fw_pages, dirty, num_dirty) < 0)
+        return -1;
+
+    /* Catch a bad page here rather than from the whole-image checksum */
+    if (num_dirty > 0 && info.version >= BL_VERSION_PAGE_CRC) {
+        fprintf(dev->out, "Verifying written pages...\n");
+        if (verify_pages(dev, image, info.fw_pages) != 0)
+            return -1;
+    }
+    fprintf(dev->out, "\n");
+
+    return finalize_and_check(dev);
+}
+
+/* Compares every app page with the image without writing anything. */
+static int run_verify(device_t *dev, const flash_image_t *image)
+{
+    bl_info_t info;
+    int       ret;
+
+    if ((ret = bl_connect(dev, &info)) < 0)
+        return ret;
+    if ((ret = require_version(dev, &info, BL_VERSION_PAGE_CRC, "--verify-only")) < 0)
+        return ret;
+
+    fprintf(dev->out, "--- Verify ---\n");
+    ret = verify_pages(dev, image, info.fw_pages);
+    if (ret < 0)
+        return -1;
+    if (ret > 0) {
+        fprintf(dev->err, "%d of %d page(s) differ from the image.\n\n", ret, info.fw_pages);
+        finalize_and_check(dev);
+        return -1;
+    }
+    fprintf(dev->out, "All %d page(s) match the image.\n\n", info.fw_pages);
+
+    return finalize_and_check(dev);
+}
+
+/* Saves the installed app flash, checksum trailer included, as Intel HEX. */
+static int run_backup(device_t *dev, const char *path)
+{
+    bl_info_t info;
+    uint8_t   data[FLASH_SIZE];
+    int       page;
+    int       ret;
+
+    if ((ret = bl_connect(dev, &info)) < 0)
+        return ret;
+    if ((ret = require_version(dev, &info, BL_VERSION_READBACK, "--backup")) < 0)
+        return ret;
+
+    fprintf(dev->out, "--- Backup ---\n");
+    for (page = 0; page < info.fw_pages; page++) {
+        if (bl_read_block(dev, CMD_READ_PAGE, (uint8_t)page, data + page * SPM_PAGESIZE) < 0) {
+            fprintf(dev->err, "\n  page %d: read failed.\n", page);
+            return -1;
+        }
+        if (dev->progress) {
+            fprintf(dev->out, "\r  [%d/%d] read", page + 1, info.fw_pages);
+            fflush(dev->out);
+        }
+    }
+
+    if (write_hex_file(path, data, (uint16_t)(info.fw_pages * SPM_PAGESIZE)) < 0)
+        return -1;
+    fprintf(dev->out, "\nSaved %d bytes to %s.\n\n", info.fw_pages * SPM_PAGESIZE, path);
+
+    return finalize_and_check(dev);
+}
+
+static int eeprom_read_all(device_t *dev, uint8_t *data)
+{
+    int block;
+
+    for (block = 0; block < EEPROM_SIZE / BL_READ_BLOCK; block++) {
+        if (bl_read_block(dev, CMD_READ_EEPROM, (uint8_t)block, data + block * BL_READ_BLOCK) < 0) {
+            fprintf(dev->err, "EEPROM block %d: read failed.\n", block);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Saves the EEPROM to path, or restores it from path and reads it back. The
+ * bootloader-owned bytes from EEPROM_BL_FIRST up are saved but not restored.
+ */
+static int run_eeprom(device_t *dev, const char *path, int write)
+{
+    bl_info_t info;
+    uint8_t   data[EEPROM_SIZE];
+    uint8_t   check[EEPROM_SIZE];
+    FILE     *f;
+    int       addr;
+    int       ret;
+
+    if ((ret = bl_connect(dev, &info)) < 0)
+        return ret;
+    if ((ret = require_version(dev, &info, BL_VERSION_READBACK, "--eeprom")) < 0)
+        return ret;
+
+    fprintf(dev->out, "--- EEPROM ---\n");
+
+    if (!write) {
+        if (eeprom_read_all(dev, data) < 0)
+            return -1;
+        f = fopen(path, "wb");
+        if (!f || fwrite(data, 1, EEPROM_SIZE, f) != EEPROM_SIZE || fclose(f) != 0) {
+            fprintf(dev->err, "Failed to write %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        fprintf(dev->out, "Saved %d bytes to %s.\n\n", EEPROM_SIZE, path);
+        return finalize_and_check(dev);
+    }
+
+    f = fopen(path, "rb");
+    if (!f) {
+        fprintf(dev->err, "Failed to open %s: %s\n", path, strerror(errno));
+        return -2;
+    }
+    ret = (int)fread(data, 1, EEPROM_SIZE, f);
+    fclose(f);
+    if (ret != EEPROM_SIZE) {
+        fprintf(dev->err, "%s must be exactly %d bytes.\n", path, EEPROM_SIZE);
+        return -2;
+    }
+
+    for (addr = 0; addr < EEPROM_BL_FIRST; addr += BL_EEPROM_WRITE_MAX) {
+        int len = EEPROM_BL_FIRST - addr < BL_EEPROM_WRITE_MAX ? EEPROM_BL_FIRST - addr
+                                                               : BL_EEPROM_WRITE_MAX;
+
+        if (bl_write_eeprom(dev, (uint16_t)addr, data + addr, (uint8_t)len) < 0) {
+            fprintf(dev->err, "\n  EEPROM 0x%03X: write failed.\n", addr);
+            return -1;
+        }
+        if (dev->progress) {
+            fprintf(dev->out, "\r  [%d/%d] queued", addr + len, EEPROM_BL_FIRST);
+            fflush(dev->out);
+        }
+    }
+    if (bl_wait_status(dev, BL_STATUS_EEPROM, EEPROM_TIMEOUT_US, NULL, NULL) < 0) {
+        fprintf(dev->err, "\n  EEPROM write did not finish.\n");
+        return -1;
+    }
+
+    if (eeprom_read_all(dev, check) < 0)
+        return -1;
+    if (memcmp(data, check, EEPROM_BL_FIRST) != 0) {
+        fprintf(dev->err, "\nEEPROM readback does not match %s.\n", path);
+        return -1;
+    }
+    fprintf(dev->out, "\nEEPROM restored from %s and verified.\n\n", path);
+
+    return finalize_and_check(dev);
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Opens the device's bus and runs the job on it. Safe to call from a thread. */
+static void run_device(device_t *dev)
+{
+    const job_t     *job = dev->job;
+    struct timespec  start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (i2c_open(dev) < 0) {
+        dev->ret = -2;
+        return;
+    }
+    if (job->daemon) {
+        /* only the daemon is wanted here; without it the app is on dev->bus */
+        dev->app = topper_link_open(dev->path, 0);
+        if (dev->app && !topper_link_is_daemon(dev->app)) {
+            topper_link_close(dev->app);
+            dev->app = NULL;
+        }
+    }
+
+    switch (job->mode) {
+        case MODE_FLASH:        dev->ret = run_flash_sequence(dev, job->image, job->full, job->force); break;
+        case MODE_VERIFY:       dev->ret = run_verify(dev, job->image);                    break;
+        case MODE_BACKUP:       dev->ret = run_backup(dev, job->file);                     break;
+        case MODE_EEPROM_READ:  dev->ret = run_eeprom(dev, job->file, 0);                  break;
+        case MODE_EEPROM_WRITE: dev->ret = run_eeprom(dev, job->file, 1);                  break;
+        default:                dev->ret = -2;                                             break;
+    }
+
+    dev->traffic = dev->bus->stats;
+    topper_link_close(dev->app);
+    i2c_bus_close(dev->bus);
+    dev->seconds = elapsed_since(&start);
+
+    fprintf(dev->out, "Bus traffic: %lu transaction(s), %lu NACKed, %lu byte(s), "
+            "%.1f ms wire time at %d kHz; %.2f s elapsed.\n",
+            dev->traffic.xfers, dev->traffic.failed, dev->traffic.bytes,
+            i2c_bus_wire_ms(&dev->traffic), I2C_BUS_HZ / 1000, dev->seconds);
+}
+
+static void *device_thread(void *arg)
+{
+    run_device(arg);
+    return NULL;
+}
+
+/*
+ * Accepts "1,3,/dev/i2c-7,stub:5,sim:bootloader,replay:flash.cap": every spec
+ * i2c_bus_open() takes. Returns the number of devices or -1.
+ */
+static int parse_bus_list(char *list, device_t *devs)
+{
+    int   count = 0;
+    char *tok;
+
+    for (tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        char *end;
+        long  bus = strtol(tok, &end, 10);
+
+        if (count == MAX_DEVICES) {
+            fprintf(stderr, "At most %d buses are supported.\n", MAX_DEVICES);
+            return -1;
+        }
+        if (*end == '\0' && end != tok && bus >= 0)
+            snprintf(devs[count].path, sizeof(devs[count].path), "/dev/i2c-%ld", bus);
+        else if ((tok[0] == '/' || strncmp(tok, "sim:", 4) == 0 || strncmp(tok, "stub:", 5) == 0 ||
+                  strncmp(tok, "replay:", 7) == 0) &&
+                 strlen(tok) < sizeof(devs[count].path))
+            strcpy(devs[count].path, tok);
+        else {
+            fprintf(stderr, "Invalid bus '%s'.\n", tok);
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+static const char *result_name(int ret)
+{
+    switch (ret) {
+        case 0:  return "OK";
+        case -1: return "FAILED";
+        default: return "ERROR";
+    }
+}
+
+/*
+ * Runs the job on every device in parallel. Each thread writes its log to a
+ * temporary file that is printed once all threads are done, followed by a
+ * per-board summary.
+ */
+static int run_parallel(device_t *devs, int count)
+{
+    pthread_t threads[MAX_DEVICES];
+    int       started[MAX_DEVICES];
+    char      line[256];
+    int       failed = 0;
+    int       i;
+
+    for (i = 0; i < count; i++) {
+        devs[i].out = tmpfile();
+        if (!devs[i].out) {
+            fprintf(stderr, "Failed to create log file: %s\n", strerror(errno));
+            return -1;
+        }
+        devs[i].err = devs[i].out;
+        started[i] = pthread_create(&threads[i], NULL, device_thread, &devs[i]) == 0;
+        if (!started[i]) {
+            fprintf(devs[i].err, "Failed to start thread.\n");
+            devs[i].ret = -2;
+        }
+    }
+    for (i = 0; i < count; i++)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+
+    for (i = 0; i < count; i++) {
+        printf("===== %s =====\n", devs[i].path);
+        rewind(devs[i].out);
+        while (fgets(line, sizeof(line), devs[i].out))
+            fputs(line, stdout);
+        fclose(devs[i].out);
+        printf("\n");
+    }
+
+    printf("%-16s %-8s %-4s %6s %8s %9s\n", "Bus", "Result", "BL", "Pages", "Bytes", "Time");
+    for (i = 0; i < count; i++) {
+        char version[8] = "-";
+        if (devs[i].bl_version)
+            snprintf(version, sizeof(version), "0x%02X", devs[i].bl_version);
+        printf("%-16.16s %-8s %-4s %6d %8lu %7.2f s\n", devs[i].path, result_name(devs[i].ret),
+               version, devs[i].pages_written, devs[i].traffic.bytes, devs[i].seconds);
+        failed += devs[i].ret != 0;
+    }
+    printf("%d of %d board(s) OK.\n", count - failed, count);
+
+    return failed ? -1 : 0;
+}
+
 int main(int argc, char *argv[])
 {
-    const char   *hex_file = NULL;
-    flash_image_t image;
+    static device_t devs[MAX_DEVICES];
+    flash_image_t *image    = NULL;
+    const char   *hex_file  = NULL;
+    char         *bus_list  = NULL;
+    job_t         job       = { MODE_FLASH, NULL, 0, 0, NULL, 0 };
+    int           num_devs;
     int           ret;
+    int           i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "--full") == 0) {
+            job.full = 1;
+        } else if (strcmp(argv[i], "--force") == 0) {
+            job.force = 1;
+        } else if (strcmp(argv[i], "--bus") == 0 && i + 1 < argc) {
+            bus_list = argv[++i];
+        } else if (strcmp(argv[i], "--verify-only") == 0) {
+            job.mode = MODE_VERIFY;
+        } else if (strcmp(argv[i], "--backup") == 0 && i + 1 < argc) {
+            job.mode = MODE_BACKUP;
+            job.file = argv[++i];
+        } else if (strcmp(argv[i], "--eeprom") == 0 && i + 2 < argc) {
+            if (strcmp(argv[i + 1], "read") == 0) {
+                job.mode = MODE_EEPROM_READ;
+            } else if (strcmp(argv[i + 1], "write") == 0) {
+                job.mode = MODE_EEPROM_WRITE;
+            } else {
+                usage(argv[0]);
+                return 2;
+            }
+            job.file = argv[i + 2];
+            i += 2;
+        } else if (!hex_file && argv[i][0] != '-') {
+            hex_file = argv[i];
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
 
-    if (argc < 2 || strcmp(argv[1], "-h") == 0) {
+    if ((job.mode == MODE_FLASH || job.mode == MODE_VERIFY) != (hex_file != NULL)) {
         usage(argv[0]);
-        return argc < 2 ? 2 : 0;
+        return 2;
     }
 
-    hex_file = argv[1];
+    if (bus_list) {
+        num_devs = parse_bus_list(bus_list, devs);
+        if (num_devs <= 0)
+            return 2;
+    } else {
+        strcpy(devs[0].path, DEFAULT_BUS);
+        num_devs   = 1;
+        job.daemon = 1;
+    }
 
-    printf("Parsing %s...\n", hex_file);
-    if (parse_hex_file(hex_file, &image) < 0)
+    if (num_devs > 1 && job.mode != MODE_FLASH && job.mode != MODE_VERIFY) {
+        fprintf(stderr, "--backup and --eeprom take a single bus.\n");
         return 2;
-    printf("  %u page(s) with data.\n\n", image.num_pages);
+    }
 
-    if (i2c_open("/dev/i2c-1") < 0)
-        return 2;
+    if (hex_file) {
+        printf("Loading %s...\n", hex_file);
+        image = malloc(sizeof(*image));
+        if (!image) {
+            fprintf(stderr, "Out of memory.\n");
+            return 2;
+        }
+        if (load_image(hex_file, image) < 0)
+            return 2;
+        printf("  %u page(s) with data.\n\n", image->num_pages);
+        job.image = image;
+    }
 
-    ret = run_flash_sequence(&image);
+    for (i = 0; i < num_devs; i++)
+        devs[i].job = &job;
+
+    if (num_devs == 1) {
+        devs[0].out      = stdout;
+        devs[0].err      = stderr;
+        devs[0].progress = 1;
+        run_device(&devs[0]);
+        ret = devs[0].ret;
+    } else {
+        ret = run_parallel(devs, num_devs);
+    }
 
-    close(i2c_fd);
+    free(image);
     return ret == 0 ? 0 : 1;
 }
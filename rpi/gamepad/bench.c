@@ -0,0 +1,669 @@
+// gamepad-bench: press-to-event latency of the gamepad driver.
+//
+// Runs the driver against the simulated ATmega (--bus sim:atmega) with a script
+// of button taps at known CLOCK_MONOTONIC times, reads the events back from the
+// driver's /dev/input/eventN and reports for each polling configuration the
+// press-to-event latency, the taps that never produced a press and the CPU time
+// the driver used. --json writes the same results for comparing builds.
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <linux/input.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+
+#include "lat_hist.h"
+
+// ---- Constants ----------------------------------------------------------------
+
+#define DEVICE_NAME       "PS3 Controller"
+#define TAP_MAP           "0---------------"    // input bit 0 drives BTN_SOUTH
+#define TAP_CODE          BTN_SOUTH
+#define START_DELAY_MS    1000      // launch to the first scripted change
+#define DRAIN_MS          300       // events still accepted after the last release
+#define DEBOUNCE_MS       10        // firmware holds a released button this long
+#define GAP_MARGIN_MS     20        // spare time after each release for late polls
+#define IDLE_AFTER_MS     50        // adaptive scenarios: every tap arrives from idle
+#define MAX_SCENARIOS     16
+#define MAX_TAP_LENGTHS   16
+#define MAX_EXTRA_ARGS    16
+
+// ---- Globals ------------------------------------------------------------------
+
+typedef struct {
+    char   name[32];
+    char   rate[16];            // --rate-hz, "" for the driver default
+    char   idle[16];            // --idle-hz, "" for fixed-rate polling
+    double slowest_ms;          // longest poll period, spaces the taps
+} Scenario;
+
+typedef struct {
+    uint32_t   taps, missed, extra;
+    uint32_t   len_taps[MAX_TAP_LENGTHS], len_missed[MAX_TAP_LENGTHS];
+    lat_hist_t latency;         // us from the scripted press to the evdev event
+    double     user_s, sys_s, wall_s;
+    long long  cycles, missed_deadlines;  // from the driver's polling report, -1 if absent
+} Result;
+
+static const char *gamepad_path = NULL;
+static const char *json_path    = NULL;
+static const char *device_path  = NULL;
+static const char *label        = "";
+static int         taps         = 200;
+static unsigned    seed         = 1;
+static double      tap_ms[MAX_TAP_LENGTHS] = { 1, 3, 5, 10, 20, 50 };
+static int         n_tap_ms     = 6;
+static char       *extra_args[MAX_EXTRA_ARGS];
+static int         n_extra_args = 0;
+
+static Scenario scenarios[MAX_SCENARIOS];
+static Result   results[MAX_SCENARIOS];
+static int      n_scenarios = 0;
+
+static char     workdir[64];
+static pid_t    child = -1;
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+// ---- Scenarios ----------------------------------------------------------------
+
+static void add_scenario(const char *rate, const char *idle) {
+    Scenario *s = &scenarios[n_scenarios++];
+    double active_hz = rate[0] ? atof(rate) : 62.5;
+
+    snprintf(s->rate, sizeof(s->rate), "%s", rate);
+    snprintf(s->idle, sizeof(s->idle), "%s", idle);
+    if (idle[0]) {
+        snprintf(s->name, sizeof(s->name), "adaptive %s/%s Hz", rate, idle);
+        s->slowest_ms = 1000.0 / atof(idle);
+    } else {
+        snprintf(s->name, sizeof(s->name), "fixed %s Hz", rate[0] ? rate : "62.5");
+        s->slowest_ms = 1000.0 / active_hz;
+    }
+}
+
+// "default,125,250" -> one fixed-rate scenario per entry
+static bool parse_rates(const char *arg) {
+    char buf[128], *tok, *save;
+
+    snprintf(buf, sizeof(buf), "%s", arg);
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        int hz = atoi(tok);
+        if (n_scenarios == MAX_SCENARIOS - 1) return false;
+        if (strcmp(tok, "default") == 0)   add_scenario("", "");
+        else if (hz >= 1 && hz <= 1000)    add_scenario(tok, "");
+        else return false;
+    }
+    return true;
+}
+
+// "<active>/<idle>" -> one adaptive scenario
+static bool parse_adaptive(const char *arg) {
+    char rate[16], idle[16];
+    int  a, i;
+
+    if (strcmp(arg, "none") == 0) return true;
+    if (sscanf(arg, "%15[0-9]/%15[0-9]", rate, idle) != 2) return false;
+    a = atoi(rate);
+    i = atoi(idle);
+    if (a < 1 || a > 1000 || i < 1 || i > 1000) return false;
+    add_scenario(rate, idle);
+    return true;
+}
+
+static bool parse_tap_ms(const char *arg) {
+    char buf[128], *tok, *save;
+
+    n_tap_ms = 0;
+    snprintf(buf, sizeof(buf), "%s", arg);
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        double ms = atof(tok);
+        if (n_tap_ms == MAX_TAP_LENGTHS || ms <= 0 || ms > 1000) return false;
+        tap_ms[n_tap_ms++] = ms;
+    }
+    return n_tap_ms > 0;
+}
+
+// Writes the tap script and fills press[] with each tap's press time, in us
+// after the script start. Taps cycle through the lengths; the gap after each
+// release covers the debounce hold, two of the slowest polls and a margin, so
+// the driver always sees the release, plus a random part so presses land at
+// every phase of the poll period.
+static uint64_t write_script(const Scenario *s, const char *path, uint64_t *press, int *len_index) {
+    FILE    *f = fopen(path, "w");
+    unsigned r = seed;
+    double   t = 0, idle_ms = s->idle[0] ? IDLE_AFTER_MS : 0;
+
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    fprintf(f, "# ms  buttons\n0 0000\n");
+    for (int i = 0; i < taps; i++) {
+        double len = tap_ms[i % n_tap_ms];
+        double gap = DEBOUNCE_MS + GAP_MARGIN_MS + idle_ms + s->slowest_ms * (2.0 + rand_r(&r) / (double)RAND_MAX);
+
+        t += gap;
+        press[i]     = (uint64_t)(t * 1000.0);
+        len_index[i] = i % n_tap_ms;
+        fprintf(f, "%.3f 0001\n%.3f 0000\n", t, t + len);
+        t += len;
+    }
+    fclose(f);
+    return (uint64_t)(t * 1000.0);
+}
+
+// ---- Driver process -----------------------------------------------------------
+
+static bool is_event_node(const char *name, int *n) {
+    return sscanf(name, "event%d", n) == 1 && *n >= 0 && *n < 1024;
+}
+
+static void list_event_nodes(bool present[1024]) {
+    DIR *d = opendir("/dev/input");
+    struct dirent *e;
+    int n;
+
+    memset(present, 0, 1024 * sizeof(bool));
+    if (!d) return;
+    while ((e = readdir(d)))
+        if (is_event_node(e->d_name, &n)) present[n] = true;
+    closedir(d);
+}
+
+// Opens the driver's event device: --device, or the first "PS3 Controller"
+// node that was not there before the launch. Gives up when the driver exits.
+static int find_device(const bool before[1024], uint64_t deadline) {
+    char path[300], name[64];
+    int  status;
+
+    while (running && now_us() < deadline) {
+        if (waitpid(child, &status, WNOHANG) == child) {
+            child = -1;
+            return -1;
+        }
+        if (device_path) {
+            int fd = open(device_path, O_RDONLY | O_NONBLOCK);
+            if (fd >= 0) return fd;
+        } else {
+            DIR *d = opendir("/dev/input");
+            struct dirent *e;
+            int n;
+
+            while (d && (e = readdir(d))) {
+                if (!is_event_node(e->d_name, &n) || before[n]) continue;
+                snprintf(path, sizeof(path), "/dev/input/%s", e->d_name);
+                int fd = open(path, O_RDONLY | O_NONBLOCK);
+                if (fd < 0) continue;
+                if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) >= 0 &&
+                    strncmp(name, DEVICE_NAME, sizeof(name)) == 0) {
+                    closedir(d);
+                    return fd;
+                }
+                close(fd);
+            }
+            if (d) closedir(d);
+        }
+        sleep_ms(10);
+    }
+    return -1;
+}
+
+static pid_t launch(const Scenario *s, const char *script, uint64_t start, const char *log) {
+    char  spec[256], idle_after[16];
+    char *argv[16 + MAX_EXTRA_ARGS];
+    int   argc = 0;
+    pid_t pid;
+
+    snprintf(spec, sizeof(spec), "sim:atmega:input=%s:start=%llu", script, (unsigned long long)start);
+    argv[argc++] = (char *)gamepad_path;
+    argv[argc++] = "--map";
+    argv[argc++] = TAP_MAP;
+    argv[argc++] = "--bus";
+    argv[argc++] = spec;
+    if (s->rate[0]) {
+        argv[argc++] = "--rate-hz";
+        argv[argc++] = (char *)s->rate;
+    }
+    if (s->idle[0]) {
+        argv[argc++] = "--idle-hz";
+        argv[argc++] = (char *)s->idle;
+        argv[argc++] = "--idle-after-ms";
+        snprintf(idle_after, sizeof(idle_after), "%d", IDLE_AFTER_MS);
+        argv[argc++] = idle_after;
+    }
+    for (int i = 0; i < n_extra_args; i++)
+        argv[argc++] = extra_args[i];
+    argv[argc] = NULL;
+
+    pid = fork();
+    if (pid == 0) {
+        int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        execv(gamepad_path, argv);
+        perror(gamepad_path);
+        _exit(127);
+    }
+    return pid;
+}
+
+static void print_log(const char *log) {
+    FILE *f = fopen(log, "r");
+    char  line[256];
+
+    if (!f) return;
+    while (fgets(line, sizeof(line), f))
+        fprintf(stderr, "    %s", line);
+    fclose(f);
+}
+
+// "Polling: target 500.0 Hz (2000 us), 992 cycles, 7 missed deadlines"
+static void parse_polling_report(const char *log, Result *r) {
+    FILE *f = fopen(log, "r");
+    char  line[256];
+
+    r->cycles = r->missed_deadlines = -1;
+    if (!f) return;
+    while (fgets(line, sizeof(line), f))
+        sscanf(line, "Polling: target %*f Hz (%*u us), %lld cycles, %lld missed deadlines",
+               &r->cycles, &r->missed_deadlines);
+    fclose(f);
+}
+
+// ---- One scenario -------------------------------------------------------------
+
+static bool run_scenario(const Scenario *s, Result *r) {
+    char      script[96], log[96];
+    uint64_t *press  = calloc((size_t)taps, sizeof(uint64_t));
+    int      *len_ix = calloc((size_t)taps, sizeof(int));
+    uint64_t *events = calloc((size_t)taps * 4, sizeof(uint64_t));
+    int       n_events = 0, next = 0, status = 0, fd, clk = CLOCK_MONOTONIC;
+    bool      before[1024], ok = false;
+    uint64_t  launched, start, end;
+    struct rusage ru;
+
+    memset(r, 0, sizeof(*r));
+    lat_hist_reset(&r->latency);
+    if (!press || !len_ix || !events) {
+        fprintf(stderr, "Error: out of memory\n");
+        exit(1);
+    }
+
+    snprintf(script, sizeof(script), "%s/taps.txt", workdir);
+    snprintf(log, sizeof(log), "%s/gamepad.log", workdir);
+    end = write_script(s, script, press, len_ix);
+
+    list_event_nodes(before);
+    launched = now_us();
+    start    = launched + START_DELAY_MS * 1000ULL;
+    child    = launch(s, script, start, log);
+    if (child < 0) {
+        perror("fork");
+        goto out;
+    }
+
+    fd = find_device(before, start - 100000);
+    if (fd < 0) {
+        if (child < 0)
+            fprintf(stderr, "%s: the driver exited. Driver output:\n", s->name);
+        else
+            fprintf(stderr, "%s: no \"%s\" event device appeared within %d ms. Driver output:\n",
+                    s->name, DEVICE_NAME, START_DELAY_MS - 100);
+        print_log(log);
+        goto out;
+    }
+    if (ioctl(fd, EVIOCSCLOCKID, &clk) < 0) {
+        perror("EVIOCSCLOCKID");
+        close(fd);
+        goto out;
+    }
+
+    // Collect press times until the last tap has had time to arrive
+    end += start + DRAIN_MS * 1000ULL;
+    while (running && now_us() < end) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        struct input_event ev[64];
+        ssize_t n;
+
+        if (poll(&pfd, 1, 50) <= 0) {
+            if (waitpid(child, &status, WNOHANG) == child) {
+                fprintf(stderr, "%s: the driver exited early. Driver output:\n", s->name);
+                print_log(log);
+                child = -1;
+                close(fd);
+                goto out;
+            }
+            continue;
+        }
+        n = read(fd, ev, sizeof(ev));
+        for (int i = 0; i < n / (ssize_t)sizeof(ev[0]); i++) {
+            uint64_t t = (uint64_t)ev[i].input_event_sec * 1000000ULL + (uint64_t)ev[i].input_event_usec;
+            if (ev[i].type == EV_KEY && ev[i].code == TAP_CODE && ev[i].value == 1 &&
+                n_events < taps * 4 && t >= start)
+                events[n_events++] = t - start;
+        }
+    }
+    close(fd);
+    if (!running) goto out;
+
+    // Each tap owns the first press between its scripted press and the next one
+    r->taps = (uint32_t)taps;
+    for (int i = 0; i < taps; i++) {
+        uint64_t limit = i + 1 < taps ? press[i + 1] : UINT64_MAX;
+
+        r->len_taps[len_ix[i]]++;
+        while (next < n_events && events[next] < press[i])
+            next++;
+        if (next < n_events && events[next] < limit) {
+            lat_hist_record(&r->latency, (uint32_t)(events[next] - press[i]));
+            next++;
+        } else {
+            r->missed++;
+            r->len_missed[len_ix[i]]++;
+        }
+    }
+    r->extra = (uint32_t)n_events - (r->taps - r->missed);
+    ok = true;
+
+out:
+    if (child > 0) {
+        kill(child, SIGTERM);
+        if (wait4(child, &status, 0, &ru) == child) {
+            r->user_s = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+            r->sys_s  = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        }
+        child = -1;
+    }
+    r->wall_s = (now_us() - launched) / 1e6;
+    parse_polling_report(log, r);
+    free(press);
+    free(len_ix);
+    free(events);
+    return ok;
+}
+
+// ---- Output -------------------------------------------------------------------
+
+static void print_table_header(void) {
+    printf("%-22s %5s %6s %7s %7s %7s %7s %7s %6s\n",
+           "Scenario", "Taps", "Missed", "p50", "p90", "p99", "max us", "Extra", "CPU");
+}
+
+static void print_result(const Scenario *s, const Result *r) {
+    const lat_hist_t *h = &r->latency;
+    double cpu = r->wall_s > 0 ? 100.0 * (r->user_s + r->sys_s) / r->wall_s : 0;
+
+    printf("%-22s %5u %6u %7u %7u %7u %7u %7u %5.1f%%\n", s->name, r->taps, r->missed,
+           lat_hist_percentile(h, 50), lat_hist_percentile(h, 90), lat_hist_percentile(h, 99),
+           h->count ? h->max : 0, r->extra, cpu);
+    fflush(stdout);
+}
+
+static void print_missed_by_length(void) {
+    printf("\nMissed taps by tap length:\n%-22s", "");
+    for (int j = 0; j < n_tap_ms; j++)
+        printf(" %6g ms", tap_ms[j]);
+    printf("\n");
+    for (int i = 0; i < n_scenarios; i++) {
+        printf("%-22s", scenarios[i].name);
+        for (int j = 0; j < n_tap_ms; j++) {
+            char cell[24];
+            snprintf(cell, sizeof(cell), "%u/%u", results[i].len_missed[j], results[i].len_taps[j]);
+            printf(" %9s", cell);
+        }
+        printf("\n");
+    }
+}
+
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')          fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)    fprintf(f, "\\u%04x", *s);
+        else                                  fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void write_json(const char *path) {
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    struct utsname u;
+    char  date[32];
+    time_t now = time(NULL);
+
+    if (!f) {
+        perror(path);
+        return;
+    }
+    uname(&u);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(f, "{\n  \"label\": ");
+    json_string(f, label);
+    fprintf(f, ",\n  \"date\": \"%s\",\n  \"host\": ", date);
+    json_string(f, u.nodename);
+    fprintf(f, ",\n  \"kernel\": ");
+    json_string(f, u.release);
+    fprintf(f, ",\n  \"machine\": ");
+    json_string(f, u.machine);
+    fprintf(f, ",\n  \"gamepad\": ");
+    json_string(f, gamepad_path);
+    fprintf(f, ",\n  \"extra_args\": [");
+    for (int i = 0; i < n_extra_args; i++) {
+        fprintf(f, "%s", i ? ", " : "");
+        json_string(f, extra_args[i]);
+    }
+    fprintf(f, "],\n  \"taps\": %d,\n  \"seed\": %u,\n  \"tap_ms\": [", taps, seed);
+    for (int j = 0; j < n_tap_ms; j++)
+        fprintf(f, "%s%g", j ? ", " : "", tap_ms[j]);
+    fprintf(f, "],\n  \"scenarios\": [\n");
+
+    for (int i = 0; i < n_scenarios; i++) {
+        const Scenario   *s = &scenarios[i];
+        const Result     *r = &results[i];
+        const lat_hist_t *h = &r->latency;
+
+        fprintf(f, "    {\n      \"name\": ");
+        json_string(f, s->name);
+        fprintf(f, ",\n");
+        fprintf(f, "      \"rate_hz\": %s,\n", s->rate[0] ? s->rate : "62.5");
+        fprintf(f, "      \"idle_hz\": %s,\n", s->idle[0] ? s->idle : "null");
+        fprintf(f, "      \"taps\": %u,\n      \"detected\": %u,\n      \"missed\": %u,\n      \"extra_presses\": %u,\n",
+                r->taps, r->taps - r->missed, r->missed, r->extra);
+        fprintf(f, "      \"missed_by_tap_ms\": [");
+        for (int j = 0; j < n_tap_ms; j++)
+            fprintf(f, "%s{\"tap_ms\": %g, \"taps\": %u, \"missed\": %u}",
+                    j ? ", " : "", tap_ms[j], r->len_taps[j], r->len_missed[j]);
+        fprintf(f, "],\n");
+        fprintf(f, "      \"latency_us\": {\"n\": %llu, \"min\": %u, \"mean\": %.1f, \"p50\": %u, \"p90\": %u, "
+                   "\"p99\": %u, \"p99_9\": %u, \"max\": %u},\n",
+                (unsigned long long)h->count, h->count ? h->min : 0, h->count ? (double)h->sum / h->count : 0.0,
+                lat_hist_percentile(h, 50), lat_hist_percentile(h, 90), lat_hist_percentile(h, 99),
+                lat_hist_percentile(h, 99.9), h->count ? h->max : 0);
+        fprintf(f, "      \"cpu\": {\"user_s\": %.3f, \"sys_s\": %.3f, \"wall_s\": %.3f, \"percent\": %.2f},\n",
+                r->user_s, r->sys_s, r->wall_s,
+                r->wall_s > 0 ? 100.0 * (r->user_s + r->sys_s) / r->wall_s : 0.0);
+        if (r->cycles >= 0)
+            fprintf(f, "      \"polling\": {\"cycles\": %lld, \"missed_deadlines\": %lld}\n",
+                    r->cycles, r->missed_deadlines);
+        else
+            fprintf(f, "      \"polling\": null\n");
+        fprintf(f, "    }%s\n", i + 1 < n_scenarios ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (f != stdout) fclose(f);
+}
+
+// ---- Argument parsing ---------------------------------------------------------
+
+static void usage(void) {
+    puts(
+"Usage: gamepad-bench [options] [-- <extra gamepad options>]\n"
+"\n"
+"Runs the gamepad driver against a simulated ATmega that taps a button on a\n"
+"fixed schedule, and reports press-to-event latency, missed taps and CPU use\n"
+"per polling configuration. Needs write access to /dev/uinput and read access\n"
+"to /dev/input/event*.\n"
+"\n"
+"  --gamepad <path>       Driver to run (default: gamepad next to this program)\n"
+"  --rates <list>         Fixed polling rates in Hz, \"default\" for the driver's\n"
+"                         own (default: default,125,250,500,1000)\n"
+"  --adaptive <a>/<i>     Adaptive scenario: --rate-hz a, --idle-hz i, idle after\n"
+"                         50 ms so every tap comes from idle (default: 1000/10,\n"
+"                         \"none\" to skip)\n"
+"  --taps <n>             Taps per scenario (default: 200)\n"
+"  --tap-ms <list>        Tap lengths cycled through, in ms (default: 1,3,5,10,20,50)\n"
+"  --seed <n>             Seed for the tap spacing (default: 1)\n"
+"  --device <path>        Read events from this node instead of finding it\n"
+"  --json <path>          Also write the results as JSON (\"-\" for stdout)\n"
+"  --label <text>         Stored in the JSON, e.g. a commit or firmware version\n"
+"  -h, --help             Show this help");
+}
+
+static const char *need_value(int argc, char *argv[], int i) {
+    if (i + 1 >= argc) {
+        fprintf(stderr, "Error: %s requires a value\n", argv[i]);
+        exit(1);
+    }
+    return argv[i + 1];
+}
+
+static void parse_args(int argc, char *argv[]) {
+    const char *rates = "default,125,250,500,1000", *adaptive = "1000/10";
+    static char default_gamepad[512];
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage();
+            exit(0);
+        } else if (strcmp(argv[i], "--") == 0) {
+            for (i++; i < argc; i++) {
+                if (n_extra_args == MAX_EXTRA_ARGS) {
+                    fprintf(stderr, "Error: more than %d extra gamepad options\n", MAX_EXTRA_ARGS);
+                    exit(1);
+                }
+                extra_args[n_extra_args++] = argv[i];
+            }
+        } else if (strcmp(argv[i], "--gamepad") == 0) {
+            gamepad_path = need_value(argc, argv, i++);
+        } else if (strcmp(argv[i], "--rates") == 0) {
+            rates = need_value(argc, argv, i++);
+        } else if (strcmp(argv[i], "--adaptive") == 0) {
+            adaptive = need_value(argc, argv, i++);
+        } else if (strcmp(argv[i], "--taps") == 0) {
+            taps = atoi(need_value(argc, argv, i++));
+            if (taps < 1 || taps > 100000) {
+                fprintf(stderr, "Error: --taps must be 1-100000\n");
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--tap-ms") == 0) {
+            if (!parse_tap_ms(need_value(argc, argv, i++))) {
+                fprintf(stderr, "Error: --tap-ms takes up to %d lengths of 0-1000 ms\n", MAX_TAP_LENGTHS);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            seed = (unsigned)atoi(need_value(argc, argv, i++));
+        } else if (strcmp(argv[i], "--device") == 0) {
+            device_path = need_value(argc, argv, i++);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json_path = need_value(argc, argv, i++);
+        } else if (strcmp(argv[i], "--label") == 0) {
+            label = need_value(argc, argv, i++);
+        } else {
+            fprintf(stderr, "Error: unknown option '%s'. Use --help for usage.\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (!parse_rates(rates)) {
+        fprintf(stderr, "Error: --rates takes \"default\" or rates of 1-1000 Hz, separated by commas\n");
+        exit(1);
+    }
+    if (!parse_adaptive(adaptive)) {
+        fprintf(stderr, "Error: --adaptive takes <active Hz>/<idle Hz> or \"none\"\n");
+        exit(1);
+    }
+    if (!gamepad_path) {
+        const char *slash = strrchr(argv[0], '/');
+        snprintf(default_gamepad, sizeof(default_gamepad), "%.*sgamepad",
+                 slash ? (int)(slash - argv[0] + 1) : 0, argv[0]);
+        gamepad_path = slash ? default_gamepad : "./gamepad";
+    }
+}
+
+// ---- Main ---------------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+
+    parse_args(argc, argv);
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    snprintf(workdir, sizeof(workdir), "/tmp/gamepad-bench.XXXXXX");
+    if (!mkdtemp(workdir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    printf("%d taps per scenario, tap lengths", taps);
+    for (int j = 0; j < n_tap_ms; j++)
+        printf("%s %g", j ? "," : "", tap_ms[j]);
+    printf(" ms\n\n");
+    print_table_header();
+
+    // A failed run is nearly always the environment (no uinput access), so stop there
+    for (int i = 0; i < n_scenarios && running && !failed; i++) {
+        if (run_scenario(&scenarios[i], &results[i]))
+            print_result(&scenarios[i], &results[i]);
+        else
+            failed++;
+    }
+    if (running && !failed)
+        print_missed_by_length();
+
+    if (json_path && running && !failed)
+        write_json(json_path);
+
+    char path[96];
+    snprintf(path, sizeof(path), "%s/taps.txt", workdir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/gamepad.log", workdir);
+    unlink(path);
+    rmdir(workdir);
+
+    return running && !failed ? 0 : 1;
+}
@@ -2,7 +2,6 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <linux/i2c-dev.h>
 #include <sys/ioctl.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,12 +9,33 @@
 #include <linux/uinput.h>
 #include <linux/input.h>
 #include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <poll.h>
+
+#include "topper_protocol.h"
+#include "topper_link.h"
+#include "lat_hist.h"
+#include "realtime.h"
+#include "stick.h"
+#include "vblank.h"
 
 // ---- Constants ----------------------------------------------------------------
 
-#define POLLING_DELAY_US  16000
-#define I2C_DEVICE_ADDRESS  0x30
-#define DATASIZE               9   // Topper i2cStructure is 9 bytes
+#define POLLING_DELAY_US  16000     // default period, about 60 Hz
+#define RATE_HZ_MIN       1
+#define RATE_HZ_MAX       1000      // the ATmega refreshes its report every 1 ms
+#define IDLE_AFTER_MS     2000
+#define BACKOFF_MIN_MS    10
+#define BACKOFF_MAX_MS    1000
+#define LOST_AFTER_MS     2000      // without a good frame before inputs are released
+#define REPROBE_MS        1000
+#define MOUSE_HZ          250
+#define MOUSE_SPEED       1000      // pixels per second at full deflection
+#define MOUSE_ACCEL_MS    500       // full deflection held this long reaches --mouse-accel
+#define VBLANK_OFFSET_US  2000      // --vblank: read this long before each vblank
 
 // Append one input_event to an array and advance the count.
 #define EMIT(ev, cnt, t, c, v) \
@@ -41,8 +61,60 @@ static int axis_center_ly = 127;
 static int axis_center_rx = 127;
 static int axis_center_ry = 127;
 
-static int i2c_fd     = -1;
+// --axis-cal: per-axis min/center/max for the stick pipeline, -1 = use the above
+static int axis_cal[4][3] = {
+    { -1, -1, -1 }, { -1, -1, -1 }, { -1, -1, -1 }, { -1, -1, -1 },
+};
+static const char *axis_names[4] = { "lx", "ly", "rx", "ry" };
+
+// Stick pipeline (stick.h), enabled by any --stick-* or --axis-cal option.
+// Overrides are applied to both sticks' profiles after parsing; < 0 = unset.
+static bool         stick_pipeline = false;
+static StickProfile stick_profile[2];
+static StickLut     stick_lut[2];
+static float        stick_deadzone     = -1;
+static float        stick_antideadzone = -1;
+static float        stick_saturation   = -1;
+static const char  *stick_curve        = NULL;
+
+static topper_link_t *topper = NULL;
+static const char    *bus_spec = NULL;     // --bus: open this bus directly, bypassing topperd
 static int gamepad_fd = -1;
+static int timer_fd   = -1;
+
+static uint64_t active_period_ns = POLLING_DELAY_US * 1000ULL;
+static uint64_t idle_period_ns   = 0;   // 0: adaptive polling off
+static uint64_t idle_after_ns    = IDLE_AFTER_MS * 1000000ULL;
+static int      idle_threshold   = AXIS_FUZZ;
+
+static int      read_retries     = 2;
+static uint64_t reprobe_ns       = REPROBE_MS * 1000000ULL;
+static uint64_t stats_interval_ns = 0;
+static bool     rate_given       = false;
+
+// --vblank: poll once per display frame, a fixed time before its vblank
+static bool        vblank_sync      = false;
+static const char *vblank_card      = NULL;
+static uint64_t    vblank_offset_ns = VBLANK_OFFSET_US * 1000ULL;
+static Vblank      vblank           = { .fd = -1 };
+
+// --mouse: a second uinput device, a pointer moved by one stick
+static int          mouse_stick     = -1;   // 0 = left, 1 = right, -1 = off
+static int          mouse_fd        = -1;
+static int          mouse_timer_fd  = -1;
+static bool         mouse_moving    = false;    // mouse timer armed
+static uint64_t     mouse_period_ns = 1000000000ULL / MOUSE_HZ;
+static double       mouse_speed     = MOUSE_SPEED;
+static double       mouse_accel     = 2.0;
+static int8_t       mouse_button_bit[3] = { -1, -1, -1 };  // input bit for left, right, middle
+static StickProfile mouse_profile;
+static StickLut     mouse_lut;
+
+static bool              realtime = false;
+static realtime_config_t rt_config = { REALTIME_DEFAULT_PRIORITY, -1 };
+
+static volatile sig_atomic_t running    = 1;
+static volatile sig_atomic_t dump_stats = 0;
 
 typedef struct {
     uint16_t buttons;
@@ -103,27 +175,6 @@ static const char *ps3_button_names[17] = {
     "dpup", "dpdown", "dpleft", "dpright",
 };
 
-// ---- CRC-16-CCITT -------------------------------------------------------------
-
-static uint16_t crc16_table[256];
-
-static void init_crc16_table(void) {
-    const uint16_t poly = 0x1021;
-    for (uint16_t i = 0; i < 256; i++) {
-        uint16_t crc = i << 8;
-        for (uint8_t j = 0; j < 8; j++)
-            crc = (crc & 0x8000) ? (crc << 1) ^ poly : crc << 1;
-        crc16_table[i] = crc;
-    }
-}
-
-static uint16_t compute_crc16(const uint8_t *data, uint8_t len) {
-    uint16_t crc = 0xFFFF;
-    for (uint8_t i = 0; i < len; i++)
-        crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ data[i]) & 0xFF];
-    return crc;
-}
-
 // ---- Map string ---------------------------------------------------------------
 //
 // The --map argument is a 16-character string, one character per input bit
@@ -177,66 +228,111 @@ static void print_mapping(void) {
 // ---- Cleanup ------------------------------------------------------------------
 
 static void cleanup(void) {
+    if (timer_fd >= 0) {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+    if (mouse_timer_fd >= 0) {
+        close(mouse_timer_fd);
+        mouse_timer_fd = -1;
+    }
+    if (mouse_fd >= 0) {
+        ioctl(mouse_fd, UI_DEV_DESTROY);
+        close(mouse_fd);
+        mouse_fd = -1;
+    }
     if (gamepad_fd >= 0) {
         ioctl(gamepad_fd, UI_DEV_DESTROY);
         close(gamepad_fd);
         gamepad_fd = -1;
     }
-    if (i2c_fd >= 0) {
-        close(i2c_fd);
-        i2c_fd = -1;
-    }
+    vblank_close(&vblank);
+    topper_link_close(topper);
+    topper = NULL;
+}
+
+// ---- Latency trace ------------------------------------------------------------
+//
+// With --trace every poll is timestamped on CLOCK_MONOTONIC: when the read
+// starts, when a frame with a valid CRC has arrived, and when the uinput write
+// for it returns. Each event batch also carries MSC_TIMESTAMP, the read
+// completion time in microseconds, so a reader that sets EVIOCSCLOCKID to
+// CLOCK_MONOTONIC can subtract it from the event time to get the driver's
+// share of the latency.
+
+typedef struct {
+    uint64_t   batches;     // event batches written
+    lat_hist_t read;        // read request to valid frame, one attempt
+    lat_hist_t deliver;     // valid frame to uinput write returned
+    lat_hist_t total;       // poll start, including retries, to uinput write returned
+} TraceStats;
+
+static bool       trace = false;
+static TraceStats trace_stats;
+static uint64_t   t_poll_start;
+static uint64_t   t_read_done;      // 0 when no fresh frame is waiting to be delivered
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static struct timespec ns_to_timespec(uint64_t ns) {
+    return (struct timespec){ (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+}
+
+static uint32_t us_between(uint64_t from, uint64_t to) {
+    return to > from ? (uint32_t)((to - from) / 1000) : 0;
+}
+
+static void print_trace_stats(void) {
+    fprintf(stderr, "Latency: %llu event batches\n", (unsigned long long)trace_stats.batches);
+    lat_hist_print(stderr, "i2c read", &trace_stats.read, "us");
+    lat_hist_print(stderr, "frame to event", &trace_stats.deliver, "us");
+    lat_hist_print(stderr, "poll to event", &trace_stats.total, "us");
 }
 
 // ---- I2C ----------------------------------------------------------------------
 
 static void init_i2c(void) {
-    i2c_fd = open("/dev/i2c-1", O_RDWR);
-    if (i2c_fd < 0) {
-        perror("Failed to open /dev/i2c-1");
+    // Goes through topperd when it is running, otherwise opens the bus.
+    topper = topper_link_open(bus_spec, bus_spec != NULL);
+    if (!topper)
         exit(1);
-    }
-    if (ioctl(i2c_fd, I2C_SLAVE, I2C_DEVICE_ADDRESS) < 0) {
-        perror("Failed to set I2C slave address");
-        cleanup();
-        exit(1);
-    }
+
     // Probe: confirm something is there before starting the loop.
-    uint8_t probe;
-    if (read(i2c_fd, &probe, 1) < 1) {
-        fprintf(stderr, "No I2C device found at address 0x%02X\n", I2C_DEVICE_ADDRESS);
+    uint8_t probe[REPORT_LEN];
+    if (topper_link_report(topper, probe, 0) == TOPPER_ERR_IO) {
+        fprintf(stderr, "No I2C device found at address 0x%02X\n", I2C_APP_ADDR);
         cleanup();
         exit(1);
     }
-    printf("I2C device found at 0x%02X\n", I2C_DEVICE_ADDRESS);
+    printf("I2C device found at 0x%02X%s\n", I2C_APP_ADDR,
+           topper_link_is_daemon(topper) ? " (via topperd)" : "");
 }
 
-// Topper i2cStructure wire layout (9 bytes, AVR little-endian):
-//   [0-1]  buttons  uint16_t  (bit0-7 = PORTB, bit8-15 = PORTD, active-high after ATmega inversion)
-//   [2]    joyLX    uint8_t
-//   [3]    joyLY    uint8_t
-//   [4]    joyRX    uint8_t
-//   [5]    joyRY    uint8_t
-//   [6]    status   uint8_t   (brightness:3, display_on:1, crc_active:1, ...)
-//   [7-8]  crc16    uint16_t  little-endian, over bytes 0-6
-//
-// We parse manually from a raw byte buffer to avoid any struct-packing
-// differences between AVR and the host architecture.
-
-static bool read_i2c_data(void) {
-    uint8_t buf[DATASIZE];
-    if (read(i2c_fd, buf, DATASIZE) != DATASIZE) return false;
-
-    uint16_t computed = compute_crc16(buf, 7);
-    uint16_t received = (uint16_t)buf[7] | ((uint16_t)buf[8] << 8);
-    if (computed != received) return false;
-
-    current.buttons = (uint16_t)buf[0] | ((uint16_t)buf[1] << 8);
-    current.joyLX   = buf[2];
-    current.joyLY   = buf[3];
-    current.joyRX   = buf[4];
-    current.joyRY   = buf[5];
-    return true;
+// The report frame layout is defined in topper_protocol.h. We parse manually
+// from a raw byte buffer to avoid any struct-packing differences between AVR
+// and the host architecture.
+
+static int read_i2c_data(void) {
+    uint8_t buf[REPORT_LEN];
+    uint64_t t_start = trace ? now_ns() : 0;
+    int status = topper_link_report(topper, buf, 0);
+    if (status != TOPPER_OK) return status;
+
+    if (trace) {
+        t_read_done = now_ns();
+        lat_hist_record(&trace_stats.read, us_between(t_start, t_read_done));
+    }
+
+    current.buttons = (uint16_t)buf[REPORT_BUTTONS] | ((uint16_t)buf[REPORT_BUTTONS + 1] << 8);
+    current.joyLX   = buf[REPORT_JOY_LX];
+    current.joyLY   = buf[REPORT_JOY_LY];
+    current.joyRX   = buf[REPORT_JOY_RX];
+    current.joyRY   = buf[REPORT_JOY_RY];
+    return TOPPER_OK;
 }
 
 // ---- uinput -------------------------------------------------------------------
@@ -258,15 +354,27 @@ static int setup_uinput_gamepad(int fd) {
     ioctl(fd, UI_SET_ABSBIT, ABS_RY);
     ioctl(fd, UI_SET_ABSBIT, ABS_RZ);
 
+    if (trace) {
+        ioctl(fd, UI_SET_EVBIT, EV_MSC);
+        ioctl(fd, UI_SET_MSCBIT, MSC_TIMESTAMP);
+    }
+
     struct uinput_user_dev uidev = {0};
     snprintf(uidev.name, UINPUT_MAX_NAME_SIZE, "PS3 Controller");
     uidev.id = (struct input_id){ BUS_USB, 0x054c, 0x0268, 0x8111 };
 
-    SET_ABS(uidev, ABS_X,  axis_min, axis_max, axis_flat, AXIS_FUZZ);
-    SET_ABS(uidev, ABS_Y,  axis_min, axis_max, axis_flat, AXIS_FUZZ);
+    // With the stick pipeline the sticks are already calibrated and deadzoned
+    // to 0-255 around 128, so the kernel must not add its own flat on top.
+    int smin  = stick_pipeline ? 0   : axis_min;
+    int smax  = stick_pipeline ? 255 : axis_max;
+    int sflat = stick_pipeline ? 0   : axis_flat;
+    int sfuzz = stick_pipeline ? 0   : AXIS_FUZZ;
+
+    SET_ABS(uidev, ABS_X,  smin, smax, sflat, sfuzz);
+    SET_ABS(uidev, ABS_Y,  smin, smax, sflat, sfuzz);
     SET_ABS(uidev, ABS_Z,  0, 255, 0, 0);   // trigger: digital 0 or 255
-    SET_ABS(uidev, ABS_RX, axis_min, axis_max, axis_flat, AXIS_FUZZ);
-    SET_ABS(uidev, ABS_RY, axis_min, axis_max, axis_flat, AXIS_FUZZ);
+    SET_ABS(uidev, ABS_RX, smin, smax, sflat, sfuzz);
+    SET_ABS(uidev, ABS_RY, smin, smax, sflat, sfuzz);
     SET_ABS(uidev, ABS_RZ, 0, 255, 0, 0);   // trigger: digital 0 or 255
 
     if (write(fd, &uidev, sizeof(uidev)) < 0) {
@@ -281,11 +389,11 @@ static int setup_uinput_gamepad(int fd) {
     // Push initial axis positions so the kernel has sane values from the start.
     struct input_event init_events[7];
     int n = 0;
-    EMIT(init_events, n, EV_ABS, ABS_X,  axis_center_lx);
-    EMIT(init_events, n, EV_ABS, ABS_Y,  axis_center_ly);
+    EMIT(init_events, n, EV_ABS, ABS_X,  stick_pipeline ? 128 : axis_center_lx);
+    EMIT(init_events, n, EV_ABS, ABS_Y,  stick_pipeline ? 128 : axis_center_ly);
     EMIT(init_events, n, EV_ABS, ABS_Z,  0);
-    EMIT(init_events, n, EV_ABS, ABS_RX, axis_center_rx);
-    EMIT(init_events, n, EV_ABS, ABS_RY, axis_center_ry);
+    EMIT(init_events, n, EV_ABS, ABS_RX, stick_pipeline ? 128 : axis_center_rx);
+    EMIT(init_events, n, EV_ABS, ABS_RY, stick_pipeline ? 128 : axis_center_ry);
     EMIT(init_events, n, EV_ABS, ABS_RZ, 0);
     EMIT(init_events, n, EV_SYN, SYN_REPORT, 0);
     write(fd, init_events, sizeof(struct input_event) * n);
@@ -308,47 +416,665 @@ static void init_gamepad(void) {
            "(GUID 030000004c0500006802000011810000)\n");
 }
 
+// ---- Mouse emulation ----------------------------------------------------------
+//
+// With --mouse one stick moves a pointer on a second uinput device. The stick
+// goes through its own lookup tables (--mouse-profile, "pointer" by default),
+// and its deflection sets the cursor velocity. A separate timerfd integrates
+// the motion at --mouse-hz, so the cursor glides smoothly even when the I2C
+// poll is slower. Fractions of a pixel carry over to the next tick, so slow
+// movements are not lost to rounding. Holding the stick at full deflection
+// ramps the speed up to --mouse-accel times over MOUSE_ACCEL_MS. The timer is
+// disarmed while the stick rests in its deadzone.
+
+static void init_mouse(void) {
+    if (mouse_stick < 0) return;
+
+    mouse_fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (mouse_fd < 0) {
+        perror("Failed to open /dev/uinput for the mouse");
+        cleanup();
+        exit(1);
+    }
+
+    ioctl(mouse_fd, UI_SET_EVBIT, EV_REL);
+    ioctl(mouse_fd, UI_SET_RELBIT, REL_X);
+    ioctl(mouse_fd, UI_SET_RELBIT, REL_Y);
+    // BTN_LEFT is what makes libinput and X treat the device as a pointer.
+    ioctl(mouse_fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(mouse_fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(mouse_fd, UI_SET_KEYBIT, BTN_RIGHT);
+    ioctl(mouse_fd, UI_SET_KEYBIT, BTN_MIDDLE);
+
+    struct uinput_user_dev uidev = {0};
+    snprintf(uidev.name, UINPUT_MAX_NAME_SIZE, "Topper Stick Mouse");
+    uidev.id = (struct input_id){ BUS_VIRTUAL, 0, 0, 1 };
+
+    if (write(mouse_fd, &uidev, sizeof(uidev)) < 0 || ioctl(mouse_fd, UI_DEV_CREATE) < 0) {
+        perror("Failed to create uinput mouse");
+        cleanup();
+        exit(1);
+    }
+
+    mouse_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (mouse_timer_fd < 0) {
+        perror("Failed to create mouse timer");
+        cleanup();
+        exit(1);
+    }
+    printf("Virtual mouse created, %s stick at %.0f px/s, updated at %.0f Hz\n",
+           mouse_stick ? "right" : "left", mouse_speed, 1e9 / (double)mouse_period_ns);
+}
+
+static void mouse_stick_q15(int32_t *vx, int32_t *vy) {
+    if (mouse_stick == 0)
+        stick_apply_q15(&mouse_lut, current.joyLX, current.joyLY, vx, vy);
+    else
+        stick_apply_q15(&mouse_lut, current.joyRX, current.joyRY, vx, vy);
+}
+
+static void arm_mouse_timer(bool on) {
+    struct itimerspec its = {0};
+    if (on) {
+        its.it_value    = ns_to_timespec(mouse_period_ns);
+        its.it_interval = ns_to_timespec(mouse_period_ns);
+    }
+    timerfd_settime(mouse_timer_fd, 0, &its, NULL);
+    mouse_moving = on;
+}
+
+// Called after each poll: starts the mouse timer once the stick leaves its deadzone.
+static void mouse_wake(void) {
+    if (mouse_stick < 0 || mouse_moving) return;
+
+    int32_t vx, vy;
+    mouse_stick_q15(&vx, &vy);
+    if (vx || vy)
+        arm_mouse_timer(true);
+}
+
+static void mouse_tick(void) {
+    static uint64_t last, held_since;
+    static double   acc_x, acc_y;
+    uint64_t expirations;
+
+    if (read(mouse_timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+
+    int32_t vx, vy;
+    mouse_stick_q15(&vx, &vy);
+    if (!vx && !vy) {
+        arm_mouse_timer(false);
+        last = held_since = 0;
+        acc_x = acc_y = 0;
+        return;
+    }
+
+    // Integrate over the real interval; after a stall, cap it so the cursor doesn't jump.
+    uint64_t now = now_ns();
+    uint64_t dt  = last ? now - last : mouse_period_ns;
+    if (dt > 4 * mouse_period_ns) dt = 4 * mouse_period_ns;
+    last = now;
+
+    double gain = 1.0;
+    double mag2 = ((double)vx * vx + (double)vy * vy) / (32767.0 * 32767.0);
+    if (mag2 >= 0.95 * 0.95) {
+        if (!held_since) held_since = now;
+        double t = (double)(now - held_since) / (MOUSE_ACCEL_MS * 1e6);
+        gain = 1.0 + (mouse_accel - 1.0) * (t < 1.0 ? t : 1.0);
+    } else {
+        held_since = 0;
+    }
+
+    double scale = mouse_speed * gain * ((double)dt / 1e9) / 32767.0;
+    acc_x += vx * scale;
+    acc_y += vy * scale;
+
+    // Truncation keeps the remainder's sign, so reversing direction doesn't drift.
+    int dx = (int)acc_x;
+    int dy = (int)acc_y;
+    acc_x -= dx;
+    acc_y -= dy;
+    if (!dx && !dy) return;
+
+    struct input_event events[3];
+    int n = 0;
+    if (dx) EMIT(events, n, EV_REL, REL_X, dx);
+    if (dy) EMIT(events, n, EV_REL, REL_Y, dy);
+    EMIT(events, n, EV_SYN, SYN_REPORT, 0);
+    write(mouse_fd, events, sizeof(struct input_event) * n);
+}
+
+static void update_mouse_buttons(uint16_t buttons) {
+    static const uint16_t codes[3] = { BTN_LEFT, BTN_RIGHT, BTN_MIDDLE };
+    static uint8_t previous_pressed;
+    struct input_event events[4];
+    int n = 0;
+
+    uint8_t pressed = 0;
+    for (int i = 0; i < 3; i++)
+        if (mouse_button_bit[i] >= 0 && ((buttons >> mouse_button_bit[i]) & 1))
+            pressed |= (uint8_t)(1 << i);
+
+    uint8_t changed = pressed ^ previous_pressed;
+    for (int i = 0; i < 3; i++)
+        if (changed & (1 << i))
+            EMIT(events, n, EV_KEY, codes[i], (pressed >> i) & 1);
+    previous_pressed = pressed;
+
+    if (n > 0) {
+        EMIT(events, n, EV_SYN, SYN_REPORT, 0);
+        write(mouse_fd, events, sizeof(struct input_event) * n);
+    }
+}
+
 // ---- Event emission -----------------------------------------------------------
 
 static void update_gamepad_events(void) {
     struct input_event events[40];
     int n = 0;
 
+    // The stick pipeline reshapes the raw readings; previous holds what was sent.
+    ControllerState out = current;
+    if (stick_pipeline) {
+        stick_apply(&stick_lut[0], &out.joyLX, &out.joyLY);
+        stick_apply(&stick_lut[1], &out.joyRX, &out.joyRY);
+    }
+
     // Buttons: iterate over changed bits, look up PS3 target, emit.
     // If the bit maps to b6 (L2) or b7 (R2), also drive the trigger axis.
-    uint16_t changed = previous.buttons ^ current.buttons;
+    uint16_t changed = previous.buttons ^ out.buttons;
     for (int i = 0; i < 16; i++) {
         if (!(changed & (1 << i))) continue;
         int8_t btn = bit_to_ps3[i];
         if (btn < 0) continue;
 
-        int pressed = (current.buttons >> i) & 1;
+        int pressed = (out.buttons >> i) & 1;
         EMIT(events, n, EV_KEY, ps3_keycodes[btn], pressed);
 
         if (btn == 6) EMIT(events, n, EV_ABS, ABS_Z,  pressed ? 255 : 0);
         if (btn == 7) EMIT(events, n, EV_ABS, ABS_RZ, pressed ? 255 : 0);
     }
 
-    // Analog sticks: emit only on change.
-    if (joystick_count >= 1) {
-        if (previous.joyLX != current.joyLX)
-            EMIT(events, n, EV_ABS, ABS_X, current.joyLX);
-        if (previous.joyLY != current.joyLY)
-            EMIT(events, n, EV_ABS, ABS_Y, current.joyLY);
+    // Analog sticks: emit only on change. A stick driving the mouse stays centered.
+    if (joystick_count >= 1 && mouse_stick != 0) {
+        if (previous.joyLX != out.joyLX)
+            EMIT(events, n, EV_ABS, ABS_X, out.joyLX);
+        if (previous.joyLY != out.joyLY)
+            EMIT(events, n, EV_ABS, ABS_Y, out.joyLY);
     }
-    if (joystick_count >= 2) {
-        if (previous.joyRX != current.joyRX)
-            EMIT(events, n, EV_ABS, ABS_RX, current.joyRX);
-        if (previous.joyRY != current.joyRY)
-            EMIT(events, n, EV_ABS, ABS_RY, current.joyRY);
+    if (joystick_count >= 2 && mouse_stick != 1) {
+        if (previous.joyRX != out.joyRX)
+            EMIT(events, n, EV_ABS, ABS_RX, out.joyRX);
+        if (previous.joyRY != out.joyRY)
+            EMIT(events, n, EV_ABS, ABS_RY, out.joyRY);
     }
 
     if (n > 0) {
+        // MSC_TIMESTAMP is a free-running 32-bit microsecond count.
+        if (t_read_done)
+            EMIT(events, n, EV_MSC, MSC_TIMESTAMP, (int32_t)(uint32_t)(t_read_done / 1000));
         EMIT(events, n, EV_SYN, SYN_REPORT, 0);
         write(gamepad_fd, events, sizeof(struct input_event) * n);
+
+        if (t_read_done) {
+            uint64_t t_written = now_ns();
+            trace_stats.batches++;
+            lat_hist_record(&trace_stats.deliver, us_between(t_read_done, t_written));
+            lat_hist_record(&trace_stats.total, us_between(t_poll_start, t_written));
+        }
+    }
+
+    if (mouse_fd >= 0)
+        update_mouse_buttons(out.buttons);
+
+    t_read_done = 0;
+    previous = out;
+}
+
+// ---- Poll timer ---------------------------------------------------------------
+//
+// The loop waits on a timerfd armed with absolute CLOCK_MONOTONIC deadlines
+// (start + k * period), so the I2C read time and wakeup latency never push
+// later polls back. When a cycle overruns, the timer reports the deadlines
+// that passed and the loop skips them rather than bursting to catch up.
+//
+// With --idle-hz the rate adapts: any input change switches to the active
+// rate (--rate-hz) at once, and after --idle-after-ms without a change the
+// loop drops to the idle rate. Small stick movements up to --idle-threshold
+// are treated as noise so a resting stick does not keep the loop awake.
+
+typedef enum { MODE_ACTIVE, MODE_IDLE, MODE_COUNT } PollMode;
+
+static const char *mode_names[MODE_COUNT] = { "active", "idle" };
+
+typedef struct {
+    uint64_t   cycles;
+    uint64_t   missed;      // deadlines skipped because a cycle overran
+    uint64_t   switches;    // active <-> idle transitions
+    uint64_t   mode_ns[MODE_COUNT];
+    lat_hist_t period[MODE_COUNT];  // wakeup to wakeup, us
+    lat_hist_t lateness;            // deadline to wakeup, us
+    lat_hist_t vblank_age;          // --vblank: newest frame's read to the vblank, us
+    uint64_t   vblank_refused;      // --vblank: event requests refused, e.g. CRTC off
+} PollStats;
+
+static PollStats poll_stats;
+
+static PollMode        mode = MODE_ACTIVE;
+static uint64_t        mode_since;
+static uint64_t        last_activity;
+static uint64_t        last_wake;
+static uint64_t        next_deadline;
+static uint64_t        last_frame_ns;
+static ControllerState activity_ref;
+
+static uint64_t mode_period_ns(PollMode m) {
+    return m == MODE_IDLE ? idle_period_ns : active_period_ns;
+}
+
+// Restarts the deadline sequence at first, then every period of the current mode.
+static void arm_timer(uint64_t first) {
+    uint64_t period = mode_period_ns(mode);
+
+    next_deadline = first;
+    last_wake     = 0;  // the next interval spans two rates, keep it out of the histogram
+
+    struct itimerspec its = {
+        .it_interval = ns_to_timespec(period),
+        .it_value    = ns_to_timespec(next_deadline),
+    };
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("Failed to arm poll timer");
+        cleanup();
+        exit(1);
     }
+}
 
-    previous = current;
+static void init_timer(void) {
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        perror("Failed to create poll timer");
+        cleanup();
+        exit(1);
+    }
+
+    uint64_t now = now_ns();
+    mode_since    = now;
+    last_activity = now;
+    activity_ref  = current;
+    arm_timer(now + mode_period_ns(mode));
+
+    printf("Polling at %.1f Hz (period %llu us)\n",
+           1e9 / (double)active_period_ns, (unsigned long long)(active_period_ns / 1000));
+    if (idle_period_ns)
+        printf("Idle polling at %.1f Hz after %llu ms without input\n",
+               1e9 / (double)idle_period_ns, (unsigned long long)(idle_after_ns / 1000000));
+}
+
+static void set_mode(PollMode m, uint64_t now) {
+    if (m == mode)
+        return;
+    poll_stats.mode_ns[mode] += now - mode_since;
+    poll_stats.switches++;
+    mode       = m;
+    mode_since = now;
+    arm_timer(now + mode_period_ns(mode));
+}
+
+// Consumes a poll timer expiration. Returns false if there was none.
+static bool wait_tick(void) {
+    uint64_t expirations;
+
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        if (errno != EINTR && errno != EAGAIN) {
+            perror("Poll timer read failed");
+            running = 0;
+        }
+        return false;
+    }
+
+    uint64_t now    = now_ns();
+    uint64_t period = mode_period_ns(mode);
+
+    // Every expiration after the first is a deadline this cycle ran past.
+    next_deadline += (expirations - 1) * period;
+    poll_stats.missed += expirations - 1;
+    poll_stats.cycles++;
+
+    lat_hist_record(&poll_stats.lateness,
+                    now > next_deadline ? (uint32_t)((now - next_deadline) / 1000) : 0);
+    if (last_wake)
+        lat_hist_record(&poll_stats.period[mode], (uint32_t)((now - last_wake) / 1000));
+
+    last_wake      = now;
+    next_deadline += period;
+    return true;
+}
+
+static bool axis_moved(uint8_t a, uint8_t b) {
+    return abs((int)a - (int)b) > idle_threshold;
+}
+
+// Called after each good read: picks the poll rate from recent input activity.
+static void update_poll_mode(void) {
+    if (!idle_period_ns)
+        return;
+
+    uint64_t now = now_ns();
+    bool active = current.buttons != activity_ref.buttons ||
+                  axis_moved(current.joyLX, activity_ref.joyLX) ||
+                  axis_moved(current.joyLY, activity_ref.joyLY) ||
+                  axis_moved(current.joyRX, activity_ref.joyRX) ||
+                  axis_moved(current.joyRY, activity_ref.joyRY);
+
+    if (active) {
+        activity_ref  = current;
+        last_activity = now;
+        set_mode(MODE_ACTIVE, now);
+    } else if (mode == MODE_ACTIVE && now - last_activity >= idle_after_ns) {
+        set_mode(MODE_IDLE, now);
+    }
+}
+
+static void print_poll_stats(void) {
+    uint64_t now = now_ns();
+
+    fprintf(stderr, "Polling: target %.1f Hz (%llu us), %llu cycles, %llu missed deadlines\n",
+            1e9 / (double)active_period_ns, (unsigned long long)(active_period_ns / 1000),
+            (unsigned long long)poll_stats.cycles, (unsigned long long)poll_stats.missed);
+    if (realtime) {
+        fprintf(stderr, "  ");
+        realtime_report(stderr);
+    }
+    if (vblank.fd >= 0) {
+        fprintf(stderr, "  Vblank: %s on %s, %.2f Hz, read %llu us before each, %llu events, "
+                "%llu late, %llu refused\n", vblank.connector, vblank.card, 1e9 / (double)vblank.period_ns,
+                (unsigned long long)(vblank_offset_ns / 1000), (unsigned long long)vblank.events,
+                (unsigned long long)vblank.skipped, (unsigned long long)poll_stats.vblank_refused);
+        lat_hist_print(stderr, "sample age", &poll_stats.vblank_age, "us");
+    }
+
+    if (!idle_period_ns) {
+        lat_hist_print(stderr, "period", &poll_stats.period[MODE_ACTIVE], "us");
+        lat_hist_print(stderr, "wakeup lateness", &poll_stats.lateness, "us");
+        fprintf(stderr, "  period distribution:\n");
+        lat_hist_print_distribution(stderr, &poll_stats.period[MODE_ACTIVE], "us", 16);
+        return;
+    }
+
+    uint64_t total = 0, spent[MODE_COUNT];
+    for (int m = 0; m < MODE_COUNT; m++) {
+        spent[m] = poll_stats.mode_ns[m] + (m == (int)mode ? now - mode_since : 0);
+        total   += spent[m];
+    }
+    fprintf(stderr, "  %llu mode switches, now %s\n",
+            (unsigned long long)poll_stats.switches, mode_names[mode]);
+    for (int m = 0; m < MODE_COUNT; m++) {
+        char label[32];
+        fprintf(stderr, "  %-6s %7.1f Hz  %10.1f s  %5.1f%%\n", mode_names[m],
+                1e9 / (double)mode_period_ns((PollMode)m), (double)spent[m] / 1e9,
+                total ? 100.0 * (double)spent[m] / (double)total : 0.0);
+        snprintf(label, sizeof(label), "period (%s)", mode_names[m]);
+        lat_hist_print(stderr, label, &poll_stats.period[m], "us");
+    }
+    lat_hist_print(stderr, "wakeup lateness", &poll_stats.lateness, "us");
+    fprintf(stderr, "  active period distribution:\n");
+    lat_hist_print_distribution(stderr, &poll_stats.period[MODE_ACTIVE], "us", 16);
+}
+
+// ---- Link recovery ------------------------------------------------------------
+//
+// A failed read is retried at once up to --retries times, since a CRC error is
+// usually one corrupted transfer. If the poll still fails, the loop backs off,
+// doubling the pause from BACKOFF_MIN_MS to BACKOFF_MAX_MS. A CRC storm or a
+// missing device then costs a few transfers per second, not a busy loop.
+//
+// After LOST_AFTER_MS without a good frame the controller counts as gone. All
+// inputs are released and the link is closed. Every --reprobe-ms the loop
+// reopens and probes it until the ATmega answers again, for example after the
+// reboot at the end of a firmware update. The uinput device stays up the whole
+// time, so games keep their controller handle.
+
+typedef enum { LINK_UP, LINK_BACKOFF, LINK_DOWN } LinkState;
+
+static const char *link_state_names[] = { "up", "backoff", "down" };
+
+typedef struct {
+    uint64_t frames;
+    uint64_t crc_errors;
+    uint64_t io_errors;
+    uint64_t retries;       // extra reads within one poll
+    uint64_t backoffs;
+    uint64_t disconnects;
+    uint64_t reconnects;
+    uint64_t probes;
+    uint64_t down_ns;
+} LinkStats;
+
+static LinkStats link_stats;
+static LinkState link_state = LINK_UP;
+static uint64_t  fail_since;
+static uint64_t  down_since;
+static uint64_t  backoff_ns;
+
+static int read_with_retries(void) {
+    int status = TOPPER_ERR_IO;
+
+    if (trace)
+        t_poll_start = now_ns();
+    for (int attempt = 0; attempt <= read_retries; attempt++) {
+        if (attempt) link_stats.retries++;
+        status = read_i2c_data();
+        if (status == TOPPER_OK) {
+            link_stats.frames++;
+            break;
+        }
+        if (status == TOPPER_ERR_CRC)
+            link_stats.crc_errors++;
+        else
+            link_stats.io_errors++;
+    }
+    return status;
+}
+
+// Reopens the link when it was closed, so a restarted topperd is picked up too.
+static int reprobe(void) {
+    link_stats.probes++;
+    if (!topper) {
+        topper = topper_link_open(bus_spec, bus_spec != NULL);
+        if (!topper) return TOPPER_ERR_IO;
+    }
+    int status = read_with_retries();
+    if (status == TOPPER_ERR_IO) {
+        topper_link_close(topper);
+        topper = NULL;
+    }
+    return status;
+}
+
+static void release_inputs(void) {
+    current.buttons = 0;
+    current.joyLX   = (uint8_t)axis_center_lx;
+    current.joyLY   = (uint8_t)axis_center_ly;
+    current.joyRX   = (uint8_t)axis_center_rx;
+    current.joyRY   = (uint8_t)axis_center_ry;
+    update_gamepad_events();
+}
+
+static void link_recovered(uint64_t now) {
+    if (link_state == LINK_DOWN) {
+        link_stats.reconnects++;
+        link_stats.down_ns += now - down_since;
+        fprintf(stderr, "Controller reattached after %.1f s%s\n", (double)(now - down_since) / 1e9,
+                topper_link_is_daemon(topper) ? " (via topperd)" : "");
+    }
+    link_state    = LINK_UP;
+    last_activity = now;
+    activity_ref  = current;
+    set_mode(MODE_ACTIVE, now);
+    arm_timer(now + mode_period_ns(mode));
+}
+
+static void link_failed(int status, uint64_t now) {
+    if (link_state == LINK_UP) {
+        fail_since = now;
+        backoff_ns = BACKOFF_MIN_MS * 1000000ULL;
+    } else if (link_state == LINK_BACKOFF && backoff_ns < BACKOFF_MAX_MS * 1000000ULL) {
+        backoff_ns *= 2;
+        if (backoff_ns > BACKOFF_MAX_MS * 1000000ULL)
+            backoff_ns = BACKOFF_MAX_MS * 1000000ULL;
+    }
+
+    if (link_state != LINK_DOWN && now - fail_since >= LOST_AFTER_MS * 1000000ULL) {
+        link_state = LINK_DOWN;
+        down_since = now;
+        link_stats.disconnects++;
+        fprintf(stderr, "Controller lost (%s), releasing inputs and re-probing every %llu ms\n",
+                status == TOPPER_ERR_CRC ? "CRC errors" : "no response",
+                (unsigned long long)(reprobe_ns / 1000000));
+        release_inputs();
+        topper_link_close(topper);
+        topper = NULL;
+    }
+
+    if (link_state == LINK_DOWN) {
+        arm_timer(now + reprobe_ns);
+    } else {
+        link_state = LINK_BACKOFF;
+        link_stats.backoffs++;
+        arm_timer(now + backoff_ns);
+    }
+}
+
+static void poll_controller(void) {
+    int status = link_state == LINK_DOWN ? reprobe() : read_with_retries();
+    uint64_t now = now_ns();
+
+    if (status != TOPPER_OK) {
+        link_failed(status, now);
+        return;
+    }
+    if (link_state != LINK_UP)
+        link_recovered(now);
+    last_frame_ns = now;
+    update_gamepad_events();
+    update_poll_mode();
+    mouse_wake();
+}
+
+// ---- Vblank sync --------------------------------------------------------------
+//
+// With --vblank the active rate follows the display. Each vblank event from the
+// DPI CRTC moves the next poll to --vblank-offset-us before the vblank after it,
+// so every frame starts with a sample of the same age rather than one anywhere
+// up to a poll period old. Between events the poll timer keeps running at the
+// frame period: a late or missing event costs the alignment, never a poll.
+// While idle, backing off or lost, no events are queued and the timer alone
+// sets the pace.
+
+static bool vblank_stalled = false;
+
+static void init_vblank(void) {
+    if (!vblank_sync)
+        return;
+    if (vblank_open(&vblank, vblank_card) < 0) {
+        fprintf(stderr, "Warning: no display to follow, polling at %.1f Hz instead\n",
+                1e9 / (double)active_period_ns);
+    } else if (vblank_offset_ns >= vblank.period_ns) {
+        fprintf(stderr, "Error: --vblank-offset-us must be below the frame period (%llu us)\n",
+                (unsigned long long)(vblank.period_ns / 1000));
+        cleanup();
+        exit(1);
+    } else {
+        active_period_ns = vblank.period_ns;
+        printf("Following vblank of %s on %s (CRTC %u), reading %llu us before each\n",
+               vblank.connector, vblank.card, vblank.crtc_id, (unsigned long long)(vblank_offset_ns / 1000));
+    }
+    if (idle_period_ns && idle_period_ns <= active_period_ns) {
+        fprintf(stderr, "Error: --idle-hz must be lower than the display rate (%.2f Hz)\n",
+                1e9 / (double)active_period_ns);
+        cleanup();
+        exit(1);
+    }
+}
+
+// Queues the event for the next vblank, once per frame while polling actively.
+static void queue_vblank(void) {
+    if (vblank.fd < 0 || vblank.pending || mode != MODE_ACTIVE || link_state != LINK_UP)
+        return;
+    if (vblank_request(&vblank) == 0) {
+        if (vblank_stalled)
+            fprintf(stderr, "Vblank events from %s resumed\n", vblank.connector);
+        vblank_stalled = false;
+        return;
+    }
+    poll_stats.vblank_refused++;
+    if (!vblank_stalled)
+        fprintf(stderr, "Warning: no vblank events from %s (%s), polling on the timer until they resume\n",
+                vblank.connector, strerror(errno));
+    vblank_stalled = true;
+}
+
+// Moves the deadlines so the next poll falls the offset before the vblank
+// after vblank_ns, without restarting the period statistics.
+static void align_timer(uint64_t vblank_ns) {
+    uint64_t now      = now_ns();
+    uint64_t period   = active_period_ns;
+    uint64_t deadline = vblank_ns + period - vblank_offset_ns;
+
+    while (deadline <= now)
+        deadline += period;
+    next_deadline = deadline;
+
+    struct itimerspec its = {
+        .it_interval = ns_to_timespec(period),
+        .it_value    = ns_to_timespec(deadline),
+    };
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("Failed to align poll timer");
+        running = 0;
+    }
+}
+
+static void on_vblank(void) {
+    if (vblank_read(&vblank) <= 0 || mode != MODE_ACTIVE || link_state != LINK_UP)
+        return;
+    // Only polls that were already aligned to the previous vblank count
+    if (vblank.chained && last_frame_ns && last_frame_ns < vblank.last_ns)
+        lat_hist_record(&poll_stats.vblank_age, us_between(last_frame_ns, vblank.last_ns));
+    active_period_ns = vblank.period_ns;
+    align_timer(vblank.last_ns);
+    queue_vblank();
+}
+
+static void print_link_stats(void) {
+    uint64_t down = link_stats.down_ns + (link_state == LINK_DOWN ? now_ns() - down_since : 0);
+
+    fprintf(stderr, "Link: %s, %llu frames, %llu CRC errors, %llu I/O errors, %llu retries, %llu backoffs\n",
+            link_state_names[link_state], (unsigned long long)link_stats.frames,
+            (unsigned long long)link_stats.crc_errors, (unsigned long long)link_stats.io_errors,
+            (unsigned long long)link_stats.retries, (unsigned long long)link_stats.backoffs);
+    fprintf(stderr, "  %llu disconnects, %llu reconnects, %llu probes, %.1f s down\n",
+            (unsigned long long)link_stats.disconnects, (unsigned long long)link_stats.reconnects,
+            (unsigned long long)link_stats.probes, (double)down / 1e9);
+}
+
+static void on_signal(int sig) {
+    if (sig == SIGUSR1)
+        dump_stats = 1;
+    else
+        running = 0;
+}
+
+static void install_signals(void) {
+    // No SA_RESTART: the blocking poll() must return so the loop can exit.
+    struct sigaction sa = {0};
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
 }
 
 // ---- Autocenter ---------------------------------------------------------------
@@ -365,11 +1091,117 @@ static void sample_axis_centers(void) {
            axis_center_lx, axis_center_ly, axis_center_rx, axis_center_ry);
 }
 
+// ---- Stick pipeline -----------------------------------------------------------
+
+static AxisCalibration axis_calibration(int axis, int center) {
+    AxisCalibration cal = {
+        (uint8_t)(axis_cal[axis][0] >= 0 ? axis_cal[axis][0] : axis_min),
+        (uint8_t)(axis_cal[axis][1] >= 0 ? axis_cal[axis][1] : center),
+        (uint8_t)(axis_cal[axis][2] >= 0 ? axis_cal[axis][2] : axis_max),
+    };
+    return cal;
+}
+
+// Runs after autocenter so sampled centers feed the calibration tables.
+static void init_sticks(void) {
+    int centers[4] = { axis_center_lx, axis_center_ly, axis_center_rx, axis_center_ry };
+
+    if (mouse_stick >= 0) {
+        AxisCalibration cal[2] = {
+            axis_calibration(2 * mouse_stick,     centers[2 * mouse_stick]),
+            axis_calibration(2 * mouse_stick + 1, centers[2 * mouse_stick + 1]),
+        };
+        stick_build(&mouse_lut, &mouse_profile, cal);
+    }
+
+    if (!stick_pipeline) return;
+
+    for (int s = 0; s < 2; s++) {
+        StickProfile *p = &stick_profile[s];
+        if (stick_deadzone     >= 0) p->deadzone     = stick_deadzone;
+        if (stick_antideadzone >= 0) p->antideadzone = stick_antideadzone;
+        if (stick_saturation   >= 0) p->saturation   = stick_saturation;
+        if (stick_curve && !stick_parse_curve(stick_curve, p)) {
+            fprintf(stderr, "Error: unknown --stick-curve '%s'\n", stick_curve);
+            exit(1);
+        }
+        if (p->saturation <= p->deadzone) {
+            fprintf(stderr, "Error: stick saturation must be above the deadzone\n");
+            exit(1);
+        }
+
+        AxisCalibration cal[2] = {
+            axis_calibration(2 * s,     centers[2 * s]),
+            axis_calibration(2 * s + 1, centers[2 * s + 1]),
+        };
+        stick_build(&stick_lut[s], p, cal);
+
+        printf("%s stick: profile %s, deadzone %.0f%%, anti-deadzone %.0f%%, saturation %.0f%%, "
+               "%s curve, %s: %d/%d/%d, %s: %d/%d/%d\n",
+               s ? "Right" : "Left", p->name, p->deadzone * 100, p->antideadzone * 100,
+               p->saturation * 100, stick_curve_name(p->curve),
+               axis_names[2 * s],     cal[0].min, cal[0].center, cal[0].max,
+               axis_names[2 * s + 1], cal[1].min, cal[1].center, cal[1].max);
+    }
+}
+
+// "<name>" for both sticks or "<left>,<right>"
+static void parse_stick_profiles(const char *arg) {
+    char left[32], *right;
+
+    snprintf(left, sizeof(left), "%s", arg);
+    right = strchr(left, ',');
+    if (right) *right++ = '\0';
+
+    if (!stick_profile_find(left, &stick_profile[0]) ||
+        !stick_profile_find(right ? right : left, &stick_profile[1])) {
+        fprintf(stderr, "Error: unknown stick profile in '%s'. Profiles:\n", arg);
+        stick_profile_list();
+        exit(1);
+    }
+}
+
+// "<axis>=<min>:<center>:<max>", e.g. lx=30:125:220
+static void parse_axis_cal(const char *arg) {
+    int axis, v[3];
+    char name[4];
+
+    if (sscanf(arg, "%2[a-z]=%d:%d:%d", name, &v[0], &v[1], &v[2]) != 4) {
+        fprintf(stderr, "Error: --axis-cal expects <axis>=<min>:<center>:<max>, e.g. lx=30:125:220\n");
+        exit(1);
+    }
+    for (axis = 0; axis < 4 && strcmp(name, axis_names[axis]) != 0; axis++)
+        ;
+    if (axis == 4) {
+        fprintf(stderr, "Error: --axis-cal axis must be lx, ly, rx or ry\n");
+        exit(1);
+    }
+    if (v[0] < 0 || v[2] > 255 || !(v[0] < v[1] && v[1] < v[2])) {
+        fprintf(stderr, "Error: --axis-cal needs 0 <= min < center < max <= 255\n");
+        exit(1);
+    }
+    for (int i = 0; i < 3; i++)
+        axis_cal[axis][i] = v[i];
+}
+
+static float parse_percent(const char *opt, const char *arg, int lo, int hi) {
+    int val = atoi(arg);
+    if (val < lo || val > hi) {
+        fprintf(stderr, "Error: %s must be %d-%d\n", opt, lo, hi);
+        exit(1);
+    }
+    return (float)val / 100.0f;
+}
+
 // ---- Argument parsing ---------------------------------------------------------
 
 static void parse_args(int argc, char *argv[]) {
     bool map_provided = false;
 
+    stick_profile_find("linear", &stick_profile[0]);
+    stick_profile_find("linear", &stick_profile[1]);
+    stick_profile_find("pointer", &mouse_profile);
+
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
             puts(
@@ -402,6 +1234,47 @@ static void parse_args(int argc, char *argv[]) {
 "  --max <0-255>          Stick axis maximum value (default: 215)\n"
 "  --deadzone <0-100>     Stick axis deadzone flat value (default: 20)\n"
 "  --autocenter           Sample stick positions at startup as center point\n"
+"  --bus <spec>           Open this bus instead of going through topperd:\n"
+"                         /dev/i2c-N, N, stub:N, sim:atmega[:opt...] or replay:<file>\n"
+"\n"
+"  Stick pipeline (replaces the kernel's per-axis flat with a radial deadzone):\n"
+"  --stick-profile <p>    Profile for both sticks, or <left>,<right>\n"
+"                         (linear, precise, expo, responsive, pointer)\n"
+"  --stick-deadzone <0-50>      Radial deadzone, percent of full deflection\n"
+"  --stick-antideadzone <0-50>  Output jump just outside the deadzone, percent\n"
+"  --stick-saturation <50-100>  Deflection that already gives full output, percent\n"
+"  --stick-curve <c>      linear, quadratic, cubic or expo[=<0-1>]\n"
+"  --axis-cal <a>=<min>:<center>:<max>\n"
+"                         Calibrate one axis (lx, ly, rx, ry), e.g. lx=30:125:220\n"
+"\n"
+"  Mouse emulation (a second virtual device, a pointer):\n"
+"  --mouse <left|right>   Stick that moves the pointer; it leaves the gamepad\n"
+"  --mouse-buttons <l>[,<r>[,<m>]]\n"
+"                         Input bits (0-15) for the left, right and middle buttons\n"
+"  --mouse-speed <px/s>   Pointer speed at full deflection (default: 1000)\n"
+"  --mouse-accel <1-8>    Speed multiplier after holding full deflection (default: 2)\n"
+"  --mouse-hz <50-1000>   Pointer update rate (default: 250)\n"
+"  --mouse-profile <p>    Stick profile for the pointer (default: pointer)\n"
+"\n"
+"  --rate-hz <1-1000>     Polling rate (default: 62.5, a 16 ms period)\n"
+"                         A jitter report is printed on exit and on SIGUSR1.\n"
+"  --vblank               Poll once per display frame, just before its vblank,\n"
+"                         instead of at --rate-hz (DRM, DPI output preferred)\n"
+"  --vblank-card <path>   DRM card to follow (default: first with a DPI output)\n"
+"  --vblank-offset-us <n> Read this long before each vblank (default: 2000)\n"
+"  --idle-hz <1-1000>     Drop to this rate while inputs are quiet (default: off)\n"
+"  --idle-after-ms <ms>   Quiet time before dropping to the idle rate (default: 2000)\n"
+"  --idle-threshold <n>   Stick movement treated as noise while idle (default: 4)\n"
+"  --retries <0-10>       Immediate re-reads after a failed poll (default: 2)\n"
+"  --reprobe-ms <ms>      Probe interval while the controller is lost (default: 1000)\n"
+"  --stats <seconds>      Print poll and link statistics periodically (default: off)\n"
+"                         They are also printed on exit and on SIGUSR1.\n"
+"  --trace                Time each read and uinput write, add MSC_TIMESTAMP to\n"
+"                         events and report latency histograms with the stats\n"
+"  --realtime             Run as SCHED_FIFO with memory locked (needs root or\n"
+"                         CAP_SYS_NICE and CAP_IPC_LOCK)\n"
+"  --rt-priority <1-99>   SCHED_FIFO priority for --realtime (default: 50)\n"
+"  --cpu <n>              With --realtime, pin the driver to CPU n\n"
 "  --help, -h             Show this help and exit"
             );
             exit(0);
@@ -418,6 +1291,44 @@ static void parse_args(int argc, char *argv[]) {
             autocenter = true;
             printf("Autocenter enabled\n");
 
+        } else if (strcmp(argv[i], "--bus") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --bus requires a value\n");
+                exit(1);
+            }
+            bus_spec = argv[++i];
+
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace = true;
+            printf("Latency tracing enabled\n");
+
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+
+        } else if (strcmp(argv[i], "--rt-priority") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --rt-priority requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 1 || val > 99) {
+                fprintf(stderr, "Error: --rt-priority must be 1-99\n");
+                exit(1);
+            }
+            rt_config.priority = val;
+
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --cpu requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 0 || val > 1023) {
+                fprintf(stderr, "Error: --cpu must be 0-1023\n");
+                exit(1);
+            }
+            rt_config.cpu = val;
+
         } else if (strcmp(argv[i], "--joysticks") == 0) {
             if (i + 1 >= argc) {
                 fprintf(stderr, "Error: --joysticks requires a value\n");
@@ -470,6 +1381,241 @@ static void parse_args(int argc, char *argv[]) {
             axis_flat = val;
             printf("Deadzone: %d\n", axis_flat);
 
+        } else if (strcmp(argv[i], "--stick-profile") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stick-profile requires a value\n");
+                exit(1);
+            }
+            parse_stick_profiles(argv[++i]);
+            stick_pipeline = true;
+
+        } else if (strcmp(argv[i], "--stick-deadzone") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stick-deadzone requires a value\n");
+                exit(1);
+            }
+            stick_deadzone = parse_percent("--stick-deadzone", argv[++i], 0, 50);
+            stick_pipeline = true;
+
+        } else if (strcmp(argv[i], "--stick-antideadzone") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stick-antideadzone requires a value\n");
+                exit(1);
+            }
+            stick_antideadzone = parse_percent("--stick-antideadzone", argv[++i], 0, 50);
+            stick_pipeline = true;
+
+        } else if (strcmp(argv[i], "--stick-saturation") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stick-saturation requires a value\n");
+                exit(1);
+            }
+            stick_saturation = parse_percent("--stick-saturation", argv[++i], 50, 100);
+            stick_pipeline = true;
+
+        } else if (strcmp(argv[i], "--stick-curve") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stick-curve requires a value\n");
+                exit(1);
+            }
+            stick_curve = argv[++i];
+            stick_pipeline = true;
+
+        } else if (strcmp(argv[i], "--axis-cal") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --axis-cal requires a value\n");
+                exit(1);
+            }
+            parse_axis_cal(argv[++i]);
+            stick_pipeline = true;
+
+        } else if (strcmp(argv[i], "--mouse") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --mouse requires a value\n");
+                exit(1);
+            }
+            i++;
+            if (strcmp(argv[i], "left") == 0) {
+                mouse_stick = 0;
+            } else if (strcmp(argv[i], "right") == 0) {
+                mouse_stick = 1;
+            } else {
+                fprintf(stderr, "Error: --mouse must be left or right\n");
+                exit(1);
+            }
+
+        } else if (strcmp(argv[i], "--mouse-buttons") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --mouse-buttons requires a value\n");
+                exit(1);
+            }
+            char *p = argv[++i];
+            for (int b = 0; b < 3 && *p; b++) {
+                char *end;
+                long bit = strtol(p, &end, 10);
+                if (end == p || bit < 0 || bit > 15 || (*end && *end != ',')) {
+                    fprintf(stderr, "Error: --mouse-buttons takes up to three input bits 0-15, e.g. 4,5\n");
+                    exit(1);
+                }
+                mouse_button_bit[b] = (int8_t)bit;
+                p = *end ? end + 1 : end;
+            }
+
+        } else if (strcmp(argv[i], "--mouse-speed") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --mouse-speed requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 10 || val > 20000) {
+                fprintf(stderr, "Error: --mouse-speed must be 10-20000\n");
+                exit(1);
+            }
+            mouse_speed = val;
+
+        } else if (strcmp(argv[i], "--mouse-accel") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --mouse-accel requires a value\n");
+                exit(1);
+            }
+            double val = atof(argv[++i]);
+            if (val < 1.0 || val > 8.0) {
+                fprintf(stderr, "Error: --mouse-accel must be 1-8\n");
+                exit(1);
+            }
+            mouse_accel = val;
+
+        } else if (strcmp(argv[i], "--mouse-hz") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --mouse-hz requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 50 || val > 1000) {
+                fprintf(stderr, "Error: --mouse-hz must be 50-1000\n");
+                exit(1);
+            }
+            mouse_period_ns = 1000000000ULL / (uint64_t)val;
+
+        } else if (strcmp(argv[i], "--mouse-profile") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --mouse-profile requires a value\n");
+                exit(1);
+            }
+            if (!stick_profile_find(argv[++i], &mouse_profile)) {
+                fprintf(stderr, "Error: unknown stick profile '%s'. Profiles:\n", argv[i]);
+                stick_profile_list();
+                exit(1);
+            }
+
+        } else if (strcmp(argv[i], "--rate-hz") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --rate-hz requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < RATE_HZ_MIN || val > RATE_HZ_MAX) {
+                fprintf(stderr, "Error: --rate-hz must be %d-%d\n", RATE_HZ_MIN, RATE_HZ_MAX);
+                exit(1);
+            }
+            active_period_ns = 1000000000ULL / (uint64_t)val;
+            rate_given       = true;
+
+        } else if (strcmp(argv[i], "--vblank") == 0) {
+            vblank_sync = true;
+
+        } else if (strcmp(argv[i], "--vblank-card") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --vblank-card requires a value\n");
+                exit(1);
+            }
+            vblank_card = argv[++i];
+            vblank_sync = true;
+
+        } else if (strcmp(argv[i], "--vblank-offset-us") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --vblank-offset-us requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 0 || val > 100000) {
+                fprintf(stderr, "Error: --vblank-offset-us must be 0-100000\n");
+                exit(1);
+            }
+            vblank_offset_ns = (uint64_t)val * 1000ULL;
+
+        } else if (strcmp(argv[i], "--idle-hz") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --idle-hz requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < RATE_HZ_MIN || val > RATE_HZ_MAX) {
+                fprintf(stderr, "Error: --idle-hz must be %d-%d\n", RATE_HZ_MIN, RATE_HZ_MAX);
+                exit(1);
+            }
+            idle_period_ns = 1000000000ULL / (uint64_t)val;
+
+        } else if (strcmp(argv[i], "--idle-after-ms") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --idle-after-ms requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 1 || val > 3600000) {
+                fprintf(stderr, "Error: --idle-after-ms must be 1-3600000\n");
+                exit(1);
+            }
+            idle_after_ns = (uint64_t)val * 1000000ULL;
+
+        } else if (strcmp(argv[i], "--idle-threshold") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --idle-threshold requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 0 || val > 255) {
+                fprintf(stderr, "Error: --idle-threshold must be 0-255\n");
+                exit(1);
+            }
+            idle_threshold = val;
+
+        } else if (strcmp(argv[i], "--retries") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --retries requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 0 || val > 10) {
+                fprintf(stderr, "Error: --retries must be 0-10\n");
+                exit(1);
+            }
+            read_retries = val;
+
+        } else if (strcmp(argv[i], "--reprobe-ms") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --reprobe-ms requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 10 || val > 60000) {
+                fprintf(stderr, "Error: --reprobe-ms must be 10-60000\n");
+                exit(1);
+            }
+            reprobe_ns = (uint64_t)val * 1000000ULL;
+
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: --stats requires a value\n");
+                exit(1);
+            }
+            int val = atoi(argv[++i]);
+            if (val < 1 || val > 86400) {
+                fprintf(stderr, "Error: --stats must be 1-86400 seconds\n");
+                exit(1);
+            }
+            stats_interval_ns = (uint64_t)val * 1000000000ULL;
+
         } else {
             fprintf(stderr, "Error: unknown argument '%s'\n", argv[i]);
             fprintf(stderr, "Run with --help for usage\n");
@@ -485,6 +1631,22 @@ static void parse_args(int argc, char *argv[]) {
             "  Use the mapper utility to generate a string interactively.\n");
         exit(1);
     }
+
+    if (mouse_stick >= 0 && mouse_stick >= joystick_count) {
+        fprintf(stderr, "Error: --mouse %s needs --joysticks %d or more\n",
+                mouse_stick ? "right" : "left", mouse_stick + 1);
+        exit(1);
+    }
+
+    if (vblank_sync && rate_given) {
+        fprintf(stderr, "Error: --vblank takes the poll rate from the display, drop --rate-hz\n");
+        exit(1);
+    }
+
+    if (idle_period_ns && !vblank_sync && idle_period_ns <= active_period_ns) {
+        fprintf(stderr, "Error: --idle-hz must be lower than --rate-hz\n");
+        exit(1);
+    }
 }
 
 // ---- Main ---------------------------------------------------------------------
@@ -493,20 +1655,65 @@ int main(int argc, char *argv[]) {
     parse_args(argc, argv);
     print_mapping();
 
-    init_crc16_table();
     init_i2c();
 
     if (autocenter)
         sample_axis_centers();
 
+    init_sticks();
     init_gamepad();
+    init_mouse();
+    install_signals();
+    init_vblank();
+    init_timer();
+
+    // Last, so every start-up allocation is already locked in.
+    if (realtime) {
+        if (realtime_enter(&rt_config) == 0)
+            printf("Real-time mode: SCHED_FIFO priority %d\n", rt_config.priority);
+        else
+            fprintf(stderr, "Warning: continuing without full real-time mode\n");
+    }
 
-    while (1) {
-        if (!read_i2c_data()) continue;
-        update_gamepad_events();
-        usleep(POLLING_DELAY_US);
+    uint64_t next_stats = stats_interval_ns ? now_ns() + stats_interval_ns : 0;
+
+    while (running) {
+        // poll() skips the entries whose fd is -1
+        struct pollfd fds[3] = {
+            { .fd = timer_fd,       .events = POLLIN },
+            { .fd = mouse_timer_fd, .events = POLLIN },
+            { .fd = vblank.fd,      .events = POLLIN },
+        };
+        if (poll(fds, 3, -1) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+                break;
+            }
+        } else {
+            if (mouse_timer_fd >= 0 && (fds[1].revents & POLLIN))
+                mouse_tick();
+            if ((fds[0].revents & POLLIN) && wait_tick()) {
+                poll_controller();
+                queue_vblank();
+            }
+            if (fds[2].revents & POLLIN)
+                on_vblank();
+        }
+        if (next_stats && now_ns() >= next_stats) {
+            next_stats += stats_interval_ns;
+            dump_stats  = 1;
+        }
+        if (dump_stats) {
+            dump_stats = 0;
+            print_poll_stats();
+            print_link_stats();
+            if (trace) print_trace_stats();
+        }
     }
 
+    print_poll_stats();
+    print_link_stats();
+    if (trace) print_trace_stats();
     cleanup();
     return 0;
 }
@@ -2,68 +2,39 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <termios.h>
 #include <signal.h>
 
-#define I2C_DEVICE_ADDRESS  0x30
-#define DATASIZE               9
-#define POLL_US             8000   // 8 ms between I2C reads
-
-// ---- CRC-16-CCITT -------------------------------------------------------------
-
-static uint16_t crc16_table[256];
-
-static void init_crc16_table(void) {
-    const uint16_t poly = 0x1021;
-    for (uint16_t i = 0; i < 256; i++) {
-        uint16_t crc = i << 8;
-        for (uint8_t j = 0; j < 8; j++)
-            crc = (crc & 0x8000) ? (crc << 1) ^ poly : crc << 1;
-        crc16_table[i] = crc;
-    }
-}
+#include "topper_protocol.h"
+#include "topper_link.h"
 
-static uint16_t compute_crc16(const uint8_t *data, uint8_t len) {
-    uint16_t crc = 0xFFFF;
-    for (uint8_t i = 0; i < len; i++)
-        crc = (crc << 8) ^ crc16_table[((crc >> 8) ^ data[i]) & 0xFF];
-    return crc;
-}
+#define POLL_US             8000   // 8 ms between I2C reads
 
 // ---- I2C ----------------------------------------------------------------------
 
-static int      i2c_fd       = -1;
-static uint16_t last_buttons =  0;
+static topper_link_t *topper       = NULL;
+static uint16_t       last_buttons = 0;
 
 static void init_i2c(void) {
-    i2c_fd = open("/dev/i2c-1", O_RDWR);
-    if (i2c_fd < 0) { perror("Failed to open /dev/i2c-1"); exit(1); }
-    if (ioctl(i2c_fd, I2C_SLAVE, I2C_DEVICE_ADDRESS) < 0) {
-        perror("Failed to set I2C slave");
-        close(i2c_fd);
-        exit(1);
-    }
-    uint8_t probe;
-    if (read(i2c_fd, &probe, 1) < 1) {
-        fprintf(stderr, "No device at I2C address 0x%02X\n", I2C_DEVICE_ADDRESS);
-        close(i2c_fd);
+    topper = topper_link_open(NULL, 0);
+    if (!topper) exit(1);
+    uint8_t probe[REPORT_LEN];
+    if (topper_link_report(topper, probe, 0) == TOPPER_ERR_IO) {
+        fprintf(stderr, "No device at I2C address 0x%02X\n", I2C_APP_ADDR);
+        topper_link_close(topper);
         exit(1);
     }
 }
 
 // Returns the current 16-bit button state, or the last good value on CRC error.
+// A frame up to POLL_US old is fine, so a running gamepad driver's reads are shared.
 static uint16_t read_buttons(void) {
-    uint8_t buf[DATASIZE];
-    if (read(i2c_fd, buf, DATASIZE) != DATASIZE) return last_buttons;
-    uint16_t computed = compute_crc16(buf, 7);
-    uint16_t received = (uint16_t)buf[7] | ((uint16_t)buf[8] << 8);
-    if (computed != received) return last_buttons;
-    last_buttons = (uint16_t)buf[0] | ((uint16_t)buf[1] << 8);
+    uint8_t buf[REPORT_LEN];
+    if (topper_link_report(topper, buf, POLL_US) != TOPPER_OK) return last_buttons;
+    last_buttons = (uint16_t)buf[REPORT_BUTTONS] | ((uint16_t)buf[REPORT_BUTTONS + 1] << 8);
     return last_buttons;
 }
 
@@ -92,7 +63,7 @@ static void set_raw_mode(void) {
 static void handle_signal(int sig) {
     (void)sig;
     restore_terminal();
-    if (i2c_fd >= 0) close(i2c_fd);
+    topper_link_close(topper);
     printf("\n\nInterrupted.\n");
     exit(1);
 }
@@ -284,7 +255,6 @@ static void print_results(void) {
 // ---- Main ---------------------------------------------------------------------
 
 int main(void) {
-    init_crc16_table();
     init_i2c();
     memset(bit_to_ps3, -1, sizeof(bit_to_ps3));
 
@@ -306,6 +276,6 @@ int main(void) {
     restore_terminal();
     print_results();
 
-    close(i2c_fd);
+    topper_link_close(topper);
     return 0;
 }
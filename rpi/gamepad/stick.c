@@ -0,0 +1,121 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stick.h"
+
+// ---- Profiles -----------------------------------------------------------------
+
+static const StickProfile profiles[] = {
+    //  name        deadzone  anti   sat    curve             expo
+    { "linear",     0.08f,   0.00f, 0.95f, CURVE_LINEAR,     0.0f },
+    { "precise",    0.06f,   0.00f, 0.95f, CURVE_QUADRATIC,  0.0f },  // fine aim near center
+    { "expo",       0.08f,   0.00f, 0.95f, CURVE_EXPO,       0.5f },
+    { "responsive", 0.10f,   0.12f, 0.85f, CURVE_LINEAR,     0.0f },  // moves as soon as it leaves the deadzone
+    { "pointer",    0.10f,   0.00f, 0.90f, CURVE_CUBIC,      0.0f },  // slow small motions, fast sweeps
+};
+
+#define PROFILE_COUNT (sizeof(profiles) / sizeof(profiles[0]))
+
+static const char *curve_names[] = { "linear", "quadratic", "cubic", "expo" };
+
+bool stick_profile_find(const char *name, StickProfile *out) {
+    for (size_t i = 0; i < PROFILE_COUNT; i++) {
+        if (strcmp(profiles[i].name, name) == 0) {
+            *out = profiles[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+void stick_profile_list(void) {
+    for (size_t i = 0; i < PROFILE_COUNT; i++) {
+        const StickProfile *p = &profiles[i];
+        printf("  %-11s deadzone %2.0f%%  anti-deadzone %2.0f%%  saturation %3.0f%%  %s",
+               p->name, p->deadzone * 100, p->antideadzone * 100, p->saturation * 100,
+               curve_names[p->curve]);
+        if (p->curve == CURVE_EXPO)
+            printf(" %.2f", p->expo);
+        printf("\n");
+    }
+}
+
+const char *stick_curve_name(StickCurve curve) {
+    return curve_names[curve];
+}
+
+bool stick_parse_curve(const char *s, StickProfile *p) {
+    for (int c = CURVE_LINEAR; c <= CURVE_CUBIC; c++) {
+        if (strcmp(s, curve_names[c]) == 0) {
+            p->curve = (StickCurve)c;
+            return true;
+        }
+    }
+    if (strncmp(s, "expo", 4) == 0) {
+        float k = 0.5f;
+        if (s[4] == '=') {
+            char *end;
+            k = strtof(s + 5, &end);
+            if (*end || k < 0.0f || k > 1.0f)
+                return false;
+        } else if (s[4]) {
+            return false;
+        }
+        p->curve = CURVE_EXPO;
+        p->expo  = k;
+        return true;
+    }
+    return false;
+}
+
+// ---- Table construction -------------------------------------------------------
+
+static double apply_curve(const StickProfile *p, double t) {
+    switch (p->curve) {
+    case CURVE_QUADRATIC: return t * t;
+    case CURVE_CUBIC:     return t * t * t;
+    case CURVE_EXPO:      return (1.0 - p->expo) * t + p->expo * t * t * t;
+    default:              return t;
+    }
+}
+
+// Output magnitude (0-1) for a stick deflected to radius r (0-1, more on diagonals)
+static double shape_radius(const StickProfile *p, double r) {
+    if (r <= p->deadzone)
+        return 0.0;
+
+    double span = p->saturation - p->deadzone;
+    double t    = span > 0.0 ? (r - p->deadzone) / span : 1.0;
+    if (t > 1.0)
+        t = 1.0;
+    return p->antideadzone + (1.0 - p->antideadzone) * apply_curve(p, t);
+}
+
+static void build_axis(int16_t table[256], const AxisCalibration *cal) {
+    for (int raw = 0; raw < 256; raw++) {
+        double v;
+        if (raw >= cal->center)
+            v = cal->max > cal->center ? (double)(raw - cal->center) / (cal->max - cal->center) : 0.0;
+        else
+            v = cal->center > cal->min ? (double)(raw - cal->center) / (cal->center - cal->min) : 0.0;
+        if (v >  1.0) v =  1.0;
+        if (v < -1.0) v = -1.0;
+        table[raw] = (int16_t)lround(v * 32767.0);
+    }
+}
+
+void stick_build(StickLut *lut, const StickProfile *p, const AxisCalibration cal[2]) {
+    build_axis(lut->axis[0], &cal[0]);
+    build_axis(lut->axis[1], &cal[1]);
+
+    // Entry i covers r^2 in [i, i + 1) << STICK_GAIN_SHIFT; evaluate at its middle.
+    for (int i = 0; i < STICK_GAIN_SIZE; i++) {
+        double r2   = ((double)i + 0.5) * (double)(1u << STICK_GAIN_SHIFT);
+        double r    = sqrt(r2) / 32767.0;
+        double gain = shape_radius(p, r) / r;
+        double q    = gain * STICK_GAIN_ONE;
+        lut->gain[i] = (uint16_t)(q > 65535.0 ? 65535.0 : lround(q));
+    }
+}
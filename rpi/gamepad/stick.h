@@ -0,0 +1,94 @@
+#ifndef STICK_H
+#define STICK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ---- Analog stick pipeline ----------------------------------------------------
+//
+// Raw 8-bit stick readings go through three steps, all precomputed at startup:
+//
+//   1. Per-axis calibration: a 256-entry table maps each raw value to a signed
+//      Q15 deflection, using that axis's min / center / max.
+//   2. Radial shaping: the squared radius x*x + y*y indexes a gain table that
+//      applies the deadzone, outer saturation, response curve and
+//      anti-deadzone to the stick's magnitude while keeping its direction, so
+//      diagonals do not snap to the axes the way a per-axis flat does.
+//   3. Scaling back to 0-255 around 128.
+//
+// Per frame that is two axis loads, one gain load and a few multiplies.
+
+#define STICK_GAIN_BITS   12                    // gain table size, 4096 entries
+#define STICK_GAIN_SIZE   (1 << STICK_GAIN_BITS)
+#define STICK_GAIN_SHIFT  (31 - STICK_GAIN_BITS) // r^2 (up to 2^31) -> gain index
+#define STICK_GAIN_ONE    4096                  // Q12 unity gain
+
+typedef enum {
+    CURVE_LINEAR,
+    CURVE_QUADRATIC,
+    CURVE_CUBIC,
+    CURVE_EXPO,     // linear blended with cubic by expo
+} StickCurve;
+
+typedef struct {
+    const char *name;
+    float      deadzone;        // radius below which the stick reads centered (0-0.5)
+    float      antideadzone;    // output magnitude just outside the deadzone (0-0.5)
+    float      saturation;      // radius that already gives full output (0.5-1)
+    StickCurve curve;
+    float      expo;            // CURVE_EXPO blend, 0 = linear .. 1 = cubic
+} StickProfile;
+
+typedef struct {
+    uint8_t min, center, max;
+} AxisCalibration;
+
+typedef struct {
+    int16_t  axis[2][256];              // raw -> Q15 deflection, [0] = X, [1] = Y
+    uint16_t gain[STICK_GAIN_SIZE];     // squared radius -> Q12 gain
+} StickLut;
+
+// Copies the built-in profile called name. Returns false if there is none.
+bool stick_profile_find(const char *name, StickProfile *out);
+
+// Prints the built-in profiles, one per line.
+void stick_profile_list(void);
+
+const char *stick_curve_name(StickCurve curve);
+
+// Parses "linear", "quadratic", "cubic" or "expo[=<0-1>]" into p.
+bool stick_parse_curve(const char *s, StickProfile *p);
+
+void stick_build(StickLut *lut, const StickProfile *p, const AxisCalibration cal[2]);
+
+static inline uint8_t stick_to_u8(int32_t v) {
+    return (uint8_t)(128 + (v * 127 + (v >= 0 ? 16383 : -16383)) / 32767);
+}
+
+// Shaped deflection of a stick as signed Q15 (-32767..32767) per axis
+static inline void stick_apply_q15(const StickLut *lut, uint8_t x, uint8_t y, int32_t *ox, int32_t *oy) {
+    int32_t  vx = lut->axis[0][x];
+    int32_t  vy = lut->axis[1][y];
+    uint32_t r2 = (uint32_t)(vx * vx) + (uint32_t)(vy * vy);
+    uint32_t i  = r2 >> STICK_GAIN_SHIFT;
+    int32_t  g  = lut->gain[i < STICK_GAIN_SIZE ? i : STICK_GAIN_SIZE - 1];
+
+    vx = (vx * g) / STICK_GAIN_ONE;
+    vy = (vy * g) / STICK_GAIN_ONE;
+    if (vx >  32767) vx =  32767;
+    if (vx < -32767) vx = -32767;
+    if (vy >  32767) vy =  32767;
+    if (vy < -32767) vy = -32767;
+    *ox = vx;
+    *oy = vy;
+}
+
+static inline void stick_apply(const StickLut *lut, uint8_t *x, uint8_t *y) {
+    int32_t vx, vy;
+
+    stick_apply_q15(lut, *x, *y, &vx, &vy);
+    *x = stick_to_u8(vx);
+    *y = stick_to_u8(vy);
+}
+
+#endif // STICK_H
@@ -0,0 +1,325 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "vblank.h"
+
+// ---- Kernel DRM ABI -----------------------------------------------------------
+//
+// The subset of <drm/drm.h> and <drm/drm_mode.h> used here, with the kernel's
+// names and layouts.
+
+#define DRM_IOCTL_BASE                  'd'
+#define DRM_IOCTL_DROP_MASTER           _IO(DRM_IOCTL_BASE, 0x1f)
+#define DRM_IOCTL_WAIT_VBLANK           _IOWR(DRM_IOCTL_BASE, 0x3a, union drm_wait_vblank)
+#define DRM_IOCTL_MODE_GETRESOURCES     _IOWR(DRM_IOCTL_BASE, 0xA0, struct drm_mode_card_res)
+#define DRM_IOCTL_MODE_GETCRTC          _IOWR(DRM_IOCTL_BASE, 0xA1, struct drm_mode_crtc)
+#define DRM_IOCTL_MODE_GETENCODER       _IOWR(DRM_IOCTL_BASE, 0xA6, struct drm_mode_get_encoder)
+#define DRM_IOCTL_MODE_GETCONNECTOR     _IOWR(DRM_IOCTL_BASE, 0xA7, struct drm_mode_get_connector)
+
+#define _DRM_VBLANK_RELATIVE            0x00000001
+#define _DRM_VBLANK_HIGH_CRTC_MASK      0x0000003e
+#define _DRM_VBLANK_HIGH_CRTC_SHIFT     1
+#define _DRM_VBLANK_EVENT               0x04000000
+
+#define DRM_EVENT_VBLANK                0x01
+
+#define DRM_MODE_CONNECTED              1
+#define DRM_MODE_CONNECTOR_DPI          17
+
+struct drm_wait_vblank_request {
+    uint32_t      type;
+    uint32_t      sequence;
+    unsigned long signal;
+};
+
+struct drm_wait_vblank_reply {
+    uint32_t type;
+    uint32_t sequence;
+    long     tval_sec;
+    long     tval_usec;
+};
+
+union drm_wait_vblank {
+    struct drm_wait_vblank_request request;
+    struct drm_wait_vblank_reply   reply;
+};
+
+struct drm_event {
+    uint32_t type;
+    uint32_t length;
+};
+
+struct drm_event_vblank {
+    struct drm_event base;
+    uint64_t         user_data;
+    uint32_t         tv_sec;
+    uint32_t         tv_usec;
+    uint32_t         sequence;
+    uint32_t         crtc_id;
+};
+
+struct drm_mode_card_res {
+    uint64_t fb_id_ptr, crtc_id_ptr, connector_id_ptr, encoder_id_ptr;
+    uint32_t count_fbs, count_crtcs, count_connectors, count_encoders;
+    uint32_t min_width, max_width, min_height, max_height;
+};
+
+struct drm_mode_modeinfo {
+    uint32_t clock;
+    uint16_t hdisplay, hsync_start, hsync_end, htotal, hskew;
+    uint16_t vdisplay, vsync_start, vsync_end, vtotal, vscan;
+    uint32_t vrefresh;
+    uint32_t flags;
+    uint32_t type;
+    char     name[32];
+};
+
+struct drm_mode_crtc {
+    uint64_t                 set_connectors_ptr;
+    uint32_t                 count_connectors;
+    uint32_t                 crtc_id;
+    uint32_t                 fb_id;
+    uint32_t                 x, y;
+    uint32_t                 gamma_size;
+    uint32_t                 mode_valid;
+    struct drm_mode_modeinfo mode;
+};
+
+struct drm_mode_get_encoder {
+    uint32_t encoder_id, encoder_type, crtc_id, possible_crtcs, possible_clones;
+};
+
+struct drm_mode_get_connector {
+    uint64_t encoders_ptr, modes_ptr, props_ptr, prop_values_ptr;
+    uint32_t count_modes, count_props, count_encoders;
+    uint32_t encoder_id;
+    uint32_t connector_id;
+    uint32_t connector_type;
+    uint32_t connector_type_id;
+    uint32_t connection;
+    uint32_t mm_width, mm_height;
+    uint32_t subpixel;
+    uint32_t pad;
+};
+
+_Static_assert(sizeof(struct drm_event_vblank) == 32, "drm_event_vblank layout");
+_Static_assert(sizeof(struct drm_mode_card_res) == 64, "drm_mode_card_res layout");
+_Static_assert(sizeof(struct drm_mode_crtc) == 104, "drm_mode_crtc layout");
+_Static_assert(sizeof(struct drm_mode_get_connector) == 80, "drm_mode_get_connector layout");
+
+// ---- CRTC selection -----------------------------------------------------------
+
+#define MAX_CARDS           8
+#define MAX_OBJECTS         32
+#define DEFAULT_PERIOD_NS   16666667ULL     // 60 Hz until the mode or the vblanks say otherwise
+
+static const char *connector_types[] = {
+    "Unknown", "VGA", "DVI-I", "DVI-D", "DVI-A", "Composite", "SVIDEO", "LVDS", "Component",
+    "DIN", "DP", "HDMI-A", "HDMI-B", "TV", "eDP", "Virtual", "DSI", "DPI", "Writeback", "SPI", "USB",
+};
+
+typedef struct {
+    int      score;             // 2: DPI, 1: any other active output, 0: none
+    char     connector[32];
+    uint32_t crtc_id;
+    int      pipe;
+    uint64_t period_ns;
+} Candidate;
+
+static uint64_t mode_period_ns(const struct drm_mode_modeinfo *m) {
+    if (!m->clock || !m->htotal || !m->vtotal)
+        return DEFAULT_PERIOD_NS;
+    return (uint64_t)m->htotal * m->vtotal * 1000000ULL / m->clock;
+}
+
+// Best connected output on one card whose CRTC is scanning out
+static Candidate probe_card(int fd) {
+    struct drm_mode_card_res res = {0};
+    uint32_t  crtcs[MAX_OBJECTS], connectors[MAX_OBJECTS];
+    Candidate best = {0};
+
+    if (ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res) < 0)
+        return best;    // not a modesetting device
+    if (res.count_crtcs > MAX_OBJECTS)      res.count_crtcs = MAX_OBJECTS;
+    if (res.count_connectors > MAX_OBJECTS) res.count_connectors = MAX_OBJECTS;
+    res.count_fbs = res.count_encoders = 0;
+    res.crtc_id_ptr      = (uint64_t)(uintptr_t)crtcs;
+    res.connector_id_ptr = (uint64_t)(uintptr_t)connectors;
+    if (ioctl(fd, DRM_IOCTL_MODE_GETRESOURCES, &res) < 0)
+        return best;
+
+    for (uint32_t i = 0; i < res.count_connectors; i++) {
+        // A non-zero count_modes keeps the kernel from re-probing the output
+        struct drm_mode_get_connector conn = { .connector_id = connectors[i] };
+        struct drm_mode_get_encoder   enc  = {0};
+        struct drm_mode_crtc          crtc = {0};
+        struct drm_mode_modeinfo      mode;
+        int score, pipe = -1;
+
+        conn.count_modes = 1;
+        conn.modes_ptr   = (uint64_t)(uintptr_t)&mode;
+        if (ioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn) < 0 ||
+            conn.connection != DRM_MODE_CONNECTED || !conn.encoder_id)
+            continue;
+        enc.encoder_id = conn.encoder_id;
+        if (ioctl(fd, DRM_IOCTL_MODE_GETENCODER, &enc) < 0 || !enc.crtc_id)
+            continue;
+        crtc.crtc_id = enc.crtc_id;
+        if (ioctl(fd, DRM_IOCTL_MODE_GETCRTC, &crtc) < 0 || !crtc.mode_valid)
+            continue;
+        for (uint32_t c = 0; c < res.count_crtcs; c++)
+            if (crtcs[c] == enc.crtc_id) pipe = (int)c;
+        if (pipe < 0 || pipe > _DRM_VBLANK_HIGH_CRTC_MASK >> _DRM_VBLANK_HIGH_CRTC_SHIFT)
+            continue;
+
+        score = conn.connector_type == DRM_MODE_CONNECTOR_DPI ? 2 : 1;
+        if (score <= best.score)
+            continue;
+        best.score     = score;
+        best.crtc_id   = enc.crtc_id;
+        best.pipe      = pipe;
+        best.period_ns = mode_period_ns(&crtc.mode);
+        snprintf(best.connector, sizeof(best.connector), "%s-%u",
+                 conn.connector_type < sizeof(connector_types) / sizeof(connector_types[0])
+                     ? connector_types[conn.connector_type] : "Unknown",
+                 conn.connector_type_id);
+    }
+    return best;
+}
+
+static int open_card(const char *path, Candidate *c) {
+    int fd = open(path, O_RDWR | O_CLOEXEC | O_NONBLOCK);
+
+    if (fd < 0)
+        return -1;
+    // The first opener becomes DRM master; hand that back at once so the
+    // display server or a KMS emulator started later can still set modes.
+    ioctl(fd, DRM_IOCTL_DROP_MASTER, 0);
+    *c = probe_card(fd);
+    if (!c->score) {
+        close(fd);
+        errno = 0;
+        return -1;
+    }
+    return fd;
+}
+
+// ---- Events -------------------------------------------------------------------
+
+int vblank_open(Vblank *vb, const char *card) {
+    Candidate c = {0};
+    char path[32];
+
+    memset(vb, 0, sizeof(*vb));
+    vb->fd = -1;
+
+    if (card) {
+        vb->fd = open_card(card, &c);
+        if (vb->fd < 0) {
+            fprintf(stderr, "vblank: %s: %s\n", card,
+                    errno ? strerror(errno) : "no connected output with an active CRTC");
+            return -1;
+        }
+        snprintf(vb->card, sizeof(vb->card), "%s", card);
+    } else {
+        // Prefer a DPI output on any card over another output on an earlier one
+        for (int i = 0; i < MAX_CARDS; i++) {
+            Candidate cand;
+            snprintf(path, sizeof(path), "/dev/dri/card%d", i);
+            int fd = open_card(path, &cand);
+            if (fd < 0)
+                continue;
+            if (cand.score > c.score) {
+                if (vb->fd >= 0) close(vb->fd);
+                vb->fd = fd;
+                c = cand;
+                snprintf(vb->card, sizeof(vb->card), "%s", path);
+            } else {
+                close(fd);
+            }
+        }
+        if (vb->fd < 0) {
+            fprintf(stderr, "vblank: no /dev/dri/card* with a connected output and an active CRTC\n");
+            return -1;
+        }
+    }
+
+    snprintf(vb->connector, sizeof(vb->connector), "%s", c.connector);
+    vb->crtc_id   = c.crtc_id;
+    vb->pipe      = c.pipe;
+    vb->period_ns = c.period_ns;
+    return 0;
+}
+
+int vblank_request(Vblank *vb) {
+    union drm_wait_vblank vbl;
+    struct timespec ts;
+
+    // Queued within a frame of the last vblank, the event will be for the one
+    // right after it, so its spacing measures the period.
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    vb->chained = vb->last_ns && now - vb->last_ns < vb->period_ns;
+
+    memset(&vbl, 0, sizeof(vbl));
+    vbl.request.type = _DRM_VBLANK_RELATIVE | _DRM_VBLANK_EVENT |
+                       (((uint32_t)vb->pipe << _DRM_VBLANK_HIGH_CRTC_SHIFT) & _DRM_VBLANK_HIGH_CRTC_MASK);
+    vbl.request.sequence = 1;
+    if (ioctl(vb->fd, DRM_IOCTL_WAIT_VBLANK, &vbl) < 0)
+        return -1;
+    vb->pending = true;
+    return 0;
+}
+
+int vblank_read(Vblank *vb) {
+    char buf[256];
+    ssize_t len = read(vb->fd, buf, sizeof(buf));
+    int n = 0;
+
+    if (len < 0)
+        return errno == EAGAIN || errno == EINTR ? 0 : -1;
+
+    for (ssize_t off = 0; off + (ssize_t)sizeof(struct drm_event) <= len; ) {
+        struct drm_event ev;
+        memcpy(&ev, buf + off, sizeof(ev));
+        if (ev.length < sizeof(ev) || off + (ssize_t)ev.length > len)
+            break;
+
+        if (ev.type == DRM_EVENT_VBLANK && ev.length >= sizeof(struct drm_event_vblank)) {
+            struct drm_event_vblank vbl;
+            memcpy(&vbl, buf + off, sizeof(vbl));
+
+            // DRM timestamps are CLOCK_MONOTONIC. Between chained events the
+            // spacing per frame refines the period; outliers (a mode change, a
+            // stalled CRTC) are ignored rather than averaged in.
+            uint64_t t = (uint64_t)vbl.tv_sec * 1000000000ULL + (uint64_t)vbl.tv_usec * 1000ULL;
+            uint32_t frames = vbl.sequence - vb->last_seq;
+            if (vb->chained && frames && t > vb->last_ns) {
+                uint64_t measured = (t - vb->last_ns) / frames;
+                if (measured > vb->period_ns - vb->period_ns / 8 &&
+                    measured < vb->period_ns + vb->period_ns / 8)
+                    vb->period_ns = (vb->period_ns * 15 + measured) / 16;
+                vb->skipped += frames - 1;
+            }
+            vb->last_ns  = t;
+            vb->last_seq = vbl.sequence;
+            vb->pending  = false;
+            vb->events++;
+            n++;
+        }
+        off += ev.length;
+    }
+    return n;
+}
+
+void vblank_close(Vblank *vb) {
+    if (vb->fd >= 0)
+        close(vb->fd);
+    vb->fd = -1;
+}
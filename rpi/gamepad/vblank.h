@@ -0,0 +1,46 @@
+#ifndef VBLANK_H
+#define VBLANK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// ---- Display vblank events ----------------------------------------------------
+//
+// Talks to a DRM card node with the kernel's own ioctls, so the driver needs
+// neither libdrm nor its headers. vblank_open() picks the CRTC that scans out
+// the DPI panel, or the first active CRTC on cards without one (vkms, HDMI).
+// vblank_request() queues one event for the next vblank on it; the event is
+// read from Vblank.fd by vblank_read(), which also refines the frame period
+// from the spacing of the vblanks.
+
+typedef struct {
+    int      fd;
+    char     card[32];          // e.g. "/dev/dri/card1"
+    char     connector[32];     // e.g. "DPI-1"
+    uint32_t crtc_id;
+    int      pipe;              // CRTC index, selects the CRTC in DRM_IOCTL_WAIT_VBLANK
+    uint64_t period_ns;         // from the mode, then measured
+    uint64_t last_ns;           // CLOCK_MONOTONIC time of the latest vblank, 0 before the first
+    uint32_t last_seq;
+    bool     pending;           // an event is queued
+    bool     chained;           // ... and was queued right after the previous one
+    uint64_t events;
+    uint64_t skipped;           // vblanks between chained events: the event was handled too late
+} Vblank;
+
+// Opens card, or with NULL the first /dev/dri/card* with a suitable CRTC, and
+// gives up DRM master so a compositor or KMS emulator can still take it.
+// Returns 0, or -1 after printing why.
+int vblank_open(Vblank *vb, const char *card);
+
+// Queues an event for the next vblank. Returns 0, or -1 with errno set, e.g.
+// EINVAL while the CRTC is off.
+int vblank_request(Vblank *vb);
+
+// Reads the queued events. Returns the number of vblank events, 0 if none was
+// waiting, -1 on error.
+int vblank_read(Vblank *vb);
+
+void vblank_close(Vblank *vb);
+
+#endif // VBLANK_H
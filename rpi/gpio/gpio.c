@@ -2,67 +2,34 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include <fcntl.h>
 #include <unistd.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
-
-#define I2C_DEVICE          "/dev/i2c-1"
-#define ATMEGA_ADDR         0x30
-#define I2C_CMD_GPIO_ALL    0x30
-#define I2C_CMD_GPIO_READ   0x60
-#define RESPONSE_LEN        9
+
+#include "topper_protocol.h"
+#include "topper_link.h"
+
+#define RESPONSE_LEN        PINFRAME_LEN
 #define NUM_PINS            16
 
 // Response byte offsets from I2C_CMD_GPIO_READ
-#define IDX_DDRB  0
-#define IDX_DDRD  1
-#define IDX_PORTB 2
-#define IDX_PORTD 3
-#define IDX_PINB  4
-#define IDX_PIND  5
-
-// ---- CRC ----------------------------------------------------------------
-
-static uint16_t crc_table[256];
-
-static void generate_crc_table(void) {
-    const uint16_t poly = 0x1021;
-    for (int i = 0; i < 256; i++) {
-        uint16_t crc = (uint16_t)i << 8;
-        for (int j = 0; j < 8; j++)
-            crc = (crc & 0x8000) ? (crc << 1) ^ poly : crc << 1;
-        crc_table[i] = crc;
-    }
-}
-
-static uint16_t calculate_crc(const uint8_t *data, uint8_t len) {
-    uint16_t crc = 0xFFFF;
-    for (uint8_t i = 0; i < len; i++)
-        crc = (crc << 8) ^ crc_table[(crc >> 8) ^ data[i]];
-    return crc;
-}
+#define IDX_DDRB  PINFRAME_DDRB
+#define IDX_DDRD  PINFRAME_DDRD
+#define IDX_PORTB PINFRAME_PORTB
+#define IDX_PORTD PINFRAME_PORTD
+#define IDX_PINB  PINFRAME_PINB
+#define IDX_PIND  PINFRAME_PIND
 
 // ---- I2C ----------------------------------------------------------------
 
-static int open_i2c(void) {
-    int fd = open(I2C_DEVICE, O_RDWR);
-    if (fd < 0) { perror("open"); return -1; }
-    if (ioctl(fd, I2C_SLAVE, ATMEGA_ADDR) < 0) { perror("ioctl"); close(fd); return -1; }
-    return fd;
-}
-
-static int read_state(int fd, uint8_t buf[RESPONSE_LEN]) {
-    uint8_t cmd = I2C_CMD_GPIO_READ;
-    if (write(fd, &cmd, 1) != 1) { perror("write"); return -1; }
-
-    // Give the ATmega main loop time to process the command before we read.
-    usleep(5000);
-
-    if (read(fd, buf, RESPONSE_LEN) != RESPONSE_LEN) { perror("read"); return -1; }
+// Through topperd, the command and the read that returns the pin frame are one
+// request, so no other tool's read can take the pin frame in between.
+static int read_state(topper_link_t *topper, uint8_t buf[RESPONSE_LEN]) {
+    if (topper_link_query(topper, I2C_CMD_GPIO_READ, buf, RESPONSE_LEN) != TOPPER_OK) {
+        fprintf(stderr, "Failed to read pin state from 0x%02X\n", I2C_APP_ADDR);
+        return -1;
+    }
 
-    uint16_t expected = calculate_crc(buf, 7);
-    uint16_t received = ((uint16_t)buf[7] << 8) | buf[8];
+    uint16_t expected = topper_crc16(buf, PINFRAME_CRC);
+    uint16_t received = ((uint16_t)buf[PINFRAME_CRC] << 8) | buf[PINFRAME_CRC + 1];
     if (expected != received) {
         fprintf(stderr, "CRC mismatch: expected 0x%04X, got 0x%04X\n", expected, received);
         return -1;
@@ -70,9 +37,12 @@ static int read_state(int fd, uint8_t buf[RESPONSE_LEN]) {
     return 0;
 }
 
-static int write_state(int fd, uint8_t ddrb, uint8_t ddrd, uint8_t portb, uint8_t portd) {
+static int write_state(topper_link_t *topper, uint8_t ddrb, uint8_t ddrd, uint8_t portb, uint8_t portd) {
     uint8_t buf[5] = { I2C_CMD_GPIO_ALL, ddrb, ddrd, portb, portd };
-    if (write(fd, buf, sizeof(buf)) != sizeof(buf)) { perror("write"); return -1; }
+    if (topper_link_command(topper, buf, sizeof(buf)) != TOPPER_OK) {
+        fprintf(stderr, "Failed to write pin state to 0x%02X\n", I2C_APP_ADDR);
+        return -1;
+    }
     return 0;
 }
 
@@ -135,9 +105,9 @@ static void print_pin_cb(int pin, void *userdata) {
     print_pin(pin, (const uint8_t *)userdata);
 }
 
-static int cmd_get(int fd, int argc, char *argv[], int optind) {
+static int cmd_get(topper_link_t *topper, int argc, char *argv[], int optind) {
     uint8_t buf[RESPONSE_LEN];
-    if (read_state(fd, buf) < 0) return -1;
+    if (read_state(topper, buf) < 0) return -1;
 
     if (optind >= argc) {
         // No pin argument: print all
@@ -188,28 +158,30 @@ static void apply_options_to_pin(int pin, void *userdata) {
     }
 }
 
-static int cmd_set(int fd, const char *pin_spec, int argc, char *argv[], int optind) {
+static int cmd_set(topper_link_t *topper, const char *pin_spec, int argc, char *argv[], int optind) {
     if (optind >= argc) {
         fprintf(stderr, "set requires at least one option\n");
         return -1;
     }
 
     uint8_t buf[RESPONSE_LEN];
-    if (read_state(fd, buf) < 0) return -1;
+    if (read_state(topper, buf) < 0) return -1;
 
     struct set_context ctx = { buf, argc, argv, optind, 0 };
     if (parse_pins(pin_spec, apply_options_to_pin, &ctx) < 0) return -1;
     if (ctx.error) return -1;
 
-    return write_state(fd, buf[IDX_DDRB], buf[IDX_DDRD], buf[IDX_PORTB], buf[IDX_PORTD]);
+    return write_state(topper, buf[IDX_DDRB], buf[IDX_DDRD], buf[IDX_PORTB], buf[IDX_PORTD]);
 }
 
 // ---- Usage --------------------------------------------------------------
 
 static void usage(const char *prog) {
     printf("Usage:\n");
-    printf("  %s get [<pin>|<pin,pin,...>|<start>-<end>]\n", prog);
-    printf("  %s set <pin[,pin,...]|start-end> <options>...\n\n", prog);
+    printf("  %s [--bus <spec>] get [<pin>|<pin,pin,...>|<start>-<end>]\n", prog);
+    printf("  %s [--bus <spec>] set <pin[,pin,...]|start-end> <options>...\n\n", prog);
+    printf("  --bus <spec>  open this bus instead of going through topperd: /dev/i2c-N, N,\n");
+    printf("                stub:N, sim:atmega[:opt...] or replay:<file>\n\n");
     printf("  pin: 0-%d (0-7 = PORTB bit 0-7, 8-15 = PORTD bit 0-7)\n\n", NUM_PINS - 1);
     printf("Valid [options] for %s set are:\n", prog);
     printf("  ip      set GPIO as input\n");
@@ -235,27 +207,34 @@ static void usage(const char *prog) {
 // ---- Main ---------------------------------------------------------------
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) { usage(argv[0]); return 1; }
+    const char *bus_spec = NULL;
+    int         first    = 1;
+
+    // --bus opens that bus directly instead of going through topperd
+    if (argc > 2 && strcmp(argv[1], "--bus") == 0) {
+        bus_spec = argv[2];
+        first    = 3;
+    }
 
-    if (strcmp(argv[1], "help") == 0) { usage(argv[0]); return 0; }
+    if (argc < first + 1) { usage(argv[0]); return 1; }
 
-    generate_crc_table();
+    if (strcmp(argv[first], "help") == 0) { usage(argv[0]); return 0; }
 
-    int fd = open_i2c();
-    if (fd < 0) return 1;
+    topper_link_t *topper = topper_link_open(bus_spec, bus_spec != NULL);
+    if (!topper) return 1;
 
     int result = 0;
-    const char *cmd = argv[1];
+    const char *cmd = argv[first];
 
     if (strcmp(cmd, "get") == 0) {
-        result = cmd_get(fd, argc, argv, 2);
+        result = cmd_get(topper, argc, argv, first + 1);
 
     } else if (strcmp(cmd, "set") == 0) {
-        if (argc < 4) {
+        if (argc < first + 3) {
             fprintf(stderr, "set requires a pin number and at least one option\n");
-            close(fd); return 1;
+            topper_link_close(topper); return 1;
         }
-        result = cmd_set(fd, argv[2], argc, argv, 3);
+        result = cmd_set(topper, argv[first + 1], argc, argv, first + 2);
 
     } else {
         fprintf(stderr, "Unknown command '%s'\n\n", cmd);
@@ -263,6 +242,6 @@ int main(int argc, char *argv[]) {
         result = -1;
     }
 
-    close(fd);
+    topper_link_close(topper);
     return result < 0 ? 1 : 0;
 }
@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "topper_protocol.h"
+#include "i2c_capture.h"
+
+// Prints a capture written with $TOPPER_I2C_CAPTURE, one line per
+// transaction, decoded as the Topper protocol: the app at 0x30, the
+// bootloader at 0x29 and the GSL1680 touch controller at 0x40. Frame CRCs
+// are checked, so a corrupt read shows up next to the command that asked
+// for it.
+
+#define GSL_ADDR            0x40
+#define GSL_REG_DATA        0x80
+#define GSL_REG_STATUS      0xB0
+#define GSL_REG_POWER       0xBC
+#define GSL_REG_RESET       0xE0
+#define GSL_REG_CLOCK       0xE4
+#define GSL_REG_PAGE        0xF0
+#define GSL_REG_ID          0xFC
+
+#define LINE_MAX_LEN        512
+
+// ---- Output ----
+
+typedef struct {
+    char   text[LINE_MAX_LEN];
+    size_t len;
+} Line;
+
+static void put(Line *l, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void put(Line *l, const char *fmt, ...) {
+    va_list ap;
+
+    if (l->len >= sizeof(l->text))
+        return;
+    va_start(ap, fmt);
+    int n = vsnprintf(l->text + l->len, sizeof(l->text) - l->len, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+        l->len += (size_t)n;
+}
+
+static void put_hex(Line *l, const uint8_t *data, size_t len, size_t max) {
+    for (size_t i = 0; i < len && i < max; i++)
+        put(l, "%s%02X", i ? " " : "", data[i]);
+    if (len > max)
+        put(l, " ...");
+}
+
+static const char *crc_mark(uint16_t got, uint16_t want) {
+    return got == want ? "ok" : "BAD";
+}
+
+static uint16_t be16(const uint8_t *p) { return (uint16_t)(p[0] << 8 | p[1]); }
+static uint16_t le16(const uint8_t *p) { return (uint16_t)(p[0] | p[1] << 8); }
+
+// ---- Per-address state ----
+
+// The app and the bootloader both answer a read with whatever frame the
+// last command selected, so the decoder tracks that command per address.
+typedef struct {
+    uint8_t  app_mode;          // I2C_CMD_VERSION / I2C_CMD_GPIO_READ, 0 for reports
+    uint8_t  bl_cmd;
+    uint8_t  bl_arg;
+    uint8_t  bl_count;
+    uint8_t  gsl_reg;
+} DecodeState;
+
+typedef struct {
+    unsigned long xfers;
+    unsigned long failed;
+    unsigned long crc_errors;
+    unsigned long bytes;
+    uint64_t      busy_ns;
+} AddrStats;
+
+// ---- Application (0x30) ----
+
+static void app_write(DecodeState *st, Line *l, const uint8_t *w, size_t len) {
+    switch (w[0]) {
+    case I2C_CMD_BRIGHT:
+        if (len < 2)
+            put(l, "BRIGHT (short)");
+        else if (w[1] == I2C_BRIGHT_DISABLE)
+            put(l, "BRIGHT display off");
+        else if (w[1] == I2C_BRIGHT_ENABLE)
+            put(l, "BRIGHT display on");
+        else
+            put(l, "BRIGHT level %u", w[1]);
+        break;
+    case I2C_CMD_CRC:
+        put(l, "CRC %s", len > 1 && w[1] ? "on" : "off");
+        break;
+    case I2C_CMD_GPIO_ALL:
+        if (len < 5)
+            put(l, "GPIO_ALL (short)");
+        else
+            put(l, "GPIO_ALL DDRB=%02X DDRD=%02X PORTB=%02X PORTD=%02X", w[1], w[2], w[3], w[4]);
+        break;
+    case I2C_CMD_GPIO_SAVE:
+        put(l, "GPIO_SAVE");
+        break;
+    case I2C_CMD_VERSION:
+        put(l, "VERSION");
+        st->app_mode = I2C_CMD_VERSION;
+        return;
+    case I2C_CMD_GPIO_READ:
+        put(l, "GPIO_READ");
+        st->app_mode = I2C_CMD_GPIO_READ;
+        return;
+    case I2C_CMD_BOOTLOADER:
+        put(l, "BOOTLOADER %s", len == 1 + I2C_BOOTLOADER_KEY_LEN &&
+            memcmp(w + 1, I2C_BOOTLOADER_KEY, I2C_BOOTLOADER_KEY_LEN) == 0 ? "(key ok)" : "(bad key, ignored)");
+        break;
+    default:
+        put(l, "unknown command %02X", w[0]);
+        break;
+    }
+    st->app_mode = 0;
+}
+
+static int app_read(DecodeState *st, Line *l, const uint8_t *r, size_t len) {
+    int      bad = 0;
+    uint16_t crc;
+
+    if (st->app_mode == I2C_CMD_VERSION) {
+        if (len < VERSIONFRAME_META) {
+            put(l, "version frame (short)");
+            return 0;
+        }
+        crc = be16(r + VERSIONFRAME_CRC);
+        bad |= crc != topper_crc16(r, VERSIONFRAME_STR_LEN);
+        put(l, "version \"%.*s\" crc %s", VERSIONFRAME_STR_LEN, (const char *)r,
+            crc_mark(crc, topper_crc16(r, VERSIONFRAME_STR_LEN)));
+        if (len >= VERSIONFRAME_LEN) {
+            const uint8_t *m    = r + VERSIONFRAME_META;
+            uint16_t       want = topper_crc16(m, META_LEN);
+
+            crc  = be16(r + VERSIONFRAME_META_CRC);
+            bad |= crc != want;
+            if (m[0] == META_MAGIC0 && m[1] == META_MAGIC1)
+                put(l, ", build %08X size %u", (unsigned)(m[META_HASH] | m[META_HASH + 1] << 8 |
+                    m[META_HASH + 2] << 16 | (uint32_t)m[META_HASH + 3] << 24), le16(m + META_CODE_SIZE));
+            else
+                put(l, ", no build metadata");
+            put(l, " crc %s", crc_mark(crc, want));
+        }
+        return bad;
+    }
+
+    if (st->app_mode == I2C_CMD_GPIO_READ) {
+        if (len < PINFRAME_LEN) {
+            put(l, "pin frame (short)");
+            return 0;
+        }
+        crc = be16(r + PINFRAME_CRC);
+        put(l, "pins DDRB=%02X DDRD=%02X PORTB=%02X PORTD=%02X PINB=%02X PIND=%02X crc %s",
+            r[PINFRAME_DDRB], r[PINFRAME_DDRD], r[PINFRAME_PORTB], r[PINFRAME_PORTD],
+            r[PINFRAME_PINB], r[PINFRAME_PIND], crc_mark(crc, topper_crc16(r, PINFRAME_CRC)));
+        return crc != topper_crc16(r, PINFRAME_CRC);
+    }
+
+    if (len < REPORT_LEN) {
+        put(l, "report (short)");
+        return 0;
+    }
+    crc = le16(r + REPORT_CRC);
+    put(l, "report buttons=%04X axes=%3u %3u %3u %3u status=%02X",
+        le16(r + REPORT_BUTTONS), r[REPORT_JOY_LX], r[REPORT_JOY_LY],
+        r[REPORT_JOY_RX], r[REPORT_JOY_RY], r[REPORT_STATUS]);
+
+    // With CRC off the firmware leaves the CRC bytes unspecified
+    if (crc == topper_crc16(r, REPORT_CRC) || (r[REPORT_STATUS] & REPORT_STATUS_CRC_ACTIVE)) {
+        put(l, " crc %s", crc_mark(crc, topper_crc16(r, REPORT_CRC)));
+        return crc != topper_crc16(r, REPORT_CRC);
+    }
+    put(l, " (crc off)");
+    return 0;
+}
+
+// ---- Bootloader (0x29) ----
+
+static void bl_write(DecodeState *st, Line *l, const uint8_t *w, size_t len) {
+    st->bl_cmd = w[0];
+    st->bl_arg = len > 1 ? w[1] : 0;
+    st->bl_count = len > 2 ? w[2] : 0;
+
+    switch (w[0]) {
+    case CMD_READ_INFO:
+        put(l, "READ_INFO");
+        break;
+    case CMD_WRITE_PAGE:
+        put(l, "WRITE_PAGE page %u, %zu bytes", st->bl_arg, len > 2 ? len - 2 : 0);
+        break;
+    case CMD_FINALIZE:
+        put(l, "FINALIZE");
+        break;
+    case CMD_READ_STATUS:
+        put(l, "READ_STATUS");
+        break;
+    case CMD_READ_PAGE_CRC:
+        put(l, "READ_PAGE_CRC pages %u-%u", st->bl_arg, st->bl_arg + st->bl_count - 1);
+        break;
+    case CMD_READ_PAGE:
+        put(l, "READ_PAGE page %u", st->bl_arg);
+        break;
+    case CMD_READ_EEPROM:
+        put(l, "READ_EEPROM block %u", st->bl_arg);
+        break;
+    case CMD_WRITE_EEPROM:
+        if (len < 4)
+            put(l, "WRITE_EEPROM (short)");
+        else
+            put(l, "WRITE_EEPROM addr %03X, %zu bytes", be16(w + 1), len - 3);
+        break;
+    case CMD_WRITE_PAGE_CRC:
+        if (len != 2 + BL_READ_BLOCK + 2) {
+            put(l, "WRITE_PAGE_CRC (%zu bytes)", len);
+        } else {
+            uint16_t crc = be16(w + 2 + BL_READ_BLOCK);
+            put(l, "WRITE_PAGE_CRC page %u crc %s", st->bl_arg,
+                crc_mark(crc, topper_crc16(w + 1, 1 + BL_READ_BLOCK)));
+        }
+        break;
+    default:
+        put(l, "unknown command %02X", w[0]);
+        st->bl_cmd = 0;
+        break;
+    }
+}
+
+static int bl_read(DecodeState *st, Line *l, const uint8_t *r, size_t len) {
+    uint8_t  sum1 = 0, sum2 = 0, xor = 0;
+    uint16_t crc, want;
+
+    switch (st->bl_cmd) {
+    case CMD_READ_INFO:
+        if (len < BL_INFO_LEN)
+            break;
+        for (int i = 0; i < 6; i++) {
+            sum1 += r[i];
+            sum2 += sum1;
+            xor  ^= r[i];
+        }
+        put(l, "info sig %02X%02X%02X v%u, %u app pages, %s, checksum %s",
+            r[0], r[1], r[2], r[3], r[4],
+            r[5] == VERIFY_PASSED ? "verified" : r[5] == VERIFY_FAILED ? "verify failed" :
+            r[5] == VERIFY_PENDING ? "verify pending" : "verify ??",
+            sum1 == r[6] && sum2 == r[7] && xor == r[8] ? "ok" : "BAD");
+        return !(sum1 == r[6] && sum2 == r[7] && xor == r[8]);
+    case CMD_READ_STATUS:
+        if (len < BL_STATUS_LEN)
+            break;
+        put(l, "status%s%s%s%s%s, last page ", r[0] ? "" : " idle",
+            r[0] & BL_STATUS_BUSY ? " busy" : "", r[0] & BL_STATUS_FULL ? " full" : "",
+            r[0] & BL_STATUS_EEPROM ? " eeprom" : "", r[0] & BL_STATUS_REJECTED ? " rejected" : "");
+        if (r[1] == 0xFF)
+            put(l, "none");
+        else
+            put(l, "%u", r[1]);
+        put(l, ", check %s", r[2] == (r[0] ^ r[1] ^ 0xFF) ? "ok" : "BAD");
+        return r[2] != (r[0] ^ r[1] ^ 0xFF);
+    case CMD_READ_PAGE_CRC: {
+        size_t n = st->bl_count;
+
+        if (n == 0 || n > BL_PAGE_CRC_MAX || len < 2 * n + 2)
+            break;
+        crc  = be16(r + 2 * n);
+        want = topper_crc16(r, (uint8_t)(2 * n));
+        put(l, "page crcs");
+        for (size_t i = 0; i < n; i++)
+            put(l, " %04X", be16(r + 2 * i));
+        put(l, " crc %s", crc_mark(crc, want));
+        return crc != want;
+    }
+    case CMD_READ_PAGE:
+    case CMD_READ_EEPROM:
+        if (len < BL_READ_FRAME_LEN)
+            break;
+        crc  = be16(r + BL_READ_BLOCK);
+        want = topper_crc16(r, BL_READ_BLOCK);
+        put(l, "%s %u: ", st->bl_cmd == CMD_READ_PAGE ? "page" : "eeprom block", st->bl_arg);
+        put_hex(l, r, BL_READ_BLOCK, 8);
+        put(l, " crc %s", crc_mark(crc, want));
+        return crc != want;
+    default:
+        put(l, "read with no command pending");
+        return 0;
+    }
+    put(l, "%zu-byte read after command %02X", len, st->bl_cmd);
+    return 0;
+}
+
+// ---- GSL1680 touch controller (0x40) ----
+
+static const char *gsl_reg_name(uint8_t reg) {
+    switch (reg) {
+    case GSL_REG_DATA:   return "data";
+    case GSL_REG_STATUS: return "status";
+    case GSL_REG_POWER:  return "power";
+    case GSL_REG_RESET:  return "reset";
+    case GSL_REG_CLOCK:  return "clock";
+    case GSL_REG_PAGE:   return "page";
+    case GSL_REG_ID:     return "id";
+    default:             return NULL;
+    }
+}
+
+static void gsl_write(DecodeState *st, Line *l, const uint8_t *w, size_t len) {
+    const char *name = gsl_reg_name(w[0]);
+
+    st->gsl_reg = w[0];
+    if (name)
+        put(l, "reg %02X (%s)", w[0], name);
+    else if (w[0] < GSL_REG_DATA && len == 5)
+        put(l, "firmware word %02X", w[0]);
+    else
+        put(l, "reg %02X", w[0]);
+    if (len > 1) {
+        put(l, " <- ");
+        put_hex(l, w + 1, len - 1, 8);
+    }
+}
+
+static void gsl_read(DecodeState *st, Line *l, const uint8_t *r, size_t len) {
+    if (st->gsl_reg == GSL_REG_DATA && len >= 4) {
+        unsigned fingers = r[0];
+
+        put(l, "touch %u finger%s", fingers, fingers == 1 ? "" : "s");
+        // 4 bytes per finger from offset 4: 12-bit x, 12-bit y, id in the top nibble.
+        // A non-zero top nibble of the x word is a soft key, not a finger.
+        for (unsigned i = 0; i < fingers && 4 + 4 * i + 3 < len; i++) {
+            const uint8_t *p = r + 4 + 4 * i;
+            if (p[1] >> 4) {
+                put(l, "  key %u", p[1] >> 4);
+                continue;
+            }
+            put(l, "  #%u %u,%u", p[3] >> 4, (unsigned)(p[0] | (p[1] & 0x0F) << 8),
+                (unsigned)(p[2] | (p[3] & 0x0F) << 8));
+        }
+        return;
+    }
+    if (len == 4 && (st->gsl_reg == GSL_REG_STATUS || st->gsl_reg == GSL_REG_ID)) {
+        uint32_t v = r[0] | r[1] << 8 | r[2] << 16 | (uint32_t)r[3] << 24;
+        put(l, "%s %08X", gsl_reg_name(st->gsl_reg), (unsigned)v);
+        return;
+    }
+    put(l, "reg %02X: ", st->gsl_reg);
+    put_hex(l, r, len, 16);
+}
+
+// ---- Main ----
+
+static void usage(const char *prog) {
+    printf("Usage: %s [--raw] [--addr <hex>] [--summary] <capture>\n"
+           "\n"
+           "  --raw           also print the bytes of every transaction\n"
+           "  --addr <hex>    only print transactions to this 7-bit address\n"
+           "  --summary       only print the per-address totals\n"
+           "\n"
+           "Captures are written by any tool run with $%s=<file>.\n",
+           prog, I2C_CAPTURE_ENV);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path    = NULL;
+    int         raw     = 0;
+    int         summary = 0;
+    int         only    = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--raw") == 0) {
+            raw = 1;
+        } else if (strcmp(argv[i], "--summary") == 0) {
+            summary = 1;
+        } else if (strcmp(argv[i], "--addr") == 0 && i + 1 < argc) {
+            char *end;
+            only = (int)strtol(argv[++i], &end, 16);
+            if (*end || only < 0 || only > 0x7F) {
+                fprintf(stderr, "Error: --addr must be a 7-bit address in hex\n");
+                return 1;
+            }
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    i2c_capture_file_t *cap = i2c_capture_load(path);
+    if (!cap)
+        return 1;
+
+    time_t    start = (time_t)(cap->start_realtime_ns / 1000000000ull);
+    char      when[64];
+    struct tm tm;
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&start, &tm));
+    printf("%s: %zu transactions, started %s\n", path, cap->count, when);
+
+    static DecodeState state[128];
+    static AddrStats   stats[128];
+
+    for (size_t i = 0; i < cap->count; i++) {
+        const i2c_capture_record_t *rec = &cap->records[i];
+        DecodeState                *st  = &state[rec->addr & 0x7F];
+        AddrStats                  *as  = &stats[rec->addr & 0x7F];
+        Line                        l   = { .len = 0 };
+        int                         bad = 0;
+
+        as->xfers++;
+        as->bytes   += rec->wlen + rec->rlen;
+        as->busy_ns += rec->dur_ns;
+
+        if (rec->failed) {
+            as->failed++;
+            put(&l, "NACK");
+            if (rec->wlen) {
+                put(&l, " writing ");
+                put_hex(&l, rec->wbuf, rec->wlen, 4);
+            }
+            if (rec->rlen)
+                put(&l, "%sreading %u", rec->wlen ? ", " : " ", rec->rlen);
+        } else if (!rec->wlen && rec->rlen == 1) {
+            // tools probe for a device with a 1-byte read
+            put(&l, "probe");
+        } else {
+            if (rec->wlen) {
+                if (rec->addr == I2C_APP_ADDR)
+                    app_write(st, &l, rec->wbuf, rec->wlen);
+                else if (rec->addr == I2C_BL_ADDR)
+                    bl_write(st, &l, rec->wbuf, rec->wlen);
+                else if (rec->addr == GSL_ADDR)
+                    gsl_write(st, &l, rec->wbuf, rec->wlen);
+                else
+                    put_hex(&l, rec->wbuf, rec->wlen, 16);
+            }
+            if (rec->rlen) {
+                if (rec->wlen)
+                    put(&l, " -> ");
+                if (rec->addr == I2C_APP_ADDR) {
+                    bad = app_read(st, &l, rec->rbuf, rec->rlen);
+                    st->app_mode = 0;
+                } else if (rec->addr == I2C_BL_ADDR) {
+                    bad = bl_read(st, &l, rec->rbuf, rec->rlen);
+                } else if (rec->addr == GSL_ADDR) {
+                    gsl_read(st, &l, rec->rbuf, rec->rlen);
+                } else {
+                    put_hex(&l, rec->rbuf, rec->rlen, 16);
+                }
+            }
+        }
+        as->crc_errors += bad;
+
+        if (summary || (only >= 0 && rec->addr != only))
+            continue;
+
+        printf("%12.6f %8.1fus  %02X %c%c  %s\n", rec->t_ns / 1e9, rec->dur_ns / 1e3, rec->addr,
+               rec->wlen ? 'W' : '-', rec->rlen ? 'R' : '-', l.text);
+        if (raw) {
+            if (rec->wlen) {
+                Line h = { .len = 0 };
+                put_hex(&h, rec->wbuf, rec->wlen, rec->wlen);
+                printf("%28s w: %s\n", "", h.text);
+            }
+            if (rec->rlen && !rec->failed) {
+                Line h = { .len = 0 };
+                put_hex(&h, rec->rbuf, rec->rlen, rec->rlen);
+                printf("%28s r: %s\n", "", h.text);
+            }
+        }
+    }
+
+    double span = cap->count ? (cap->records[cap->count - 1].t_ns - cap->records[0].t_ns) / 1e9 : 0;
+
+    printf("\n%-6s %9s %8s %8s %10s %9s %8s\n", "addr", "xfers", "failed", "crc err", "bytes", "busy ms", "rate/s");
+    for (int a = 0; a < 128; a++) {
+        const AddrStats *as = &stats[a];
+
+        if (!as->xfers)
+            continue;
+        printf("0x%02X   %9lu %8lu %8lu %10lu %9.1f %8.1f\n", a, as->xfers, as->failed, as->crc_errors,
+               as->bytes, as->busy_ns / 1e6, span > 0 ? as->xfers / span : 0.0);
+    }
+
+    i2c_capture_free(cap);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "topper_shm.h"
+
+// Reference reader for the ring topperd --shm publishes: no socket, no bus,
+// no locks. Prints the newest sample, the last N, or follows new ones.
+
+#define FOLLOW_SLEEP_US     1000
+
+static void print_sample(const topper_sample_t *s) {
+    printf("%10llu %10.6f  buttons=%04X  axes=%3u %3u %3u %3u  status=%02X\n",
+           (unsigned long long)s->seq, s->timestamp_ns / 1e9, s->buttons,
+           s->axes[0], s->axes[1], s->axes[2], s->axes[3], s->status);
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [--path <file>] [--history <n> | --follow]\n"
+           "\n"
+           "  --path <file>    ring published by topperd --shm (default %s)\n"
+           "  --history <n>    print the last n samples still in the ring (max %d)\n"
+           "  --follow         print samples as they are published, and the rate each second\n",
+           prog, TOPPER_SHM_PATH, TOPPER_SHM_SLOTS);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path    = NULL;
+    int         history = 0;
+    int         follow  = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--path") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            history = atoi(argv[++i]);
+            if (history < 1 || history > TOPPER_SHM_SLOTS) {
+                fprintf(stderr, "Error: --history must be 1-%d\n", TOPPER_SHM_SLOTS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--follow") == 0) {
+            follow = 1;
+        } else {
+            usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    const topper_shm_t *shm = topper_shm_open(path);
+    if (!shm) {
+        fprintf(stderr, "Failed to map %s: %s (is topperd running with --shm?)\n",
+                path ? path : TOPPER_SHM_PATH, strerror(errno));
+        return 1;
+    }
+
+    topper_sample_t s;
+    if (topper_shm_latest(shm, &s) < 0) {
+        fprintf(stderr, "No samples published yet.\n");
+        if (!follow) {
+            topper_shm_close(shm);
+            return 1;
+        }
+        s.seq = 0;
+    }
+
+    if (history) {
+        uint64_t first = s.seq > (uint64_t)history ? s.seq - history + 1 : 1;
+        for (uint64_t seq = first; seq <= s.seq; seq++) {
+            topper_sample_t h;
+            if (topper_shm_get(shm, seq, &h) == 0)
+                print_sample(&h);
+        }
+    } else if (!follow) {
+        print_sample(&s);
+    }
+
+    if (follow) {
+        uint64_t last       = s.seq;
+        uint64_t window_seq = s.seq;
+        uint64_t window_ns  = s.timestamp_ns;
+
+        for (;;) {
+            topper_sample_t n;
+            if (topper_shm_latest(shm, &n) < 0 || n.seq == last) {
+                usleep(FOLLOW_SLEEP_US);
+                continue;
+            }
+            // Catch up on anything published since the last pass
+            for (uint64_t seq = last + 1; seq <= n.seq; seq++) {
+                topper_sample_t h;
+                if (topper_shm_get(shm, seq, &h) == 0)
+                    print_sample(&h);
+            }
+            last = n.seq;
+
+            if (n.timestamp_ns - window_ns >= 1000000000u) {
+                if (window_ns)
+                    printf("-- %.1f samples/s\n",
+                           (n.seq - window_seq) * 1e9 / (double)(n.timestamp_ns - window_ns));
+                window_seq = n.seq;
+                window_ns  = n.timestamp_ns;
+            }
+            fflush(stdout);
+        }
+    }
+
+    topper_shm_close(shm);
+    return 0;
+}
@@ -0,0 +1,503 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <grp.h>
+
+#include "topper_protocol.h"
+#include "i2c_bus.h"
+#include "topper_link.h"
+#include "topper_shm.h"
+#include "realtime.h"
+
+// ---- Constants ----------------------------------------------------------------
+
+#define MAX_CLIENTS         32
+#define SOCKET_GROUP        "i2c"       // owns /dev/i2c-* on Raspberry Pi OS
+
+// ---- Globals ------------------------------------------------------------------
+
+static i2c_bus_t         *bus         = NULL;
+static int                listen_fd   = -1;
+static const char        *socket_path = NULL;
+static const char        *socket_group = SOCKET_GROUP;
+static bool               socket_group_set = false;    // --socket-group given
+static volatile sig_atomic_t running  = 1;
+
+static struct pollfd      fds[1 + MAX_CLIENTS];
+static int                num_clients = 0;
+
+// Newest report frame with a valid CRC, shared by every client's REPORT requests
+static uint8_t            cached_frame[REPORT_LEN];
+static uint64_t           cached_at_us = 0;
+
+// --shm: every valid frame is also published to the shared-memory ring
+static bool               shm_enabled = false;
+static topper_shm_t      *shm         = NULL;
+static const char        *shm_path    = TOPPER_SHM_PATH;
+static uint64_t           sample_seq  = 0;
+
+// --poll-hz: read frames on our own schedule as well as on request
+static uint32_t           poll_period_us = 0;
+
+// --realtime: SCHED_FIFO, locked memory, optional CPU pinning
+static bool               realtime  = false;
+static realtime_config_t  rt_config = { REALTIME_DEFAULT_PRIORITY, -1 };
+
+static struct {
+    unsigned long requests[4];      // indexed by topperd_op_t
+    unsigned long cache_hits;
+    unsigned long bus_errors;
+    unsigned long crc_errors;
+    unsigned long clients;
+    unsigned long polls;
+    unsigned long poll_misses;      // whole --poll-hz periods the loop fell behind
+} stats;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// ---- Request handling ---------------------------------------------------------
+//
+// Requests run to completion one at a time, so a mode command and the read
+// that follows it are never interleaved with another client's traffic.
+
+static void publish_frame(const uint8_t frame[REPORT_LEN]) {
+    struct timespec ts;
+    topper_sample_t sample;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sample.seq          = ++sample_seq;
+    sample.timestamp_ns = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    sample.buttons      = (uint16_t)frame[REPORT_BUTTONS] | ((uint16_t)frame[REPORT_BUTTONS + 1] << 8);
+    sample.axes[0]      = frame[REPORT_JOY_LX];
+    sample.axes[1]      = frame[REPORT_JOY_LY];
+    sample.axes[2]      = frame[REPORT_JOY_RX];
+    sample.axes[3]      = frame[REPORT_JOY_RY];
+    sample.status       = frame[REPORT_STATUS];
+    sample.reserved     = 0;
+    topper_shm_publish(shm, &sample);
+}
+
+// Reads a report frame from the bus; valid frames refresh the cache and the ring.
+static int read_frame(uint8_t frame[REPORT_LEN]) {
+    if (i2c_bus_read(bus, I2C_APP_ADDR, frame, REPORT_LEN) < 0) {
+        stats.bus_errors++;
+        return TOPPER_ERR_IO;
+    }
+    if (!topper_report_valid(frame)) {
+        stats.crc_errors++;
+        return TOPPER_ERR_CRC;
+    }
+    memcpy(cached_frame, frame, REPORT_LEN);
+    cached_at_us = now_us();
+    if (shm)
+        publish_frame(frame);
+    return TOPPER_OK;
+}
+
+static void do_report(const topperd_req_t *req, topperd_resp_t *resp) {
+    uint64_t now = now_us();
+
+    resp->len = REPORT_LEN;
+    if (cached_at_us && req->max_age_us && now - cached_at_us <= req->max_age_us) {
+        memcpy(resp->data, cached_frame, REPORT_LEN);
+        resp->age_us = (uint32_t)(now - cached_at_us);
+        stats.cache_hits++;
+        return;
+    }
+
+    resp->status = (int8_t)read_frame(resp->data);
+    if (resp->status == TOPPER_ERR_IO)
+        resp->len = 0;
+}
+
+// A client read within the last half period already refreshed the ring.
+static void poll_tick(void) {
+    uint8_t frame[REPORT_LEN];
+
+    if (cached_at_us && now_us() - cached_at_us < poll_period_us / 2)
+        return;
+    stats.polls++;
+    read_frame(frame);
+}
+
+static void do_command(const topperd_req_t *req, topperd_resp_t *resp) {
+    if (req->len == 0 || req->len > TOPPERD_MAX_DATA ||
+        i2c_bus_write(bus, I2C_APP_ADDR, req->data, req->len) < 0) {
+        resp->status = TOPPER_ERR_IO;
+        stats.bus_errors++;
+    }
+}
+
+static void do_query(const topperd_req_t *req, topperd_resp_t *resp) {
+    if (req->len == 0 || req->len > TOPPERD_MAX_DATA ||
+        req->reply_len == 0 || req->reply_len > TOPPERD_MAX_DATA ||
+        i2c_bus_write(bus, I2C_APP_ADDR, req->data, req->len) < 0) {
+        resp->status = TOPPER_ERR_IO;
+        stats.bus_errors++;
+        return;
+    }
+    usleep(TOPPER_CMD_DELAY_US);
+    if (i2c_bus_read(bus, I2C_APP_ADDR, resp->data, req->reply_len) < 0) {
+        resp->status = TOPPER_ERR_IO;
+        stats.bus_errors++;
+        return;
+    }
+    resp->len = req->reply_len;
+}
+
+// Serves one request from a client. Returns false if the client should be dropped.
+static bool serve_client(int fd) {
+    topperd_req_t  req;
+    topperd_resp_t resp = {0};
+    ssize_t        n    = recv(fd, &req, sizeof(req), MSG_DONTWAIT);
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return true;
+    if (n != (ssize_t)sizeof(req))
+        return false;   // disconnected or not speaking our protocol
+
+    switch (req.op) {
+        case TOPPERD_OP_REPORT:  do_report(&req, &resp);  break;
+        case TOPPERD_OP_COMMAND: do_command(&req, &resp); break;
+        case TOPPERD_OP_QUERY:   do_query(&req, &resp);   break;
+        default:                 resp.status = TOPPER_ERR_IO; break;
+    }
+    if (req.op < sizeof(stats.requests) / sizeof(stats.requests[0]))
+        stats.requests[req.op]++;
+
+    // A client that stopped reading fills its socket buffer; drop it rather
+    // than block the poll loop and every other client behind it
+    return send(fd, &resp, sizeof(resp), MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)sizeof(resp);
+}
+
+// ---- Socket -------------------------------------------------------------------
+
+// Looks a group up by name or number in /etc/group. fgetgrent() reads the file
+// directly, so the static build needs no NSS modules. Returns -1 if unknown.
+static gid_t find_group(const char *name) {
+    char  *end;
+    long   num = strtol(name, &end, 10);
+    gid_t  gid = (gid_t)-1;
+
+    if (*end == '\0' && end != name && num >= 0)
+        return (gid_t)num;
+
+    FILE *f = fopen("/etc/group", "r");
+    if (!f)
+        return gid;
+    struct group *gr;
+    while ((gr = fgetgrent(f)) != NULL) {
+        if (strcmp(gr->gr_name, name) == 0) {
+            gid = gr->gr_gid;
+            break;
+        }
+    }
+    fclose(f);
+    return gid;
+}
+
+// Removes a socket left behind by a daemon that died, but refuses to take the
+// path from one that still answers.
+static int claim_socket_path(const struct sockaddr_un *addr) {
+    struct stat st;
+
+    if (lstat(addr->sun_path, &st) < 0)
+        return 0;
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s exists and is not a socket\n", addr->sun_path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int ret = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+    int err = errno;
+    close(fd);
+    if (ret == 0 || (err != ECONNREFUSED && err != ENOENT)) {
+        fprintf(stderr, "Another topperd is already serving %s\n", addr->sun_path);
+        return -1;
+    }
+    unlink(addr->sun_path);
+    return 0;
+}
+
+static int open_socket(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    // Clients get the same access as to /dev/i2c-*: the socket's group only
+    gid_t gid = find_group(socket_group);
+    if (gid == (gid_t)-1) {
+        if (socket_group_set) {
+            fprintf(stderr, "Unknown group: %s\n", socket_group);
+            return -1;
+        }
+        fprintf(stderr, "topperd: no '%s' group; only uid %d can connect\n",
+                socket_group, (int)geteuid());
+    }
+
+    if (claim_socket_path(&addr) < 0)
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    // Bind owner-only so the socket is never reachable with looser permissions
+    mode_t old_umask = umask(0177);
+    int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_umask);
+    if (bound < 0) {
+        fprintf(stderr, "Failed to bind %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (gid != (gid_t)-1 && (chown(path, (uid_t)-1, gid) < 0 || chmod(path, 0660) < 0)) {
+        fprintf(stderr, "Failed to give %s to group %s: %s\n", path, socket_group, strerror(errno));
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    if (listen(fd, 8) < 0) {
+        perror("listen");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+static void accept_client(void) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (num_clients == MAX_CLIENTS) {
+        fprintf(stderr, "Too many clients; rejecting one.\n");
+        close(fd);
+        return;
+    }
+    fds[1 + num_clients].fd     = fd;
+    fds[1 + num_clients].events = POLLIN;
+    num_clients++;
+    stats.clients++;
+}
+
+static void drop_client(int i) {
+    close(fds[1 + i].fd);
+    fds[1 + i] = fds[num_clients];
+    num_clients--;
+}
+
+// ---- Main ---------------------------------------------------------------------
+
+static void handle_signal(int sig) {
+    (void)sig;
+    running = 0;
+}
+
+static void print_stats(void) {
+    printf("topperd: %lu client(s); %lu report (%lu from cache), %lu command, %lu query request(s); "
+           "%lu poll(s), %lu missed poll deadline(s), %llu sample(s) published; "
+           "%lu bus error(s), %lu CRC error(s)\n",
+           stats.clients, stats.requests[TOPPERD_OP_REPORT], stats.cache_hits,
+           stats.requests[TOPPERD_OP_COMMAND], stats.requests[TOPPERD_OP_QUERY],
+           stats.polls, stats.poll_misses, (unsigned long long)sample_seq,
+           stats.bus_errors, stats.crc_errors);
+    if (realtime) {
+        printf("topperd: ");
+        realtime_report(stdout);
+    }
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [--bus <spec>] [--socket <path>] [--socket-group <group>] [--shm]\n"
+           "       [--shm-path <path>] [--poll-hz <n>] [--realtime] [--rt-priority <n>] [--cpu <n>]\n"
+           "\n"
+           "Owns the ATmega at 0x%02X and serves gamepad, mapper, gpio and backlight\n"
+           "clients over a Unix socket.\n"
+           "\n"
+           "  --bus <spec>       I2C bus (default %s)\n"
+           "  --socket <path>    listening socket (default %s, or $TOPPERD_SOCKET)\n"
+           "  --socket-group <g> group allowed to connect, name or gid (default %s)\n"
+           "  --shm              publish every valid input frame to a shared-memory ring\n"
+           "  --shm-path <path>  ring file (default %s)\n"
+           "  --poll-hz <n>      also read the inputs n times a second (1-1000; default off)\n"
+           "  --realtime         run as SCHED_FIFO with memory locked\n"
+           "  --rt-priority <n>  SCHED_FIFO priority for --realtime (1-99; default %d)\n"
+           "  --cpu <n>          with --realtime, pin to CPU n\n",
+           prog, I2C_APP_ADDR, TOPPER_DEFAULT_BUS, TOPPERD_SOCKET, SOCKET_GROUP, TOPPER_SHM_PATH,
+           REALTIME_DEFAULT_PRIORITY);
+}
+
+int main(int argc, char *argv[]) {
+    const char *bus_spec = TOPPER_DEFAULT_BUS;
+
+    socket_path = topperd_socket_path();
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (strcmp(argv[i], "--bus") == 0 && i + 1 < argc) {
+            bus_spec = argv[++i];
+        } else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--socket-group") == 0 && i + 1 < argc) {
+            socket_group     = argv[++i];
+            socket_group_set = true;
+        } else if (strcmp(argv[i], "--shm") == 0) {
+            shm_enabled = true;
+        } else if (strcmp(argv[i], "--shm-path") == 0 && i + 1 < argc) {
+            shm_path = argv[++i];
+        } else if (strcmp(argv[i], "--poll-hz") == 0 && i + 1 < argc) {
+            int hz = atoi(argv[++i]);
+            if (hz < 1 || hz > 1000) {
+                fprintf(stderr, "Error: --poll-hz must be 1-1000\n");
+                return 1;
+            }
+            poll_period_us = 1000000u / (uint32_t)hz;
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else if (strcmp(argv[i], "--rt-priority") == 0 && i + 1 < argc) {
+            rt_config.priority = atoi(argv[++i]);
+            if (rt_config.priority < 1 || rt_config.priority > 99) {
+                fprintf(stderr, "Error: --rt-priority must be 1-99\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            rt_config.cpu = atoi(argv[++i]);
+            if (rt_config.cpu < 0 || rt_config.cpu > 1023) {
+                fprintf(stderr, "Error: --cpu must be 0-1023\n");
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    bus = i2c_bus_open(bus_spec);
+    if (!bus)
+        return 1;
+
+    listen_fd = open_socket(socket_path);
+    if (listen_fd < 0) {
+        i2c_bus_close(bus);
+        return 1;
+    }
+
+    if (shm_enabled) {
+        shm = topper_shm_create(shm_path);
+        if (!shm) {
+            fprintf(stderr, "Failed to create %s: %s\n", shm_path, strerror(errno));
+            close(listen_fd);
+            unlink(socket_path);
+            i2c_bus_close(bus);
+            return 1;
+        }
+    }
+
+    struct sigaction sa = { .sa_handler = handle_signal };
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("topperd: serving %s on %s", bus_spec, socket_path);
+    if (shm)
+        printf(", publishing to %s", shm_path);
+    if (poll_period_us)
+        printf(", polling every %u us", poll_period_us);
+    printf("\n");
+
+    // After the bus, socket and ring are set up, so all of them are locked in
+    if (realtime) {
+        if (realtime_enter(&rt_config) == 0)
+            printf("topperd: real-time mode, SCHED_FIFO priority %d\n", rt_config.priority);
+        else
+            fprintf(stderr, "topperd: continuing without full real-time mode\n");
+    }
+    fflush(stdout);
+
+    fds[0].fd     = listen_fd;
+    fds[0].events = POLLIN;
+
+    uint64_t next_poll_us = now_us() + poll_period_us;
+
+    while (running) {
+        struct timespec  timeout;
+        struct timespec *tp = NULL;
+
+        if (poll_period_us) {
+            uint64_t now  = now_us();
+            uint64_t wait = next_poll_us > now ? next_poll_us - now : 0;
+            timeout.tv_sec  = (time_t)(wait / 1000000u);
+            timeout.tv_nsec = (long)(wait % 1000000u) * 1000;
+            tp = &timeout;
+        }
+
+        int ready = ppoll(fds, 1 + num_clients, tp, NULL);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+
+        if (poll_period_us && now_us() >= next_poll_us) {
+            poll_tick();
+            next_poll_us += poll_period_us;
+            // Fell a whole period behind: restart the schedule rather than burst
+            uint64_t now = now_us();
+            if (next_poll_us < now) {
+                stats.poll_misses += (now - next_poll_us) / poll_period_us + 1;
+                next_poll_us = now + poll_period_us;
+            }
+        }
+        if (ready == 0)
+            continue;
+
+        // One request per ready client per pass keeps a busy poller from starving the rest
+        for (int i = num_clients - 1; i >= 0; i--) {
+            short ev = fds[1 + i].revents;
+            if (!ev)
+                continue;
+            if (!(ev & POLLIN) || !serve_client(fds[1 + i].fd))
+                drop_client(i);
+        }
+
+        if (fds[0].revents & POLLIN)
+            accept_client();
+    }
+
+    while (num_clients)
+        drop_client(num_clients - 1);
+    close(listen_fd);
+    unlink(socket_path);
+    topper_shm_destroy(shm, shm_path);
+    i2c_bus_close(bus);
+    print_stats();
+    return 0;
+}
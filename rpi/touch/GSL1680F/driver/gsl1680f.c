@@ -6,9 +6,14 @@
 #include <fcntl.h>
 #include <time.h>
 #include <signal.h>
-#include <linux/i2c-dev.h>
+#include <errno.h>
 #include <linux/uinput.h>
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
+
+#include "i2c_bus.h"
+#include "lat_hist.h"
+#include "realtime.h"
 
 #define I2C_BUS      "/dev/i2c-1"
 #define GSL_ADDR     0x40
@@ -27,6 +32,8 @@
 #define SCREEN_MAX_X 800
 #define SCREEN_MAX_Y 480
 
+#define POLL_PERIOD_NS  15000000ULL     /* read the touch data every 15 ms */
+
 /* ---- jitter filter config ---- */
 #define DEAD_ZONE   8    /* if movement from previous frame is within this
 range on both axes, average rather than emit raw */
@@ -36,11 +43,18 @@ range on both axes, average rather than emit raw */
 #define OFFSET_X    0    /* shift touch frame horizontally; positive = right */
 #define OFFSET_Y    0    /* shift touch frame vertically;   positive = down  */
 
-static volatile int running = 1;
-static int i2c_fd = -1;
+static volatile sig_atomic_t running    = 1;
+static volatile sig_atomic_t dump_stats = 0;
+static i2c_bus_t *bus = NULL;
 static int ui_fd  = -1;
 
-static void on_sigint(int sig) { (void)sig; running = 0; }
+static void on_signal(int sig)
+{
+    if (sig == SIGUSR1)
+        dump_stats = 1;
+    else
+        running = 0;
+}
 
 static void msleep(int ms)
 {
@@ -48,6 +62,126 @@ static void msleep(int ms)
     nanosleep(&ts, NULL);
 }
 
+/* ---- latency trace ---- */
+
+/*
+ * With --trace every poll is timestamped on CLOCK_MONOTONIC: when the data
+ * read starts, when it returns and when the uinput write for the frame
+ * returns. Each event batch also carries MSC_TIMESTAMP, the read completion
+ * time in microseconds (wrapping at 32 bits), so a reader that selects
+ * CLOCK_MONOTONIC with EVIOCSCLOCKID can subtract it from the event time.
+ */
+static int        trace = 0;
+static uint64_t   trace_batches;
+static lat_hist_t trace_read;       /* read start to touch data returned */
+static lat_hist_t trace_deliver;    /* touch data returned to uinput write returned */
+static lat_hist_t trace_total;      /* read start to uinput write returned */
+static uint64_t   t_poll_start;
+static uint64_t   t_read_done;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t us_between(uint64_t from, uint64_t to)
+{
+    return to > from ? (uint32_t)((to - from) / 1000) : 0;
+}
+
+static void print_trace_stats(void)
+{
+    fprintf(stderr, "latency: %llu event batches\n", (unsigned long long)trace_batches);
+    lat_hist_print(stderr, "i2c read", &trace_read, "us");
+    lat_hist_print(stderr, "frame to event", &trace_deliver, "us");
+    lat_hist_print(stderr, "poll to event", &trace_total, "us");
+}
+
+/* ---- poll timer ---- */
+
+/*
+ * The loop waits on a timerfd armed with absolute CLOCK_MONOTONIC deadlines
+ * (start + k * POLL_PERIOD_NS), so the read time and wakeup latency never
+ * push later polls back. Expirations beyond the first are deadlines the loop
+ * ran past; they are counted and skipped rather than caught up in a burst.
+ */
+static int        timer_fd = -1;
+static uint64_t   next_deadline;
+static uint64_t   last_wake;
+static uint64_t   poll_cycles;
+static uint64_t   poll_missed;
+static lat_hist_t poll_period;      /* wakeup to wakeup */
+static lat_hist_t poll_lateness;    /* deadline to wakeup */
+
+/* --realtime: SCHED_FIFO, locked memory, optional CPU pinning */
+static int               realtime  = 0;
+static realtime_config_t rt_config = { REALTIME_DEFAULT_PRIORITY, -1 };
+
+static int init_timer(void)
+{
+    /* blocking: a signal interrupts the read, as nothing else wakes the loop */
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        fprintf(stderr, "timerfd_create: %m\n");
+        return -1;
+    }
+
+    next_deadline = now_ns() + POLL_PERIOD_NS;
+    struct itimerspec its = {
+        .it_interval = { 0, (long)POLL_PERIOD_NS },
+        .it_value    = { (time_t)(next_deadline / 1000000000ULL), (long)(next_deadline % 1000000000ULL) },
+    };
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        fprintf(stderr, "timerfd_settime: %m\n");
+        close(timer_fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* Waits for the next poll deadline. Returns 0 if a signal came first. */
+static int wait_tick(void)
+{
+    uint64_t expirations;
+
+    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        if (errno != EINTR) {
+            fprintf(stderr, "poll timer read failed: %m\n");
+            running = 0;
+        }
+        return 0;
+    }
+
+    uint64_t now = now_ns();
+
+    next_deadline += (expirations - 1) * POLL_PERIOD_NS;
+    poll_missed   += expirations - 1;
+    poll_cycles++;
+
+    lat_hist_record(&poll_lateness, us_between(next_deadline, now));
+    if (last_wake)
+        lat_hist_record(&poll_period, us_between(last_wake, now));
+
+    last_wake      = now;
+    next_deadline += POLL_PERIOD_NS;
+    return 1;
+}
+
+static void print_poll_stats(void)
+{
+    fprintf(stderr, "polling: every %llu ms, %llu cycles, %llu missed deadlines\n",
+            POLL_PERIOD_NS / 1000000ULL, (unsigned long long)poll_cycles,
+            (unsigned long long)poll_missed);
+    lat_hist_print(stderr, "period", &poll_period, "us");
+    lat_hist_print(stderr, "wakeup lateness", &poll_lateness, "us");
+    if (realtime) {
+        fprintf(stderr, "  ");
+        realtime_report(stderr);
+    }
+}
+
 /* ---- I2C access ---- */
 
 static int gsl_write(uint8_t reg, const uint8_t *data, size_t len)
@@ -55,7 +189,7 @@ static int gsl_write(uint8_t reg, const uint8_t *data, size_t len)
     uint8_t buf[1 + 32];
     buf[0] = reg;
     memcpy(&buf[1], data, len);
-    if (write(i2c_fd, buf, len + 1) != (ssize_t)(len + 1)) {
+    if (i2c_bus_write(bus, GSL_ADDR, buf, len + 1) < 0) {
         fprintf(stderr, "write reg 0x%02x failed: %m\n", reg);
         return -1;
     }
@@ -75,11 +209,11 @@ static int gsl_write_u32(uint8_t reg, uint32_t val)
 
 static int gsl_read(uint8_t reg, uint8_t *data, size_t len)
 {
-    if (write(i2c_fd, &reg, 1) != 1) {
+    if (i2c_bus_write(bus, GSL_ADDR, &reg, 1) < 0) {
         fprintf(stderr, "set address pointer 0x%02x failed: %m\n", reg);
         return -1;
     }
-    if (read(i2c_fd, data, len) != (ssize_t)len) {
+    if (i2c_bus_read(bus, GSL_ADDR, data, len) < 0) {
         fprintf(stderr, "read reg 0x%02x failed: %m\n", reg);
         return -1;
     }
@@ -142,14 +276,41 @@ static int gsl_setup(const char *fw_path)
 
 /* ---- uinput virtual touchscreen ---- */
 
-static int emit(int fd, int type, int code, int value)
+/*
+ * A frame's events are collected and written with one write(), so the
+ * reader sees the whole frame at once and each frame costs one syscall:
+ * at most 4 events per slot, BTN_TOUCH, MSC_TIMESTAMP and SYN_REPORT.
+ */
+static struct input_event ev_batch[MAX_FINGERS * 4 + 3];
+static int                ev_count;
+
+static void emit(int type, int code, int value)
 {
-    struct input_event ev;
-    memset(&ev, 0, sizeof(ev));
-    ev.type  = type;
-    ev.code  = code;
-    ev.value = value;
-    return write(fd, &ev, sizeof(ev)) == sizeof(ev) ? 0 : -1;
+    struct input_event *ev = &ev_batch[ev_count++];
+    memset(ev, 0, sizeof(*ev));
+    ev->type  = type;
+    ev->code  = code;
+    ev->value = value;
+}
+
+static void flush_events(void)
+{
+    if (ev_count == 0)      /* nothing changed: an empty SYN_REPORT is dropped anyway */
+        return;
+
+    if (trace)
+        emit(EV_MSC, MSC_TIMESTAMP, (int32_t)(uint32_t)(t_read_done / 1000));
+    emit(EV_SYN, SYN_REPORT, 0);
+    if (write(ui_fd, ev_batch, sizeof(ev_batch[0]) * ev_count) < 0)
+        fprintf(stderr, "uinput write failed: %m\n");
+    ev_count = 0;
+
+    if (trace) {
+        uint64_t t_written = now_ns();
+        trace_batches++;
+        lat_hist_record(&trace_deliver, us_between(t_read_done, t_written));
+        lat_hist_record(&trace_total, us_between(t_poll_start, t_written));
+    }
 }
 
 static int uinput_setup_axis(int fd, int code, int min, int max)
@@ -176,6 +337,10 @@ static int create_uinput_device(void)
     ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_X);
     ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_Y);
     ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT);
+    if (trace) {
+        ioctl(fd, UI_SET_EVBIT,  EV_MSC);
+        ioctl(fd, UI_SET_MSCBIT, MSC_TIMESTAMP);
+    }
 
     uinput_setup_axis(fd, ABS_MT_SLOT,        0, MAX_FINGERS - 1);
     uinput_setup_axis(fd, ABS_MT_TRACKING_ID, 0, 65535);
@@ -291,7 +456,7 @@ static void process_frame(const uint8_t *buf)
     for (int slot = 0; slot < MAX_FINGERS; slot++) {
         if (frame_active[slot]) {
             any_touch = 1;
-            emit(ui_fd, EV_ABS, ABS_MT_SLOT, slot);
+            emit(EV_ABS, ABS_MT_SLOT, slot);
 
             if (!slot_active[slot]) {
                 /* first appearance: seed prev position and reset buffer,
@@ -299,7 +464,7 @@ static void process_frame(const uint8_t *buf)
                 filter_reset(slot);
                 prev_x[slot] = frame_x[slot];
                 prev_y[slot] = frame_y[slot];
-                emit(ui_fd, EV_ABS, ABS_MT_TRACKING_ID, next_tracking_id++);
+                emit(EV_ABS, ABS_MT_TRACKING_ID, next_tracking_id++);
             }
 
             int fx, fy;
@@ -312,66 +477,153 @@ static void process_frame(const uint8_t *buf)
             if (fx > SCREEN_MAX_X - 1) fx = SCREEN_MAX_X - 1;
             if (fy > SCREEN_MAX_Y - 1) fy = SCREEN_MAX_Y - 1;
 
-            emit(ui_fd, EV_ABS, ABS_MT_POSITION_X, fx);
-            emit(ui_fd, EV_ABS, ABS_MT_POSITION_Y, fy);
+            emit(EV_ABS, ABS_MT_POSITION_X, fx);
+            emit(EV_ABS, ABS_MT_POSITION_Y, fy);
 
         } else if (slot_active[slot]) {
             /* finger lifted: clear filter state for this slot */
             filter_reset(slot);
-            emit(ui_fd, EV_ABS, ABS_MT_SLOT, slot);
-            emit(ui_fd, EV_ABS, ABS_MT_TRACKING_ID, -1);
+            emit(EV_ABS, ABS_MT_SLOT, slot);
+            emit(EV_ABS, ABS_MT_TRACKING_ID, -1);
         }
 
         slot_active[slot] = frame_active[slot];
     }
 
     if (any_touch != prev_any_touch) {
-        emit(ui_fd, EV_KEY, BTN_TOUCH, any_touch);
+        emit(EV_KEY, BTN_TOUCH, any_touch);
         prev_any_touch = any_touch;
     }
 
-    emit(ui_fd, EV_SYN, SYN_REPORT, 0);
+    flush_events();
 }
 
 /* ---- main ---- */
 
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [--bus <spec>] [--trace] [--realtime] [--rt-priority <n>] [--cpu <n>]\n"
+            "       <firmware.fw>\n"
+            "  --bus <spec>        I2C bus, any i2c_bus spec, e.g. replay:<capture> (default %s)\n"
+            "  --trace             time each read and uinput write, add MSC_TIMESTAMP to events\n"
+            "  --realtime          run as SCHED_FIFO with memory locked (needs root or\n"
+            "                      CAP_SYS_NICE and CAP_IPC_LOCK)\n"
+            "  --rt-priority <n>   SCHED_FIFO priority for --realtime (1-99; default %d)\n"
+            "  --cpu <n>           with --realtime, pin the driver to CPU n\n"
+            "Poll statistics, missed 15 ms deadlines included, and the --trace latency\n"
+            "histograms are printed on exit and on SIGUSR1.\n",
+            prog, I2C_BUS, REALTIME_DEFAULT_PRIORITY);
+}
+
 int main(int argc, char **argv)
 {
-    if (argc < 2) {
-        fprintf(stderr, "usage: %s <firmware.fw>\n", argv[0]);
+    const char *bus_spec = I2C_BUS;
+    const char *fw_path  = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bus") == 0 && i + 1 < argc) {
+            bus_spec = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            trace = 1;
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = 1;
+        } else if (strcmp(argv[i], "--rt-priority") == 0 && i + 1 < argc) {
+            rt_config.priority = atoi(argv[++i]);
+            if (rt_config.priority < 1 || rt_config.priority > 99) {
+                fprintf(stderr, "--rt-priority must be 1-99\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            rt_config.cpu = atoi(argv[++i]);
+            if (rt_config.cpu < 0 || rt_config.cpu > 1023) {
+                fprintf(stderr, "--cpu must be 0-1023\n");
+                return 1;
+            }
+        } else if (!fw_path && argv[i][0] != '-') {
+            fw_path = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!fw_path) {
+        usage(argv[0]);
         return 1;
     }
 
-    signal(SIGINT, on_sigint);
-
-    i2c_fd = open(I2C_BUS, O_RDWR);
-    if (i2c_fd < 0) { fprintf(stderr, "open %s: %m\n", I2C_BUS); return 1; }
-
-    if (ioctl(i2c_fd, I2C_SLAVE, GSL_ADDR) < 0) {
-        fprintf(stderr, "set slave address 0x%02x: %m\n", GSL_ADDR);
+    /* no SA_RESTART: a signal must wake the blocking timer read */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT,  &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    bus = i2c_bus_open(bus_spec);
+    if (!bus)
         return 1;
-    }
 
-    if (gsl_setup(argv[1]) < 0) {
+    if (gsl_setup(fw_path) < 0) {
         fprintf(stderr, "chip did not report OK status, aborting\n");
+        i2c_bus_close(bus);
         return 1;
     }
 
     ui_fd = create_uinput_device();
-    if (ui_fd < 0)
+    if (ui_fd < 0) {
+        i2c_bus_close(bus);
+        return 1;
+    }
+
+    if (init_timer() < 0) {
+        ioctl(ui_fd, UI_DEV_DESTROY);
+        close(ui_fd);
+        i2c_bus_close(bus);
         return 1;
+    }
+
+    /* last, so every start-up allocation is already locked in */
+    if (realtime) {
+        if (realtime_enter(&rt_config) == 0)
+            printf("real-time mode: SCHED_FIFO priority %d\n", rt_config.priority);
+        else
+            fprintf(stderr, "continuing without full real-time mode\n");
+    }
 
     printf("virtual touchscreen created, ctrl-c to stop\n");
+    fflush(stdout);
     while (running) {
         uint8_t buf[DATA_LEN];
+
+        if (dump_stats) {
+            dump_stats = 0;
+            print_poll_stats();
+            if (trace)
+                print_trace_stats();
+        }
+        if (!wait_tick())
+            continue;
+
+        if (trace)
+            t_poll_start = now_ns();
         if (gsl_read(REG_DATA, buf, DATA_LEN) < 0)
             break;
+        if (trace) {
+            t_read_done = now_ns();
+            lat_hist_record(&trace_read, us_between(t_poll_start, t_read_done));
+        }
         process_frame(buf);
-        msleep(15);
     }
 
+    print_poll_stats();
+    if (trace)
+        print_trace_stats();
+
+    close(timer_fd);
     ioctl(ui_fd, UI_DEV_DESTROY);
     close(ui_fd);
-    close(i2c_fd);
+    i2c_bus_close(bus);
     return 0;
 }